@@ -219,6 +219,29 @@ struct dnet_addr_stat *stat_count_result_entry::statistics() const
 		.data<struct dnet_addr_stat>();
 }
 
+struct dnet_latency_stat *stat_count_result_entry::latency() const
+{
+	if (size() < sizeof(struct dnet_addr_stat))
+		return NULL;
+
+	struct dnet_addr_stat *as = statistics();
+	uint64_t offset = sizeof(struct dnet_addr_stat) + as->num * sizeof(struct dnet_stat_count);
+
+	if (as->num <= 0 || size() < offset + sizeof(struct dnet_latency_stat))
+		return NULL;
+
+	struct dnet_latency_stat *ls = reinterpret_cast<struct dnet_latency_stat *>(&as->count[as->num]);
+	if (ls->cmd_num <= 0 || ls->bucket_num <= 0)
+		return NULL;
+
+	offset += sizeof(struct dnet_latency_stat) +
+		(ls->cmd_num * 2 + ls->stage_num) * ls->bucket_num * sizeof(uint64_t);
+	if (size() < offset)
+		return NULL;
+
+	return ls;
+}
+
 exec_result_entry::exec_result_entry()
 {
 }
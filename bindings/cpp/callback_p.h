@@ -319,7 +319,11 @@ class base_stat_callback
 			cb.set_count(unlimited);
 
 			uint64_t cflags_pop = sess.get_cflags();
-			sess.set_cflags(cflags_pop | DNET_ATTR_CNTR_GLOBAL);
+			uint64_t cflags = cflags_pop | DNET_ATTR_CNTR_GLOBAL;
+			if (Command == DNET_CMD_STAT_COUNT)
+				cflags |= DNET_ATTR_CNTR_LATENCY;
+
+			sess.set_cflags(cflags);
 			int err = dnet_request_stat(sess.get_native(),
 				has_id ? &id : NULL, Command, func, priv);
 			sess.set_cflags(cflags_pop);
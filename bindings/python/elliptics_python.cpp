@@ -919,6 +919,32 @@ class elliptics_session: public session, public bp::wrapper<session> {
 			return create_result(std::move(session::list_indexes(id)));
 		}
 
+		/*
+		 * Commands and stages which were never executed are skipped, others get
+		 * percentiles in usecs and raw log-scale buckets
+		 */
+		static void latency_to_dict(bp::dict &dict, const char *name, const uint64_t *hist, int bucket_num) {
+			bp::list buckets;
+			unsigned long long total = 0;
+
+			for (int i = 0; i < bucket_num; ++i) {
+				total += hist[i];
+				buckets.append((unsigned long long)hist[i]);
+			}
+
+			if (!total)
+				return;
+
+			bp::dict entry;
+			entry["count"] = total;
+			entry["p50"] = (unsigned long long)dnet_latency_percentile(hist, bucket_num, 50);
+			entry["p99"] = (unsigned long long)dnet_latency_percentile(hist, bucket_num, 99);
+			entry["p999"] = (unsigned long long)dnet_latency_percentile(hist, bucket_num, 99.9);
+			entry["buckets"] = buckets;
+
+			dict[std::string(name)] = entry;
+		}
+
 		bp::list stat_log_count() {
 			bp::list statistics;
 
@@ -960,6 +986,27 @@ class elliptics_session: public session, public bp::wrapper<session> {
 				node_stat["proxy_commands"] = proxy_commands;
 				node_stat["counters"] = counters;
 
+				struct dnet_latency_stat *ls = data.latency();
+				if (ls) {
+					bp::dict latency, backend_latency, stage_latency;
+
+					for (int j = 0; j < ls->cmd_num; ++j) {
+						latency_to_dict(latency, dnet_counter_string(j, ls->cmd_num),
+								&ls->hist[j * ls->bucket_num], ls->bucket_num);
+						latency_to_dict(backend_latency, dnet_counter_string(j, ls->cmd_num),
+								&ls->hist[(ls->cmd_num + j) * ls->bucket_num], ls->bucket_num);
+					}
+
+					for (int j = 0; j < ls->stage_num; ++j) {
+						latency_to_dict(stage_latency, dnet_stage_string(j),
+								&ls->hist[(ls->cmd_num * 2 + j) * ls->bucket_num], ls->bucket_num);
+					}
+
+					node_stat["latency"] = latency;
+					node_stat["backend_latency"] = backend_latency;
+					node_stat["stage_latency"] = stage_latency;
+				}
+
 				statistics.append(node_stat);
 			}
 
@@ -14,10 +14,13 @@
  */
 
 #include <iostream>
+#include <atomic>
 #include <deque>
 #include <vector>
 #include <deque>
+#include <map>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 
 #include <boost/unordered_map.hpp>
@@ -34,8 +37,8 @@ namespace ioremap { namespace cache {
 
 class raw_data_t {
 	public:
-		raw_data_t(const char *data, size_t size) {
-			m_data.reserve(size);
+		raw_data_t(const char *data, size_t size, size_t reserve = 0) {
+			m_data.reserve(std::max(size, reserve));
 			m_data.insert(m_data.begin(), data, data + size);
 		}
 
@@ -70,6 +73,34 @@ typedef boost::intrusive::set_base_hook<boost::intrusive::tag<sync_set_tag_t>,
 					 boost::intrusive::link_mode<boost::intrusive::safe_link>
 					> sync_set_base_hook_t;
 
+/*
+ * Protects cache entry fields which are read without shard lock,
+ * it is held only for a few instructions
+ */
+class spinlock_t {
+	public:
+		spinlock_t() {
+			m_flag.clear();
+		}
+
+		void lock(void) {
+			while (m_flag.test_and_set(std::memory_order_acquire))
+				;
+		}
+
+		void unlock(void) {
+			m_flag.clear(std::memory_order_release);
+		}
+
+	private:
+		std::atomic_flag m_flag;
+};
+
+/*
+ * Entries are modified under shard lock only, but cache hits read them without it:
+ * data pointer, timestamp and user flags are read under per-entry @m_data_lock,
+ * flags checked by readers are atomic.
+ */
 class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_set_base_hook_t, public sync_set_base_hook_t {
 	public:
 		data_t(const unsigned char *id) {
@@ -78,7 +109,8 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 
 		data_t(const unsigned char *id, size_t lifetime, const char *data, size_t size, bool remove_from_disk) :
 			m_lifetime(0), m_synctime(0), m_user_flags(0),
-			m_remove_from_disk(remove_from_disk), m_remove_from_cache(false), m_only_append(false) {
+			m_remove_from_disk(remove_from_disk), m_remove_from_cache(false), m_only_append(false),
+			m_accessed(false), m_hash_next(NULL) {
 			memcpy(m_id.id, id, DNET_ID_SIZE);
 			dnet_empty_time(&m_timestamp);
 
@@ -99,9 +131,69 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		}
 
 		std::shared_ptr<raw_data_t> data(void) const {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
 			return m_data;
 		}
 
+		/*
+		 * Read replies are sent without copying and hold a reference to the data
+		 * until they leave the socket, so shared data is never modified in place.
+		 * Only append-only entries, which are never read without shard lock, are
+		 * modified in place, others get new data with update().
+		 */
+		raw_data_t &writable_data(void) {
+			if (m_data.use_count() > 1) {
+				std::shared_ptr<raw_data_t> copy(new raw_data_t(m_data->data().data(), m_data->size()));
+
+				std::lock_guard<spinlock_t> guard(m_data_lock);
+				m_data.swap(copy);
+			}
+
+			return *m_data;
+		}
+
+		void update(const std::shared_ptr<raw_data_t> &data, const dnet_time &timestamp, uint64_t user_flags) {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
+			m_data = data;
+			m_timestamp = timestamp;
+			m_user_flags = user_flags;
+		}
+
+		/* consistent copy of the fields returned by cache hit */
+		std::shared_ptr<raw_data_t> snapshot(dnet_time &timestamp, uint64_t &user_flags) const {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
+			timestamp = m_timestamp;
+			user_flags = m_user_flags;
+			return m_data;
+		}
+
+		dnet_time snapshot_timestamp(void) const {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
+			return m_timestamp;
+		}
+
+		/* CLOCK reference bit, set by cache hits and cleared by eviction scan */
+		void access(void) {
+			if (!m_accessed.load(std::memory_order_relaxed))
+				m_accessed.store(true, std::memory_order_relaxed);
+		}
+
+		bool test_and_clear_accessed(void) {
+			if (!m_accessed.load(std::memory_order_relaxed))
+				return false;
+
+			m_accessed.store(false, std::memory_order_relaxed);
+			return true;
+		}
+
+		data_t *hash_next(std::memory_order order = std::memory_order_acquire) const {
+			return m_hash_next.load(order);
+		}
+
+		void set_hash_next(data_t *next) {
+			m_hash_next.store(next, std::memory_order_release);
+		}
+
 		size_t lifetime(void) const {
 			return m_lifetime;
 		}
@@ -127,6 +219,7 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		}
 
 		void set_timestamp(const dnet_time &timestamp) {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
 			m_timestamp = timestamp;
 		}
 
@@ -135,6 +228,7 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		}
 
 		void set_user_flags(uint64_t user_flags) {
+			std::lock_guard<spinlock_t> guard(m_data_lock);
 			m_user_flags = user_flags;
 		}
 
@@ -143,19 +237,19 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		}
 
 		bool remove_from_cache() const {
-			return m_remove_from_cache;
+			return m_remove_from_cache.load(std::memory_order_relaxed);
 		}
 
 		void set_remove_from_cache(bool remove_from_cache) {
-			m_remove_from_cache = remove_from_cache;
+			m_remove_from_cache.store(remove_from_cache, std::memory_order_relaxed);
 		}
 
 		bool only_append() const {
-			return m_only_append;
+			return m_only_append.load(std::memory_order_relaxed);
 		}
 
 		void set_only_append(bool only_append) {
-			m_only_append = only_append;
+			m_only_append.store(only_append, std::memory_order_relaxed);
 		}
 
 		size_t size(void) const {
@@ -180,9 +274,12 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		dnet_time m_timestamp;
 		uint64_t m_user_flags;
 		bool m_remove_from_disk;
-		bool m_remove_from_cache;
-		bool m_only_append;
+		std::atomic<bool> m_remove_from_cache;
+		std::atomic<bool> m_only_append;
+		std::atomic<bool> m_accessed;
+		std::atomic<data_t *> m_hash_next;
 		struct dnet_raw_id m_id;
+		mutable spinlock_t m_data_lock;
 		std::shared_ptr<raw_data_t> m_data;
 };
 
@@ -213,13 +310,302 @@ typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<sync_set_base_
 					  boost::intrusive::compare<synctime_less>
 			     > sync_set_t;
 
+/*
+ * Cache hits do not take any lock, they only increment counter of the current epoch.
+ * Entries removed from the index are freed after synchronize() has waited for all
+ * readers which could have seen them. This is the same scheme node route table uses.
+ */
+class epoch_t {
+	public:
+		epoch_t() : m_epoch(0) {
+			for (int i = 0; i < readers_num; ++i) {
+				m_readers[i].count[0].store(0);
+				m_readers[i].count[1].store(0);
+			}
+		}
+
+		std::atomic<int> *read_lock(void) {
+			static __thread int slot = -1;
+			static std::atomic<int> slot_next(0);
+
+			if (slot < 0)
+				slot = slot_next.fetch_add(1) % readers_num;
+
+			std::atomic<int> *cnt = &m_readers[slot].count[m_epoch.load() & 1];
+			cnt->fetch_add(1);
+			return cnt;
+		}
+
+		void read_unlock(std::atomic<int> *cnt) {
+			cnt->fetch_sub(1);
+		}
+
+		/* epoch is flipped twice, since reader could sample it before the first flip */
+		void synchronize(void) {
+			for (int i = 0; i < 2; ++i) {
+				int idx = m_epoch.fetch_add(1) & 1;
+
+				for (int j = 0; j < readers_num; ++j) {
+					while (m_readers[j].count[idx].load())
+						std::this_thread::yield();
+				}
+			}
+		}
+
+	private:
+		static const int readers_num = 32;
+
+		struct reader_t {
+			std::atomic<int> count[2];
+			char pad[64];
+		};
+
+		std::atomic<int> m_epoch;
+		reader_t m_readers[readers_num];
+};
+
+/*
+ * Hash index of the shard entries: chains are modified under shard lock
+ * and are walked by cache hits without it. Reader can miss an entry while
+ * table is being grown, it falls back to the locked path then.
+ */
+class index_t {
+	public:
+		index_t(size_t size) : m_mask(size - 1), m_buckets(new std::atomic<data_t *>[size]) {
+			for (size_t i = 0; i < size; ++i)
+				m_buckets[i].store(NULL, std::memory_order_relaxed);
+		}
+
+		size_t size(void) const {
+			return m_mask + 1;
+		}
+
+		std::atomic<data_t *> &bucket(const unsigned char *id) {
+			uint64_t h;
+
+			/* first bytes select the shard */
+			memcpy(&h, id + 8, sizeof(h));
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+
+			return m_buckets[h & m_mask];
+		}
+
+		data_t *find(const unsigned char *id) {
+			for (data_t *obj = bucket(id).load(std::memory_order_acquire); obj; obj = obj->hash_next()) {
+				if (!memcmp(obj->id().id, id, DNET_ID_SIZE))
+					return obj;
+			}
+
+			return NULL;
+		}
+
+		void insert(data_t *obj) {
+			std::atomic<data_t *> &b = bucket(obj->id().id);
+
+			obj->set_hash_next(b.load(std::memory_order_relaxed));
+			b.store(obj, std::memory_order_release);
+		}
+
+		/* removed entry keeps its next pointer, so readers standing on it can go on */
+		void remove(data_t *obj) {
+			std::atomic<data_t *> &b = bucket(obj->id().id);
+			data_t *p = b.load(std::memory_order_relaxed);
+
+			if (p == obj) {
+				b.store(obj->hash_next(std::memory_order_relaxed), std::memory_order_release);
+				return;
+			}
+
+			for (; p; p = p->hash_next(std::memory_order_relaxed)) {
+				if (p->hash_next(std::memory_order_relaxed) == obj) {
+					p->set_hash_next(obj->hash_next(std::memory_order_relaxed));
+					return;
+				}
+			}
+		}
+
+		/* moves all entries into @other, must be called under shard lock */
+		void move_to(index_t &other) {
+			for (size_t i = 0; i <= m_mask; ++i) {
+				data_t *obj = m_buckets[i].load(std::memory_order_relaxed);
+
+				while (obj) {
+					data_t *next = obj->hash_next(std::memory_order_relaxed);
+					other.insert(obj);
+					obj = next;
+				}
+			}
+		}
+
+	private:
+		size_t m_mask;
+		std::unique_ptr<std::atomic<data_t *>[]> m_buckets;
+};
+
+/*
+ * Approximate access frequency of the keys: count-min sketch of 4-bit
+ * saturating counters, halved every 10 * width accesses so old popularity
+ * fades away. Counters are updated without locks, races only lose increments.
+ */
+class frequency_sketch_t {
+	public:
+		frequency_sketch_t(size_t width) :
+		m_mask(width - 1),
+		m_table(new std::atomic<uint8_t>[width * rows]),
+		m_additions(0),
+		m_sample(width * 10) {
+			for (size_t i = 0; i < width * rows; ++i)
+				m_table[i].store(0, std::memory_order_relaxed);
+		}
+
+		void increment(const unsigned char *id) {
+			for (int i = 0; i < rows; ++i) {
+				std::atomic<uint8_t> &c = counter(id, i);
+				uint8_t v = c.load(std::memory_order_relaxed);
+
+				if (v < 15)
+					c.store(v + 1, std::memory_order_relaxed);
+			}
+
+			if (m_additions.fetch_add(1, std::memory_order_relaxed) + 1 == m_sample)
+				age();
+		}
+
+		int frequency(const unsigned char *id) {
+			int freq = 15;
+
+			for (int i = 0; i < rows; ++i)
+				freq = std::min<int>(freq, counter(id, i).load(std::memory_order_relaxed));
+
+			return freq;
+		}
+
+	private:
+		static const int rows = 4;
+
+		size_t m_mask;
+		std::unique_ptr<std::atomic<uint8_t>[]> m_table;
+		std::atomic<size_t> m_additions;
+		size_t m_sample;
+
+		/* first id bytes are used by shard and index selection */
+		std::atomic<uint8_t> &counter(const unsigned char *id, int row) {
+			uint64_t h;
+
+			memcpy(&h, id + 16 + row * sizeof(h), sizeof(h));
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+
+			return m_table[row * (m_mask + 1) + (h & m_mask)];
+		}
+
+		void age(void) {
+			for (size_t i = 0; i < (m_mask + 1) * rows; ++i)
+				m_table[i].store(m_table[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+
+			m_additions.store(0, std::memory_order_relaxed);
+		}
+};
+
+/*
+ * Eviction policy decides whether data read from disk is admitted into the full cache,
+ * eviction itself always goes through LRU list with CLOCK second chance
+ */
+class cache_policy_t {
+	public:
+		virtual ~cache_policy_t() {}
+
+		/* called for every cache read, hit or miss, without shard lock */
+		virtual void access(const unsigned char *id) = 0;
+
+		/* whether @candidate may replace @victim, called under shard lock */
+		virtual bool admit(const unsigned char *candidate, const unsigned char *victim) = 0;
+};
+
+class lru_policy_t : public cache_policy_t {
+	public:
+		void access(const unsigned char *) {
+		}
+
+		bool admit(const unsigned char *, const unsigned char *) {
+			return true;
+		}
+};
+
+/* scan resistant: one-time reads can not push out frequently used entries */
+class tinylfu_policy_t : public cache_policy_t {
+	public:
+		tinylfu_policy_t(size_t max_size) : m_sketch(sketch_width(max_size)) {
+		}
+
+		void access(const unsigned char *id) {
+			m_sketch.increment(id);
+		}
+
+		bool admit(const unsigned char *candidate, const unsigned char *victim) {
+			return m_sketch.frequency(candidate) > m_sketch.frequency(victim);
+		}
+
+	private:
+		frequency_sketch_t m_sketch;
+
+		/* about one counter per 4k of cached data */
+		static size_t sketch_width(size_t max_size) {
+			size_t width = 1024;
+
+			while (width < max_size / 4096 && width < (1 << 20))
+				width <<= 1;
+
+			return width;
+		}
+};
+
+static cache_policy_t *cache_policy_create(int policy, size_t max_size)
+{
+	switch (policy) {
+		case DNET_CACHE_POLICY_TINYLFU:
+			return new tinylfu_policy_t(max_size);
+		default:
+			return new lru_policy_t();
+	}
+}
+
+/* disk read populating cache for the given key, other misses on this key wait for it */
+struct inflight_read_t {
+	std::condition_variable cond;
+	bool done;
+	int err;
+
+	/* set only when data was not admitted into cache */
+	std::shared_ptr<raw_data_t> data;
+	dnet_time timestamp;
+	uint64_t user_flags;
+
+	inflight_read_t() : done(false), err(0), user_flags(0) {
+		dnet_empty_time(&timestamp);
+	}
+};
+
+struct raw_id_less_t {
+	bool operator() (const dnet_raw_id &a, const dnet_raw_id &b) const {
+		return memcmp(a.id, b.id, DNET_ID_SIZE) < 0;
+	}
+};
+
 class cache_t {
 	public:
 		cache_t(struct dnet_node *n, size_t max_size) :
 		m_need_exit(false),
 		m_node(n),
 		m_cache_size(0),
-		m_max_cache_size(max_size) {
+		m_max_cache_size(max_size),
+		m_policy(cache_policy_create(n->cache_policy, max_size)),
+		m_index(new index_t(index_min_size)),
+		m_index_count(0),
+		m_retired_size(0) {
 			m_lifecheck = std::thread(std::bind(&cache_t::life_check, this));
 		}
 
@@ -239,6 +625,9 @@ class cache_t {
 			while(!m_lifeset.empty()) { //removes datas from lifeset
 				erase_element(&*m_lifeset.begin());
 			}
+
+			reclaim();
+			delete m_index.load();
 		}
 
 		void stop() {
@@ -268,13 +657,12 @@ class cache_t {
 			if (!cache_only) {
 				if (append && (it == m_set.end() || it->only_append())) {
 					if (it == m_set.end()) {
-						it = create_data(id, 0, 0, false);
-						it->set_only_append(true);
+						it = create_data(id, 0, 0, false, true);
 						it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
 						m_syncset.insert(*it);
 					}
 
-					auto &raw = it->data()->data();
+					auto &raw = it->writable_data().data();
 
 					m_cache_size -= raw.size();
 					m_lru.erase(m_lru.iterator_to(*it));
@@ -306,7 +694,7 @@ class cache_t {
 					int err = m_node->cb->command_handler(st, m_node->cb->command_private, cmd, io);
 					dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: second write result, err: %d", dnet_dump_id_str(id), err);
 
-					it = populate_from_disk(guard, id, false, &err);
+					it = populate_from_disk(guard, id, false, &err, NULL, NULL, true);
 
 					dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: read result, err: %d", dnet_dump_id_str(id), err);
 					cmd->flags &= ~DNET_FLAGS_NEED_ACK;
@@ -333,14 +721,14 @@ class cache_t {
 			}
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data ensured\n", dnet_dump_id_str(id));
 
-			raw_data_t &raw = *it->data();
+			std::shared_ptr<raw_data_t> old_data = it->data();
 
 			if (io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) {
 				// Data is already in memory, so it's free to use it
 				// raw.size() is zero only if there is no such file on the server
-				if (raw.size() != 0) {
+				if (old_data->size() != 0) {
 					struct dnet_raw_id csum;
-					dnet_transform_node(m_node, raw.data().data(), raw.size(), csum.id, sizeof(csum.id));
+					dnet_transform_node(m_node, old_data->data().data(), old_data->size(), csum.id, sizeof(csum.id));
 
 					if (memcmp(csum.id, io->parent, DNET_ID_SIZE)) {
 						dnet_log(m_node, DNET_LOG_ERROR, "%s: cas: cache checksum mismatch\n", dnet_dump_id(&cmd->id));
@@ -354,13 +742,13 @@ class cache_t {
 			size_t new_size = 0;
 
 			if (append) {
-				new_size = raw.size() + size;
+				new_size = old_data->size() + size;
 			} else {
 				new_size = io->offset + io->size;
 			}
 
 			// Recalc used space, free enough space for new data, move object to the end of the queue
-			m_cache_size -= raw.size();
+			m_cache_size -= old_data->size();
 			m_lru.erase(m_lru.iterator_to(*it));
 
 			if (m_cache_size + new_size > m_max_cache_size) {
@@ -373,11 +761,19 @@ class cache_t {
 			it->set_remove_from_cache(false);
 			m_cache_size += new_size;
 
+			// Cache hits may hold current data, so modified copy replaces it,
+			// only the part which is not overwritten is copied
+			std::shared_ptr<raw_data_t> new_data;
+
 			if (append) {
-				raw.data().insert(raw.data().end(), data, data + size);
+				new_data.reset(new raw_data_t(old_data->data().data(), old_data->size(), new_size));
+				new_data->data().insert(new_data->data().end(), data, data + size);
 			} else {
-				raw.data().resize(new_size);
-				memcpy(raw.data().data() + io->offset, data, size);
+				const size_t keep = std::min<size_t>(old_data->size(), io->offset);
+
+				new_data.reset(new raw_data_t(old_data->data().data(), keep, new_size));
+				new_data->data().resize(new_size);
+				memcpy(new_data->data().data() + io->offset, data, size);
 			}
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data modified\n", dnet_dump_id_str(id));
@@ -396,13 +792,12 @@ class cache_t {
 				m_lifeset.insert(*it);
 			}
 
-			it->set_timestamp(io->timestamp);
-			it->set_user_flags(io->user_flags);
+			it->update(new_data, io->timestamp, io->user_flags);
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: finished write\n", dnet_dump_id_str(id));
 
 			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-			return dnet_send_file_info_ts_without_fd(st, cmd, raw.data().data() + io->offset, io->size, &io->timestamp);
+			return dnet_send_file_info_ts_without_fd(st, cmd, new_data->data().data() + io->offset, io->size, &io->timestamp);
 		}
 
 		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
@@ -410,6 +805,14 @@ class cache_t {
 			const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 			(void) cmd;
 
+			m_policy->access(id);
+
+			std::shared_ptr<raw_data_t> hit = fast_read(id, io);
+			if (hit) {
+				dnet_counter_inc(m_node, DNET_CNTR_CACHE_HIT, 0);
+				return hit;
+			}
+
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: before guard\n", dnet_dump_id_str(id));
 			std::unique_lock<std::mutex> guard(m_lock);
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: after guard\n", dnet_dump_id_str(id));
@@ -422,10 +825,20 @@ class cache_t {
 				it = m_set.end();
 			}
 
+			if (it == m_set.end()) {
+				dnet_counter_inc(m_node, DNET_CNTR_CACHE_MISS, 0);
+			} else {
+				dnet_counter_inc(m_node, DNET_CNTR_CACHE_HIT, 0);
+			}
+
 			if (it == m_set.end() && cache && !cache_only) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: not exist\n", dnet_dump_id_str(id));
 				int err = 0;
-				it = populate_from_disk(guard, id, false, &err);
+				std::shared_ptr<raw_data_t> uncached;
+
+				it = populate_from_disk(guard, id, false, &err, io, &uncached);
+				if (uncached)
+					return uncached;
 			} else {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: exists\n", dnet_dump_id_str(id));
 			}
@@ -483,16 +896,17 @@ class cache_t {
 
 		int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd) {
 			int err = 0;
+			dnet_time timestamp;
 
-			std::unique_lock<std::mutex> guard(m_lock);
-			iset_t::iterator it = m_set.find(id);
-			if (it == m_set.end()) {
-				return -ENOTSUP;
-			}
-
-			dnet_time timestamp = it->timestamp();
+			if (!fast_timestamp(id, timestamp)) {
+				std::unique_lock<std::mutex> guard(m_lock);
+				iset_t::iterator it = m_set.find(id);
+				if (it == m_set.end()) {
+					return -ENOTSUP;
+				}
 
-			guard.unlock();
+				timestamp = it->timestamp();
+			}
 
 			local_session sess(m_node);
 
@@ -515,6 +929,8 @@ class cache_t {
 		}
 
 	private:
+		static const size_t index_min_size = 1024;
+
 		bool m_need_exit;
 		struct dnet_node *m_node;
 		size_t m_cache_size, m_max_cache_size;
@@ -524,10 +940,108 @@ class cache_t {
 		life_set_t m_lifeset;
 		sync_set_t m_syncset;
 		std::thread m_lifecheck;
+		std::unique_ptr<cache_policy_t> m_policy;
+		std::map<dnet_raw_id, std::shared_ptr<inflight_read_t>, raw_id_less_t> m_inflight;
+
+		/*
+		 * Lock-free read side: index is modified under @m_lock, removed entries
+		 * and old index tables are freed after readers have left
+		 */
+		epoch_t m_epoch;
+		std::atomic<index_t *> m_index;
+		size_t m_index_count;
+		std::vector<data_t *> m_retired;
+		std::vector<index_t *> m_retired_index;
+		size_t m_retired_size;
 
 		cache_t(const cache_t &) = delete;
 
-		iset_t::iterator create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk) {
+		/*
+		 * Cache hit without shard lock: returns NULL if entry is not found or it needs
+		 * locked path (append-only data, entry which is going to be removed)
+		 */
+		std::shared_ptr<raw_data_t> fast_read(const unsigned char *id, dnet_io_attr *io) {
+			std::shared_ptr<raw_data_t> data;
+			dnet_time timestamp;
+			uint64_t user_flags;
+
+			std::atomic<int> *cnt = m_epoch.read_lock();
+
+			data_t *obj = m_index.load(std::memory_order_acquire)->find(id);
+			if (obj && !obj->only_append() && !obj->remove_from_cache()) {
+				data = obj->snapshot(timestamp, user_flags);
+				obj->access();
+			}
+
+			m_epoch.read_unlock(cnt);
+
+			if (data) {
+				io->timestamp = timestamp;
+				io->user_flags = user_flags;
+				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: lock-free hit\n", dnet_dump_id_str(id));
+			}
+
+			return data;
+		}
+
+		bool fast_timestamp(const unsigned char *id, dnet_time &timestamp) {
+			std::atomic<int> *cnt = m_epoch.read_lock();
+
+			data_t *obj = m_index.load(std::memory_order_acquire)->find(id);
+			if (obj)
+				timestamp = obj->snapshot_timestamp();
+
+			m_epoch.read_unlock(cnt);
+
+			return obj != NULL;
+		}
+
+		void index_insert(data_t *obj) {
+			index_t *index = m_index.load(std::memory_order_relaxed);
+
+			if (++m_index_count > index->size() * 2) {
+				index_t *grown = new index_t(index->size() * 2);
+
+				index->move_to(*grown);
+				m_index.store(grown, std::memory_order_release);
+
+				m_retired_index.push_back(index);
+				index = grown;
+			}
+
+			index->insert(obj);
+		}
+
+		void index_remove(data_t *obj) {
+			m_index.load(std::memory_order_relaxed)->remove(obj);
+			--m_index_count;
+
+			m_retired.push_back(obj);
+			m_retired_size += obj->size();
+
+			if (m_retired_size > m_max_cache_size / 8)
+				reclaim();
+		}
+
+		/* frees removed entries when no reader can see them, called under shard lock */
+		void reclaim(void) {
+			if (m_retired.empty() && m_retired_index.empty())
+				return;
+
+			m_epoch.synchronize();
+
+			for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+				delete *it;
+			for (auto it = m_retired_index.begin(); it != m_retired_index.end(); ++it)
+				delete *it;
+
+			m_retired.clear();
+			m_retired_index.clear();
+			m_retired_size = 0;
+		}
+
+		iset_t::iterator create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk,
+				bool only_append = false) {
 			if (m_cache_size + size > m_max_cache_size) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called from create_data\n", dnet_dump_id_str(id));
 				resize(size);
@@ -535,18 +1049,99 @@ class cache_t {
 			}
 
 			data_t *raw = new data_t(id, 0, data, size, remove_from_disk);
+			raw->set_only_append(only_append);
 
 			m_cache_size += size;
 
 			m_lru.push_back(*raw);
+			index_insert(raw);
 			return m_set.insert(*raw).first;
 		}
 
-		iset_t::iterator populate_from_disk(std::unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err) {
-			if (guard.owns_lock()) {
-				guard.unlock();
+		/*
+		 * When @uncached is set, eviction policy may reject data which would replace cached entries,
+		 * it is returned in @uncached then and @io gets its timestamp and user flags.
+		 *
+		 * Concurrent misses on the same key are coalesced: only the first one reads from disk,
+		 * others sleep on shard lock until it finishes. @fresh forces own disk read, it is used
+		 * when disk content has just been changed and read already in flight may be stale.
+		 */
+		iset_t::iterator populate_from_disk(std::unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+				dnet_io_attr *io = NULL, std::shared_ptr<raw_data_t> *uncached = NULL, bool fresh = false) {
+			if (!guard.owns_lock()) {
+				guard.lock();
 			}
 
+			dnet_raw_id key;
+			memcpy(key.id, id, DNET_ID_SIZE);
+
+			while (!fresh) {
+				auto found = m_inflight.find(key);
+				if (found == m_inflight.end())
+					break;
+
+				std::shared_ptr<inflight_read_t> flight = found->second;
+
+				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: waiting for disk read in flight\n", dnet_dump_id_str(id));
+				dnet_counter_inc(m_node, DNET_CNTR_CACHE_COALESCED, 0);
+
+				flight->cond.wait(guard, [&flight] { return flight->done; });
+
+				*err = flight->err;
+				if (*err)
+					return m_set.end();
+
+				auto it = m_set.find(id);
+				if (it != m_set.end())
+					return it;
+
+				if (flight->data && uncached) {
+					*uncached = flight->data;
+					io->timestamp = flight->timestamp;
+					io->user_flags = flight->user_flags;
+					return m_set.end();
+				}
+
+				/* data was not cached or has been already evicted, read it again */
+			}
+
+			std::shared_ptr<inflight_read_t> flight = std::make_shared<inflight_read_t>();
+			m_inflight[key] = flight;
+
+			iset_t::iterator it;
+			try {
+				it = read_from_disk(guard, id, remove_from_disk, err, io, uncached);
+			} catch (...) {
+				if (!guard.owns_lock())
+					guard.lock();
+				finish_flight(key, flight, -EIO);
+				throw;
+			}
+
+			if (uncached && *uncached) {
+				flight->data = *uncached;
+				flight->timestamp = io->timestamp;
+				flight->user_flags = io->user_flags;
+			}
+			finish_flight(key, flight, *err);
+			return it;
+		}
+
+		void finish_flight(const dnet_raw_id &key, const std::shared_ptr<inflight_read_t> &flight, int err) {
+			flight->err = err;
+			flight->done = true;
+
+			auto found = m_inflight.find(key);
+			if (found != m_inflight.end() && found->second == flight)
+				m_inflight.erase(found);
+
+			flight->cond.notify_all();
+		}
+
+		iset_t::iterator read_from_disk(std::unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+				dnet_io_attr *io, std::shared_ptr<raw_data_t> *uncached) {
+			guard.unlock();
+
 			local_session sess(m_node);
 			sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
 
@@ -566,18 +1161,38 @@ class cache_t {
 
 			guard.lock();
 
-			if (*err == 0) {
-				auto it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
-				it->set_user_flags(user_flags);
-				it->set_timestamp(timestamp);
+			if (*err)
+				return m_set.end();
+
+			/* key has been written while shard was unlocked, cached data is newer than disk */
+			auto it = m_set.find(id);
+			if (it != m_set.end())
 				return it;
+
+			if (uncached && m_cache_size + data.size() > m_max_cache_size && !m_lru.empty() &&
+					!m_policy->admit(id, m_lru.front().id().id)) {
+				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: not admitted by eviction policy\n", dnet_dump_id_str(id));
+				dnet_counter_inc(m_node, DNET_CNTR_CACHE_ADMIT_REJECT, 0);
+
+				uncached->reset(new raw_data_t(reinterpret_cast<char *>(data.data()), data.size()));
+				io->timestamp = timestamp;
+				io->user_flags = user_flags;
+				return m_set.end();
 			}
 
-			return m_set.end();
+			it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
+			it->set_user_flags(user_flags);
+			it->set_timestamp(timestamp);
+			return it;
 		}
 
+		/*
+		 * Cache hits do not move entries in LRU list, they set reference bit instead,
+		 * so recently read entries get second chance and are moved to the tail (CLOCK)
+		 */
 		void resize(size_t reserve) {
 			size_t removed_size = 0;
+			size_t second_chance = m_lru.size();
 
 			for (auto it = m_lru.begin(); it != m_lru.end();) {
 				if (m_max_cache_size > m_cache_size + reserve + removed_size)
@@ -586,8 +1201,16 @@ class cache_t {
 				data_t *raw = &*it;
 				++it;
 
+				if (second_chance && raw->test_and_clear_accessed()) {
+					--second_chance;
+					m_lru.erase(m_lru.iterator_to(*raw));
+					m_lru.push_back(*raw);
+					continue;
+				}
+
 				if (raw->synctime() || raw->remove_from_cache()) {
 					if (!raw->remove_from_cache()) {
+						dnet_counter_inc(m_node, DNET_CNTR_CACHE_EVICT, 0);
 						raw->set_remove_from_cache(true);
 
 						m_syncset.erase(m_syncset.iterator_to(*raw));
@@ -596,6 +1219,7 @@ class cache_t {
 					}
 					removed_size += raw->size();
 				} else {
+					dnet_counter_inc(m_node, DNET_CNTR_CACHE_EVICT, 0);
 					erase_element(raw);
 				}
 			}
@@ -616,7 +1240,7 @@ class cache_t {
 
 			m_cache_size -= obj->size();
 
-			delete obj;
+			index_remove(obj);
 		}
 
 		void sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp) {
@@ -749,6 +1373,11 @@ class cache_t {
 					dnet_remove_local(m_node, &(*it));
 				}
 
+				{
+					std::lock_guard<std::mutex> guard(m_lock);
+					reclaim();
+				}
+
 				sleep(1);
 			}
 		}
@@ -816,6 +1445,12 @@ class cache_manager {
 
 using namespace ioremap::cache;
 
+/* called by network code when read reply holding cached data has been sent */
+static void dnet_cache_raw_data_release(void *priv)
+{
+	delete static_cast<std::shared_ptr<raw_data_t> *>(priv);
+}
+
 int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data)
 {
 	struct dnet_node *n = st->n;
@@ -859,7 +1494,8 @@ int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dn
 					io->size = d->size() - io->offset;
 
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+				err = dnet_send_read_data_owned(st, cmd, io, (char *)d->data().data() + io->offset,
+						dnet_cache_raw_data_release, new std::shared_ptr<raw_data_t>(d));
 				break;
 			case DNET_CMD_DEL:
 				err = cache->remove(cmd->id.id, io);
@@ -0,0 +1,23 @@
+# Find liburing
+#
+# This module defines
+#  URING_FOUND - whether the liburing was found
+#  URING_LIBRARIES - liburing libraries
+#  URING_INCLUDE_DIRS - the include path of the liburing library
+#  URING_CFLAGS - liburing compile flags
+
+if (NOT URING_INCLUDE_DIRS)
+    find_path(URING_INCLUDE_DIRS liburing.h)
+endif()
+
+if (NOT URING_LIBRARIES)
+	find_library(URING_LIBRARIES NAMES uring PATHS ${URING_LIBRARY_DIRS})
+endif()
+
+if (NOT URING_CFLAGS)
+    set(URING_CFLAGS "-DHAVE_URING_SUPPORT=1")
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(URING DEFAULT_MSG URING_LIBRARIES URING_INCLUDE_DIRS)
+mark_as_advanced(URING_LIBRARIES URING_INCLUDE_DIRS)
@@ -0,0 +1,466 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Cache read hit benchmark.
+ *
+ * Cache of the node is filled with given number of keys, then reader threads
+ * call dnet_cmd_cache_io() for random keys, like IO threads do for read
+ * commands with DNET_IO_FLAGS_CACHE. Every thread replies to its own state
+ * connected to a local socketpair, other end is drained and replies dropped.
+ * Optional writer threads rewrite random keys while readers run.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#include "../library/elliptics.h"
+
+/* thread does not queue more replies than this into its state */
+#define BENCH_CACHE_QUEUE_MAX		(4 * 1024 * 1024)
+
+struct bench_cache_thread {
+	pthread_t		tid;
+	struct dnet_net_state	*st;
+	struct dnet_raw_id	*keys;
+	int			key_num;
+	char			*data;
+	int			size;
+	long			num;
+	long			done;
+	unsigned int		seed;
+	volatile int		*stop;
+};
+
+struct bench_cache_peers {
+	struct pollfd		*fds;
+	int			num;
+};
+
+static void bench_cache_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -t num                    - number of reader threads, can be repeated (default: 1, 2, 4, 8)\n"
+			"  -w num                    - number of writer threads running together with readers (default: 0)\n"
+			"  -k num                    - number of cached keys (default: 4096)\n"
+			"  -s size                   - size of cached data (default: 1024)\n"
+			"  -n num                    - number of reads per thread (default: 1000000)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg)
+{
+	fputs(msg, stderr);
+}
+
+/* drops everything states send, exits when client node closes all of them */
+static void *bench_cache_peer_process(void *data)
+{
+	struct bench_cache_peers *p = data;
+	char buf[65536];
+	ssize_t err;
+	int i, alive = p->num;
+
+	while (alive) {
+		err = poll(p->fds, p->num, -1);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < p->num; ++i) {
+			if (!p->fds[i].revents)
+				continue;
+
+			err = read(p->fds[i].fd, buf, sizeof(buf));
+			if (err < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+
+			if (err <= 0) {
+				/* negative descriptor is ignored by poll() */
+				close(p->fds[i].fd);
+				p->fds[i].fd = -1;
+				alive--;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void bench_cache_throttle(struct dnet_net_state *st)
+{
+	while (*(volatile uint64_t *)&st->send_queue_bytes > BENCH_CACHE_QUEUE_MAX)
+		sched_yield();
+}
+
+static int bench_cache_io(struct dnet_net_state *st, int command, struct dnet_raw_id *key, char *data, int size)
+{
+	struct {
+		struct dnet_cmd		cmd;
+		struct dnet_io_attr	io;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+
+	memcpy(req.cmd.id.id, key->id, DNET_ID_SIZE);
+	req.cmd.cmd = command;
+	req.cmd.size = sizeof(struct dnet_io_attr);
+
+	memcpy(req.io.id, key->id, DNET_ID_SIZE);
+	req.io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+	if (command == DNET_CMD_WRITE)
+		req.io.size = size;
+
+	bench_cache_throttle(st);
+	return dnet_cmd_cache_io(st, &req.cmd, &req.io, data);
+}
+
+static void *bench_cache_read_process(void *data)
+{
+	struct bench_cache_thread *t = data;
+	long i;
+
+	for (i = 0; i < t->num; ++i) {
+		if (!bench_cache_io(t->st, DNET_CMD_READ, &t->keys[rand_r(&t->seed) % t->key_num], NULL, 0))
+			t->done++;
+	}
+
+	return NULL;
+}
+
+static void *bench_cache_write_process(void *data)
+{
+	struct bench_cache_thread *t = data;
+
+	while (!*t->stop) {
+		if (!bench_cache_io(t->st, DNET_CMD_WRITE, &t->keys[rand_r(&t->seed) % t->key_num], t->data, t->size))
+			t->done++;
+	}
+
+	return NULL;
+}
+
+static int bench_cache_run(struct dnet_net_state **states, struct dnet_raw_id *keys, int key_num,
+		char *data, int size, int thread_num, int writer_num, long num)
+{
+	struct bench_cache_thread *threads;
+	struct timeval start, end;
+	volatile int stop = 0;
+	long hits = 0, writes = 0;
+	double diff;
+	int i, j, err = 0;
+
+	threads = calloc(thread_num + writer_num, sizeof(struct bench_cache_thread));
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < thread_num + writer_num; ++i) {
+		threads[i].st = states[i];
+		threads[i].keys = keys;
+		threads[i].key_num = key_num;
+		threads[i].data = data;
+		threads[i].size = size;
+		threads[i].num = num;
+		threads[i].seed = i + 1;
+		threads[i].stop = &stop;
+	}
+
+	/* writers are started first and stopped when all readers have completed */
+	for (i = thread_num; i < thread_num + writer_num; ++i) {
+		err = pthread_create(&threads[i].tid, NULL, bench_cache_write_process, &threads[i]);
+		if (err) {
+			err = -err;
+			goto err_out_stop;
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < thread_num; ++j) {
+		err = pthread_create(&threads[j].tid, NULL, bench_cache_read_process, &threads[j]);
+		if (err) {
+			err = -err;
+			break;
+		}
+	}
+
+	while (--j >= 0) {
+		pthread_join(threads[j].tid, NULL);
+		hits += threads[j].done;
+	}
+	gettimeofday(&end, NULL);
+
+err_out_stop:
+	stop = 1;
+	while (--i >= thread_num) {
+		pthread_join(threads[i].tid, NULL);
+		writes += threads[i].done;
+	}
+
+	if (err)
+		goto err_out_free;
+
+	if (hits != num * thread_num) {
+		fprintf(stderr, "only %ld of %ld reads hit the cache\n", hits, num * thread_num);
+		err = -ENOENT;
+		goto err_out_free;
+	}
+
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+	printf("readers: %3d, writers: %3d, %6.1f nsec per read, %10.0f reads/sec, %10.0f writes/sec\n",
+			thread_num, writer_num, diff * 1000000000. / (num * thread_num), num * thread_num / diff,
+			writes / diff);
+
+err_out_free:
+	free(threads);
+	return err;
+}
+
+/* state is connected to one end of the socketpair, other end is drained by peer thread */
+static int bench_cache_state_create(struct dnet_node *n, int idx, struct dnet_net_state **stp, int *peer)
+{
+	struct dnet_net_state *st;
+	struct sockaddr_in sin;
+	struct dnet_addr addr;
+	int s[2], err;
+
+	err = socketpair(AF_UNIX, SOCK_STREAM, 0, s);
+	if (err) {
+		err = -errno;
+		goto err_out_exit;
+	}
+
+	fcntl(s[0], F_SETFL, O_NONBLOCK);
+	fcntl(s[0], F_SETFD, FD_CLOEXEC);
+	fcntl(s[1], F_SETFL, O_NONBLOCK);
+
+	/* every state needs its own address, they are never connected to */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(1024 + idx);
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	memcpy(addr.addr, &sin, sizeof(sin));
+	addr.addr_len = sizeof(sin);
+	addr.family = AF_INET;
+
+	/* socket is closed by dnet_state_create() on error */
+	st = dnet_state_create(n, 0, NULL, 0, &addr, s[0], &err, 0, -1, dnet_state_net_process);
+	if (!st)
+		goto err_out_close;
+
+	*stp = st;
+	*peer = s[1];
+	return 0;
+
+err_out_close:
+	close(s[1]);
+err_out_exit:
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	int default_threads[] = {1, 2, 4, 8};
+	int thread_nums[16], thread_count = 0, thread_max = 0;
+	int key_num = 4096, size = 1024, writer_num = 0;
+	long num = 1000000;
+	struct dnet_net_state **states = NULL;
+	struct dnet_raw_id *keys = NULL;
+	struct bench_cache_peers peers;
+	struct dnet_addr node_addr;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct dnet_log l;
+	unsigned int seed = 0;
+	pthread_t peer_tid;
+	char *data = NULL;
+	int ch, i, j, err = 0;
+
+	while ((ch = getopt(argc, argv, "t:w:k:s:n:h")) != -1) {
+		switch (ch) {
+			case 't':
+				if (thread_count < (int)ARRAY_SIZE(thread_nums))
+					thread_nums[thread_count++] = atoi(optarg);
+				break;
+			case 'w':
+				writer_num = atoi(optarg);
+				break;
+			case 'k':
+				key_num = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'n':
+				num = atol(optarg);
+				break;
+			case 'h':
+			default:
+				bench_cache_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (!thread_count) {
+		memcpy(thread_nums, default_threads, sizeof(default_threads));
+		thread_count = ARRAY_SIZE(default_threads);
+	}
+
+	for (i = 0; i < thread_count; ++i) {
+		if (thread_nums[i] <= 0)
+			bench_cache_usage(argv[0]);
+		if (thread_nums[i] > thread_max)
+			thread_max = thread_nums[i];
+	}
+
+	if (writer_num < 0 || key_num <= 0 || size <= 0 || num <= 0)
+		bench_cache_usage(argv[0]);
+
+	memset(&cfg, 0, sizeof(struct dnet_config));
+	memset(&l, 0, sizeof(struct dnet_log));
+
+	l.log = bench_log;
+	l.log_level = DNET_LOG_ERROR;
+
+	cfg.log = &l;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 60;
+	/* all keys have to stay in cache, it is split into shards by key */
+	cfg.cache_size = 4ULL * key_num * size + 64 * 1024 * 1024;
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -1;
+
+	/* cache is only created for server nodes, its write replies carry node address */
+	memset(&node_addr, 0, sizeof(struct dnet_addr));
+	node_addr.addr_len = sizeof(struct sockaddr_in);
+	node_addr.family = AF_INET;
+	n->addrs = &node_addr;
+	n->addr_num = 1;
+
+	err = dnet_cache_init(n);
+	if (err) {
+		fprintf(stderr, "Failed to create cache: %d\n", err);
+		goto err_out_destroy;
+	}
+
+	memset(&peers, 0, sizeof(struct bench_cache_peers));
+	peers.fds = calloc(thread_max + writer_num, sizeof(struct pollfd));
+	states = calloc(thread_max + writer_num, sizeof(struct dnet_net_state *));
+	keys = malloc(key_num * sizeof(struct dnet_raw_id));
+	data = malloc(size);
+	if (!peers.fds || !states || !keys || !data) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < thread_max + writer_num; ++i) {
+		err = bench_cache_state_create(n, i, &states[i], &peers.fds[i].fd);
+		if (err) {
+			fprintf(stderr, "Failed to create state %d: %d\n", i, err);
+			goto err_out_free;
+		}
+		peers.fds[i].events = POLLIN;
+		peers.num++;
+	}
+
+	err = pthread_create(&peer_tid, NULL, bench_cache_peer_process, &peers);
+	if (err) {
+		fprintf(stderr, "Failed to start peer thread: %d\n", err);
+		err = -err;
+		goto err_out_free;
+	}
+
+	memset(data, 0xa5, size);
+	for (i = 0; i < key_num; ++i) {
+		for (j = 0; j < DNET_ID_SIZE; ++j)
+			keys[i].id[j] = rand_r(&seed);
+
+		err = bench_cache_io(states[0], DNET_CMD_WRITE, &keys[i], data, size);
+		if (err) {
+			fprintf(stderr, "Failed to write key %d into cache: %d\n", i, err);
+			goto err_out_join;
+		}
+	}
+
+	printf("keys: %d, data size: %d, reads per thread: %ld\n", key_num, size, num);
+
+	for (i = 0; i < thread_count; ++i) {
+		err = bench_cache_run(states, keys, key_num, data, size, thread_nums[i], writer_num, num);
+		if (err)
+			break;
+	}
+
+err_out_join:
+	/* queued replies hold their own references to cached data */
+	dnet_cache_cleanup(n);
+	n->cache = NULL;
+	n->addrs = NULL;
+	n->addr_num = 0;
+
+	/* states are destroyed with the node, peer thread closes its ends then */
+	dnet_node_destroy(n);
+	pthread_join(peer_tid, NULL);
+
+	free(peers.fds);
+	free(states);
+	free(keys);
+	free(data);
+	return err;
+
+err_out_free:
+	dnet_cache_cleanup(n);
+	n->cache = NULL;
+	n->addrs = NULL;
+	n->addr_num = 0;
+err_out_destroy:
+	n->addrs = NULL;
+	n->addr_num = 0;
+	dnet_node_destroy(n);
+
+	for (i = 0; i < peers.num; ++i)
+		close(peers.fds[i].fd);
+	free(peers.fds);
+	free(states);
+	free(keys);
+	free(data);
+	return err;
+}
@@ -0,0 +1,394 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * IO pool command queue throughput benchmark.
+ *
+ * Fake peer is connected to the client node over loopback and floods it with
+ * empty commands, keeping at most @window of them not yet processed. Every
+ * command goes through the whole receive path: network thread reads it and
+ * schedules it into IO pool, IO thread takes it from the queue and calls
+ * dnet_process_cmd_raw(), which is defined here as a no-op handler.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#include "../library/elliptics.h"
+
+#define BENCH_IO_BATCH		256
+
+static unsigned long long bench_processed;
+
+/* server command handler is not part of client library, it is a weak symbol there */
+int dnet_process_cmd_raw(struct dnet_net_state *st __unused, struct dnet_cmd *cmd __unused,
+		void *data __unused, int recursive __unused)
+{
+	__sync_fetch_and_add(&bench_processed, 1);
+	return 0;
+}
+
+struct bench_peer {
+	int			listen_s;
+	int			s;
+	struct dnet_addr	addr;
+	pthread_mutex_t		write_lock;
+
+	unsigned long long	num;
+	int			window;
+};
+
+static void bench_io_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -t num                    - number of IO threads (default: 4)\n"
+			"  -n num                    - number of commands (default: 1000000)\n"
+			"  -w num                    - maximum number of queued commands (default: 4096)\n"
+			"  -e engine                 - network engine: epoll or uring (default: epoll)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg)
+{
+	fputs(msg, stderr);
+}
+
+static int bench_read(int s, void *data, size_t size)
+{
+	ssize_t err;
+
+	while (size) {
+		err = read(s, data, size);
+		if (err <= 0)
+			return err ? -errno : -ECONNRESET;
+
+		data += err;
+		size -= err;
+	}
+
+	return 0;
+}
+
+static int bench_write(struct bench_peer *p, void *data, size_t size)
+{
+	ssize_t err = 0;
+
+	pthread_mutex_lock(&p->write_lock);
+	while (size) {
+		err = write(p->s, data, size);
+		if (err <= 0) {
+			err = -errno;
+			break;
+		}
+
+		data += err;
+		size -= err;
+		err = 0;
+	}
+	pthread_mutex_unlock(&p->write_lock);
+
+	return err;
+}
+
+/* replies to reverse lookup with the single id, so the client creates state for us */
+static int bench_peer_handshake(struct bench_peer *p)
+{
+	struct dnet_cmd cmd;
+	struct {
+		struct dnet_addr_container	cnt;
+		struct dnet_addr		addr;
+		struct dnet_raw_id		id;
+	} __attribute__ ((packed)) reply;
+	int err;
+
+	err = bench_read(p->s, &cmd, sizeof(struct dnet_cmd));
+	if (err)
+		return err;
+
+	/* header keeps the client version encoded in the id, it is echoed back */
+	memset(&reply, 0, sizeof(reply));
+	reply.cnt.addr_num = 1;
+	reply.addr = p->addr;
+	memset(&reply.id, 0, sizeof(struct dnet_raw_id));
+
+	cmd.status = 0;
+	cmd.size = sizeof(reply);
+	dnet_convert_cmd(&cmd);
+	dnet_convert_addr_container(&reply.cnt);
+
+	err = bench_write(p, &cmd, sizeof(struct dnet_cmd));
+	if (err)
+		return err;
+
+	return bench_write(p, &reply, sizeof(reply));
+}
+
+/* acknowledges everything client sends us, like auth and route requests */
+static void *bench_peer_reader(void *data)
+{
+	struct bench_peer *p = data;
+	struct dnet_cmd cmd;
+	char buf[4096];
+	uint64_t size;
+	int err;
+
+	while (1) {
+		err = bench_read(p->s, &cmd, sizeof(struct dnet_cmd));
+		if (err)
+			break;
+
+		dnet_convert_cmd(&cmd);
+		for (size = cmd.size; size; size -= cmd.size) {
+			cmd.size = size < sizeof(buf) ? size : sizeof(buf);
+			err = bench_read(p->s, buf, cmd.size);
+			if (err)
+				goto err_out_exit;
+		}
+
+		if (cmd.trans & DNET_TRANS_REPLY)
+			continue;
+
+		cmd.trans |= DNET_TRANS_REPLY;
+		cmd.flags &= ~(DNET_FLAGS_MORE | DNET_FLAGS_NEED_ACK);
+		cmd.status = 0;
+		cmd.size = 0;
+		dnet_convert_cmd(&cmd);
+
+		err = bench_write(p, &cmd, sizeof(struct dnet_cmd));
+		if (err)
+			break;
+	}
+
+err_out_exit:
+	return NULL;
+}
+
+static void *bench_peer_process(void *data)
+{
+	struct bench_peer *p = data;
+	struct dnet_cmd *cmds;
+	unsigned long long sent;
+	pthread_t reader;
+	int i, err;
+
+	p->s = accept(p->listen_s, NULL, NULL);
+	if (p->s < 0) {
+		fprintf(stderr, "Failed to accept client connection: %s [%d]\n", strerror(errno), errno);
+		goto err_out_exit;
+	}
+
+	err = bench_peer_handshake(p);
+	if (err) {
+		fprintf(stderr, "Failed to reply to reverse lookup: %d\n", err);
+		goto err_out_exit;
+	}
+
+	err = pthread_create(&reader, NULL, bench_peer_reader, p);
+	if (err) {
+		fprintf(stderr, "Failed to start peer reader: %d\n", err);
+		goto err_out_exit;
+	}
+
+	cmds = calloc(BENCH_IO_BATCH, sizeof(struct dnet_cmd));
+	if (!cmds)
+		goto err_out_join;
+
+	for (sent = 0; sent < p->num; sent += BENCH_IO_BATCH) {
+		while (sent - *(volatile unsigned long long *)&bench_processed + BENCH_IO_BATCH > (unsigned long long)p->window)
+			sched_yield();
+
+		for (i = 0; i < BENCH_IO_BATCH; ++i) {
+			memset(&cmds[i], 0, sizeof(struct dnet_cmd));
+			cmds[i].cmd = DNET_CMD_STATUS;
+			cmds[i].flags = DNET_FLAGS_DIRECT;
+			cmds[i].trans = sent + i + 1;
+			dnet_convert_cmd(&cmds[i]);
+		}
+
+		err = bench_write(p, cmds, BENCH_IO_BATCH * sizeof(struct dnet_cmd));
+		if (err) {
+			fprintf(stderr, "Failed to send commands: %d\n", err);
+			break;
+		}
+	}
+
+	free(cmds);
+err_out_join:
+	pthread_join(reader, NULL);
+err_out_exit:
+	return NULL;
+}
+
+static int bench_peer_listen(struct bench_peer *p)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int err;
+
+	p->listen_s = socket(AF_INET, SOCK_STREAM, 0);
+	if (p->listen_s < 0) {
+		err = -errno;
+		goto err_out_exit;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	err = bind(p->listen_s, (struct sockaddr *)&sin, sizeof(sin));
+	if (!err)
+		err = listen(p->listen_s, 1);
+	if (!err)
+		err = getsockname(p->listen_s, (struct sockaddr *)&sin, &len);
+	if (err) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	memset(&p->addr, 0, sizeof(struct dnet_addr));
+	memcpy(p->addr.addr, &sin, len);
+	p->addr.addr_len = len;
+	p->addr.family = AF_INET;
+
+	return ntohs(sin.sin_port);
+
+err_out_close:
+	close(p->listen_s);
+err_out_exit:
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_log l;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct bench_peer p;
+	struct timeval start, end;
+	pthread_t peer;
+	double diff;
+	int ch, port, err;
+
+	memset(&cfg, 0, sizeof(struct dnet_config));
+	memset(&l, 0, sizeof(struct dnet_log));
+	memset(&p, 0, sizeof(struct bench_peer));
+
+	l.log = bench_log;
+	l.log_level = DNET_LOG_ERROR;
+
+	cfg.log = &l;
+	cfg.io_thread_num = 4;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 60;
+	cfg.flags = DNET_CFG_NO_ROUTE_LIST;
+
+	p.num = 1000000;
+	p.window = 4096;
+
+	while ((ch = getopt(argc, argv, "t:n:w:e:h")) != -1) {
+		switch (ch) {
+			case 't':
+				cfg.io_thread_num = atoi(optarg);
+				break;
+			case 'n':
+				p.num = strtoull(optarg, NULL, 0);
+				break;
+			case 'w':
+				p.window = atoi(optarg);
+				break;
+			case 'e':
+				if (!strcmp(optarg, "uring"))
+					cfg.net_engine = DNET_NET_ENGINE_URING;
+				else if (strcmp(optarg, "epoll"))
+					bench_io_usage(argv[0]);
+				break;
+			case 'h':
+			default:
+				bench_io_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (cfg.io_thread_num <= 0 || p.window < BENCH_IO_BATCH)
+		bench_io_usage(argv[0]);
+
+	p.num = (p.num + BENCH_IO_BATCH - 1) / BENCH_IO_BATCH * BENCH_IO_BATCH;
+	pthread_mutex_init(&p.write_lock, NULL);
+
+	port = bench_peer_listen(&p);
+	if (port < 0) {
+		fprintf(stderr, "Failed to create listening socket: %d\n", port);
+		return -1;
+	}
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -1;
+
+	err = pthread_create(&peer, NULL, bench_peer_process, &p);
+	if (err) {
+		fprintf(stderr, "Failed to start peer: %d\n", err);
+		goto err_out_destroy;
+	}
+
+	gettimeofday(&start, NULL);
+
+	err = dnet_add_state(n, "127.0.0.1", port, AF_INET, DNET_CFG_NO_ROUTE_LIST);
+	if (err) {
+		fprintf(stderr, "Failed to connect to peer: %d\n", err);
+		shutdown(p.listen_s, SHUT_RDWR);
+		goto err_out_join;
+	}
+
+	while (*(volatile unsigned long long *)&bench_processed < p.num)
+		usleep(1000);
+
+	gettimeofday(&end, NULL);
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+
+	printf("engine: %s, io threads: %d, commands: %llu, window: %d, time: %.3f sec, %.0f commands/sec\n",
+			cfg.net_engine == DNET_NET_ENGINE_URING ? "uring" : "epoll",
+			cfg.io_thread_num, p.num, p.window, diff, p.num / diff);
+
+err_out_join:
+	dnet_node_destroy(n);
+	pthread_join(peer, NULL);
+	close(p.listen_s);
+	return err;
+
+err_out_destroy:
+	dnet_node_destroy(n);
+	close(p.listen_s);
+	return err;
+}
@@ -0,0 +1,362 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Oplock table benchmark.
+ *
+ * Given number of threads lock and unlock random keys from the set shared
+ * by all of them, smaller set means more waiting on the same key.
+ *
+ * 'striped' locking is dnet_oplock()/dnet_opunlock() of the library, 'global'
+ * one is the table it replaced: rbtree of entries from preallocated free list
+ * under single mutex, every entry has its own mutex and condition.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#include "../library/elliptics.h"
+
+#define BENCH_OPLOCK_ENTRIES	1024
+
+struct bench_oplock_entry {
+	struct rb_node		tree_entry;
+	struct list_head	list_entry;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	unsigned char		id[DNET_ID_SIZE];
+	int			locked;
+	int			refcnt;
+};
+
+struct bench_oplock_global {
+	pthread_mutex_t		lock;
+	struct rb_root		tree;
+	struct list_head	free_list;
+	struct bench_oplock_entry	entries[BENCH_OPLOCK_ENTRIES];
+};
+
+static struct bench_oplock_global bench_global;
+
+struct bench_oplock_thread {
+	pthread_t		tid;
+	struct dnet_node	*n;
+	void			(* lock)(struct dnet_node *n, struct dnet_id *key);
+	void			(* unlock)(struct dnet_node *n, struct dnet_id *key);
+	struct dnet_id		*keys;
+	int			key_num;
+	long			num;
+	unsigned int		seed;
+};
+
+static void bench_oplock_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -t num                    - number of locking threads, can be repeated (default: 1, 2, 4, 8)\n"
+			"  -k num                    - number of keys shared by all threads (default: 4096)\n"
+			"  -n num                    - number of lock/unlock pairs per thread (default: 1000000)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg)
+{
+	fputs(msg, stderr);
+}
+
+static void bench_global_init(void)
+{
+	struct bench_oplock_global *g = &bench_global;
+	int i;
+
+	pthread_mutex_init(&g->lock, NULL);
+	g->tree = RB_ROOT;
+	INIT_LIST_HEAD(&g->free_list);
+
+	for (i = 0; i < BENCH_OPLOCK_ENTRIES; ++i) {
+		pthread_mutex_init(&g->entries[i].lock, NULL);
+		pthread_cond_init(&g->entries[i].wait, NULL);
+		list_add_tail(&g->entries[i].list_entry, &g->free_list);
+	}
+}
+
+static struct bench_oplock_entry *bench_global_search_nolock(struct dnet_id *key)
+{
+	struct rb_node *node = bench_global.tree.rb_node;
+	struct bench_oplock_entry *entry;
+	int cmp;
+
+	while (node) {
+		entry = rb_entry(node, struct bench_oplock_entry, tree_entry);
+
+		cmp = memcmp(entry->id, key->id, DNET_ID_SIZE);
+		if (cmp < 0)
+			node = node->rb_left;
+		else if (cmp > 0)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void bench_global_insert_nolock(struct bench_oplock_entry *a)
+{
+	struct rb_node **node = &bench_global.tree.rb_node, *parent = NULL;
+	struct bench_oplock_entry *t;
+
+	while (*node) {
+		parent = *node;
+		t = rb_entry(parent, struct bench_oplock_entry, tree_entry);
+
+		if (memcmp(t->id, a->id, DNET_ID_SIZE) < 0)
+			node = &parent->rb_left;
+		else
+			node = &parent->rb_right;
+	}
+
+	rb_link_node(&a->tree_entry, parent, node);
+	rb_insert_color(&a->tree_entry, &bench_global.tree);
+}
+
+static void bench_global_lock(struct dnet_node *n __unused, struct dnet_id *key)
+{
+	struct bench_oplock_global *g = &bench_global;
+	struct bench_oplock_entry *entry;
+
+	pthread_mutex_lock(&g->lock);
+	entry = bench_global_search_nolock(key);
+	if (entry) {
+		entry->refcnt++;
+	} else {
+		entry = list_first_entry(&g->free_list, struct bench_oplock_entry, list_entry);
+		list_del(&entry->list_entry);
+
+		memcpy(entry->id, key->id, DNET_ID_SIZE);
+		entry->locked = 0;
+		entry->refcnt = 1;
+		bench_global_insert_nolock(entry);
+	}
+	pthread_mutex_unlock(&g->lock);
+
+	pthread_mutex_lock(&entry->lock);
+	while (entry->locked)
+		pthread_cond_wait(&entry->wait, &entry->lock);
+	entry->locked = 1;
+	pthread_mutex_unlock(&entry->lock);
+}
+
+static void bench_global_unlock(struct dnet_node *n __unused, struct dnet_id *key)
+{
+	struct bench_oplock_global *g = &bench_global;
+	struct bench_oplock_entry *entry;
+
+	pthread_mutex_lock(&g->lock);
+	entry = bench_global_search_nolock(key);
+	if (--entry->refcnt == 0) {
+		rb_erase(&entry->tree_entry, &g->tree);
+		list_add_tail(&entry->list_entry, &g->free_list);
+		entry = NULL;
+	}
+	pthread_mutex_unlock(&g->lock);
+
+	/* remaining references belong to waiters, they keep entry in the tree */
+	if (entry) {
+		pthread_mutex_lock(&entry->lock);
+		entry->locked = 0;
+		pthread_cond_signal(&entry->wait);
+		pthread_mutex_unlock(&entry->lock);
+	}
+}
+
+static void *bench_oplock_process(void *data)
+{
+	struct bench_oplock_thread *t = data;
+	struct dnet_id *key;
+	long i;
+
+	for (i = 0; i < t->num; ++i) {
+		key = &t->keys[rand_r(&t->seed) % t->key_num];
+
+		t->lock(t->n, key);
+		t->unlock(t->n, key);
+	}
+
+	return NULL;
+}
+
+static int bench_oplock_run(struct dnet_node *n, const char *name,
+		void (* lock)(struct dnet_node *n, struct dnet_id *key),
+		void (* unlock)(struct dnet_node *n, struct dnet_id *key),
+		struct dnet_id *keys, int key_num, int thread_num, long num)
+{
+	struct bench_oplock_thread *threads;
+	struct timeval start, end;
+	double diff;
+	int i, j, err = 0;
+
+	threads = calloc(thread_num, sizeof(struct bench_oplock_thread));
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < thread_num; ++i) {
+		threads[i].n = n;
+		threads[i].lock = lock;
+		threads[i].unlock = unlock;
+		threads[i].keys = keys;
+		threads[i].key_num = key_num;
+		threads[i].num = num;
+		threads[i].seed = i + 1;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < thread_num; ++i) {
+		err = pthread_create(&threads[i].tid, NULL, bench_oplock_process, &threads[i]);
+		if (err) {
+			err = -err;
+			break;
+		}
+	}
+
+	for (j = 0; j < i; ++j)
+		pthread_join(threads[j].tid, NULL);
+	gettimeofday(&end, NULL);
+
+	if (err)
+		goto err_out_free;
+
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+	printf("%8s: threads: %3d, %6.1f nsec per lock/unlock, %10.0f locks/sec\n",
+			name, thread_num, diff * 1000000000. / (num * thread_num), num * thread_num / diff);
+
+err_out_free:
+	free(threads);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	int default_threads[] = {1, 2, 4, 8};
+	int thread_nums[16], thread_count = 0;
+	int key_num = 4096;
+	long num = 1000000;
+	struct dnet_id *keys;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct dnet_log l;
+	unsigned int seed = 0;
+	int ch, i, j, err = 0;
+
+	while ((ch = getopt(argc, argv, "t:k:n:h")) != -1) {
+		switch (ch) {
+			case 't':
+				if (thread_count < (int)ARRAY_SIZE(thread_nums))
+					thread_nums[thread_count++] = atoi(optarg);
+				break;
+			case 'k':
+				key_num = atoi(optarg);
+				break;
+			case 'n':
+				num = atol(optarg);
+				break;
+			case 'h':
+			default:
+				bench_oplock_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (!thread_count) {
+		memcpy(thread_nums, default_threads, sizeof(default_threads));
+		thread_count = ARRAY_SIZE(default_threads);
+	}
+
+	for (i = 0; i < thread_count; ++i) {
+		/* global table can not hold more locked keys than its free list has */
+		if (thread_nums[i] <= 0 || thread_nums[i] > BENCH_OPLOCK_ENTRIES)
+			bench_oplock_usage(argv[0]);
+	}
+
+	if (key_num <= 0 || num <= 0)
+		bench_oplock_usage(argv[0]);
+
+	memset(&cfg, 0, sizeof(struct dnet_config));
+	memset(&l, 0, sizeof(struct dnet_log));
+
+	l.log = bench_log;
+	l.log_level = DNET_LOG_ERROR;
+
+	cfg.log = &l;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 60;
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -1;
+
+	/* oplocks are only created for server nodes */
+	err = dnet_locks_init(n, BENCH_OPLOCK_ENTRIES);
+	if (err) {
+		fprintf(stderr, "Failed to create oplock table: %d\n", err);
+		goto err_out_destroy;
+	}
+
+	keys = calloc(key_num, sizeof(struct dnet_id));
+	if (!keys) {
+		err = -ENOMEM;
+		goto err_out_locks;
+	}
+
+	for (i = 0; i < key_num; ++i) {
+		for (j = 0; j < DNET_ID_SIZE; ++j)
+			keys[i].id[j] = rand_r(&seed);
+	}
+
+	bench_global_init();
+
+	printf("keys: %d, lock/unlock pairs per thread: %ld\n", key_num, num);
+
+	for (i = 0; i < thread_count; ++i) {
+		err = bench_oplock_run(n, "global", bench_global_lock, bench_global_unlock,
+				keys, key_num, thread_nums[i], num);
+		if (!err)
+			err = bench_oplock_run(n, "striped", dnet_oplock, dnet_opunlock,
+					keys, key_num, thread_nums[i], num);
+		if (err)
+			break;
+	}
+
+	free(keys);
+err_out_locks:
+	dnet_locks_destroy(n);
+err_out_destroy:
+	dnet_node_destroy(n);
+	return err;
+}
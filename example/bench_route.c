@@ -0,0 +1,504 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Route lookup benchmark.
+ *
+ * Client node gets route table of states connected to local socketpairs,
+ * other ends only acknowledge what reconnect thread sends, then given number
+ * of threads look up states for random ids.
+ *
+ * 'snapshot' lookup is dnet_state_get_first() of the library, 'locked' one
+ * is the lookup it replaced: group list walk and binary search over group ids
+ * under n->state_lock. 'fullid' one uses the same route table snapshot as the
+ * library, but binary searches full ids instead of prefixes and jump table.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#include "../library/elliptics.h"
+
+#define BENCH_ROUTE_IDS		4096
+
+struct bench_route_thread {
+	pthread_t		tid;
+	struct dnet_node	*n;
+	struct dnet_net_state	*(* lookup)(struct dnet_node *n, struct dnet_id *id);
+	struct dnet_id		*ids;
+	long			num;
+	long			found;
+};
+
+static void bench_route_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -t num                    - number of lookup threads, can be repeated (default: 1, 2, 4, 8)\n"
+			"  -g num                    - number of groups (default: 3)\n"
+			"  -s num                    - number of states in every group (default: 32)\n"
+			"  -i num                    - number of ids of every state (default: 64)\n"
+			"  -n num                    - number of lookups per thread (default: 2000000)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg)
+{
+	fputs(msg, stderr);
+}
+
+struct bench_route_peers {
+	struct pollfd		*fds;
+	int			num;
+};
+
+static int bench_read(int s, void *data, size_t size)
+{
+	ssize_t err;
+
+	while (size) {
+		err = read(s, data, size);
+		if (err <= 0)
+			return err ? -errno : -ECONNRESET;
+
+		data += err;
+		size -= err;
+	}
+
+	return 0;
+}
+
+/* acknowledges route list requests, exits when client node closes all states */
+static void *bench_route_peer_process(void *data)
+{
+	struct bench_route_peers *p = data;
+	struct dnet_cmd cmd;
+	char buf[4096];
+	uint64_t size;
+	int i, err, alive = p->num;
+
+	while (alive) {
+		err = poll(p->fds, p->num, -1);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < p->num; ++i) {
+			if (!p->fds[i].revents)
+				continue;
+
+			err = bench_read(p->fds[i].fd, &cmd, sizeof(struct dnet_cmd));
+
+			dnet_convert_cmd(&cmd);
+			for (size = cmd.size; !err && size; size -= cmd.size) {
+				cmd.size = size < sizeof(buf) ? size : sizeof(buf);
+				err = bench_read(p->fds[i].fd, buf, cmd.size);
+			}
+
+			if (!err && !(cmd.trans & DNET_TRANS_REPLY)) {
+				cmd.trans |= DNET_TRANS_REPLY;
+				cmd.flags &= ~(DNET_FLAGS_MORE | DNET_FLAGS_NEED_ACK);
+				cmd.status = 0;
+				cmd.size = 0;
+				dnet_convert_cmd(&cmd);
+
+				if (write(p->fds[i].fd, &cmd, sizeof(struct dnet_cmd)) != sizeof(struct dnet_cmd))
+					err = -EPIPE;
+			}
+
+			if (err) {
+				/* negative descriptor is ignored by poll() */
+				close(p->fds[i].fd);
+				p->fds[i].fd = -1;
+				alive--;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void bench_random_id(unsigned char *id, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < DNET_ID_SIZE; ++i)
+		id[i] = rand_r(seed);
+}
+
+static struct dnet_net_state *bench_route_snapshot(struct dnet_node *n, struct dnet_id *id)
+{
+	return dnet_state_get_first(n, id);
+}
+
+static int bench_route_search_pos(struct dnet_group *g, struct dnet_id *id)
+{
+	int low, high, i, cmp;
+
+	for (low = -1, high = g->id_num; high - low > 1; ) {
+		i = low + (high - low) / 2;
+
+		cmp = dnet_id_cmp_str(g->ids[i].raw.id, id->id);
+		if (cmp < 0)
+			low = i;
+		else if (cmp > 0)
+			high = i;
+		else
+			return i;
+	}
+
+	i = high - 1;
+	if (i == -1)
+		i = g->id_num - 1;
+
+	return i;
+}
+
+static struct dnet_net_state *bench_route_locked(struct dnet_node *n, struct dnet_id *id)
+{
+	struct dnet_net_state *found = NULL;
+	struct dnet_group *g;
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (g->group_id == id->group_id) {
+			dnet_group_get(g);
+			found = dnet_state_get(g->ids[bench_route_search_pos(g, id)].idc->st);
+			dnet_group_put(g);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	return found;
+}
+
+static int bench_route_fullid_pos(struct dnet_route_group *g, struct dnet_id *id)
+{
+	int low, high, i, cmp;
+
+	for (low = -1, high = g->id_num; high - low > 1; ) {
+		i = low + (high - low) / 2;
+
+		cmp = dnet_id_cmp_str(g->ids[i].raw.id, id->id);
+		if (cmp < 0)
+			low = i;
+		else if (cmp > 0)
+			high = i;
+		else
+			return i;
+	}
+
+	i = high - 1;
+	if (i == -1)
+		i = g->id_num - 1;
+
+	return i;
+}
+
+/* route table is not changed while benchmark runs, so snapshot is used without read section */
+static struct dnet_net_state *bench_route_fullid(struct dnet_node *n, struct dnet_id *id)
+{
+	struct dnet_route_table *t = n->route.table;
+	struct dnet_route_group *g;
+	unsigned int pos;
+
+	for (pos = (id->group_id * 2654435761U) & t->hash_mask; (g = t->hash[pos]); pos = (pos + 1) & t->hash_mask) {
+		if (g->group_id == id->group_id)
+			return dnet_state_get(g->ids[bench_route_fullid_pos(g, id)].st);
+	}
+
+	return NULL;
+}
+
+static void *bench_route_process(void *data)
+{
+	struct bench_route_thread *t = data;
+	struct dnet_net_state *st;
+	long i;
+
+	for (i = 0; i < t->num; ++i) {
+		st = t->lookup(t->n, &t->ids[i & (BENCH_ROUTE_IDS - 1)]);
+		if (st) {
+			t->found++;
+			dnet_state_put(st);
+		}
+	}
+
+	return NULL;
+}
+
+static int bench_route_run(struct dnet_node *n, const char *name,
+		struct dnet_net_state *(* lookup)(struct dnet_node *n, struct dnet_id *id),
+		int thread_num, long num, int group_num)
+{
+	struct bench_route_thread *threads;
+	struct timeval start, end;
+	unsigned int seed;
+	double diff;
+	long found = 0;
+	int i, j, err = 0;
+
+	threads = calloc(thread_num, sizeof(struct bench_route_thread));
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < thread_num; ++i) {
+		threads[i].n = n;
+		threads[i].lookup = lookup;
+		threads[i].num = num;
+
+		threads[i].ids = malloc(BENCH_ROUTE_IDS * sizeof(struct dnet_id));
+		if (!threads[i].ids) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		seed = i + 1;
+		for (j = 0; j < BENCH_ROUTE_IDS; ++j) {
+			memset(&threads[i].ids[j], 0, sizeof(struct dnet_id));
+			bench_random_id(threads[i].ids[j].id, &seed);
+			threads[i].ids[j].group_id = 1 + rand_r(&seed) % group_num;
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < thread_num; ++i) {
+		err = pthread_create(&threads[i].tid, NULL, bench_route_process, &threads[i]);
+		if (err) {
+			err = -err;
+			break;
+		}
+	}
+
+	for (j = 0; j < i; ++j) {
+		pthread_join(threads[j].tid, NULL);
+		found += threads[j].found;
+	}
+	gettimeofday(&end, NULL);
+
+	if (err)
+		goto err_out_free;
+
+	if (found != num * thread_num) {
+		fprintf(stderr, "%s: only %ld of %ld lookups found a state\n", name, found, num * thread_num);
+		err = -ENOENT;
+		goto err_out_free;
+	}
+
+	diff = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.;
+	printf("%8s: threads: %3d, %6.1f nsec per lookup, %10.0f lookups/sec\n",
+			name, thread_num, diff * 1000000000. / (num * thread_num), num * thread_num / diff);
+
+err_out_free:
+	for (i = 0; i < thread_num; ++i)
+		free(threads[i].ids);
+	free(threads);
+	return err;
+}
+
+/*
+ * State is connected to one end of the socketpair, other end is kept open and never read,
+ * so that route requests sent by the reconnect thread just stay unanswered
+ */
+static int bench_route_state_create(struct dnet_node *n, int group_id, struct dnet_raw_id *ids, int id_num,
+		int idx, int *peer)
+{
+	struct dnet_net_state *st;
+	struct sockaddr_in sin;
+	struct dnet_addr addr;
+	int s[2], err;
+
+	err = socketpair(AF_UNIX, SOCK_STREAM, 0, s);
+	if (err) {
+		err = -errno;
+		goto err_out_exit;
+	}
+
+	fcntl(s[0], F_SETFL, O_NONBLOCK);
+	fcntl(s[0], F_SETFD, FD_CLOEXEC);
+
+	/* every state needs its own address, they are never connected to */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(1024 + idx);
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	memcpy(addr.addr, &sin, sizeof(sin));
+	addr.addr_len = sizeof(sin);
+	addr.family = AF_INET;
+
+	/* socket is closed by dnet_state_create() on error */
+	st = dnet_state_create(n, group_id, ids, id_num, &addr, s[0], &err, 0, -1, dnet_state_net_process);
+	if (!st)
+		goto err_out_close;
+
+	*peer = s[1];
+	return 0;
+
+err_out_close:
+	close(s[1]);
+err_out_exit:
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	int default_threads[] = {1, 2, 4, 8};
+	int thread_nums[16], thread_count = 0;
+	int group_num = 3, state_num = 32, id_num = 64;
+	long num = 2000000;
+	struct dnet_raw_id *ids;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct dnet_log l;
+	unsigned int seed = 0;
+	struct bench_route_peers peers;
+	pthread_t peer_tid;
+	int ch, i, j, err = 0;
+
+	while ((ch = getopt(argc, argv, "t:g:s:i:n:h")) != -1) {
+		switch (ch) {
+			case 't':
+				if (thread_count < (int)ARRAY_SIZE(thread_nums))
+					thread_nums[thread_count++] = atoi(optarg);
+				break;
+			case 'g':
+				group_num = atoi(optarg);
+				break;
+			case 's':
+				state_num = atoi(optarg);
+				break;
+			case 'i':
+				id_num = atoi(optarg);
+				break;
+			case 'n':
+				num = atol(optarg);
+				break;
+			case 'h':
+			default:
+				bench_route_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (!thread_count) {
+		memcpy(thread_nums, default_threads, sizeof(default_threads));
+		thread_count = ARRAY_SIZE(default_threads);
+	}
+
+	for (i = 0; i < thread_count; ++i) {
+		if (thread_nums[i] <= 0)
+			bench_route_usage(argv[0]);
+	}
+
+	if (group_num <= 0 || state_num <= 0 || id_num <= 0 || num <= 0)
+		bench_route_usage(argv[0]);
+
+	memset(&cfg, 0, sizeof(struct dnet_config));
+	memset(&l, 0, sizeof(struct dnet_log));
+
+	l.log = bench_log;
+	l.log_level = DNET_LOG_ERROR;
+
+	cfg.log = &l;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 60;
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -1;
+
+	memset(&peers, 0, sizeof(struct bench_route_peers));
+	peers.fds = calloc(group_num * state_num, sizeof(struct pollfd));
+	ids = malloc(id_num * sizeof(struct dnet_raw_id));
+	if (!peers.fds || !ids) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < group_num * state_num; ++i) {
+		for (j = 0; j < id_num; ++j)
+			bench_random_id(ids[j].id, &seed);
+
+		err = bench_route_state_create(n, 1 + i % group_num, ids, id_num, i, &peers.fds[i].fd);
+		if (err) {
+			fprintf(stderr, "Failed to create state %d: %d\n", i, err);
+			goto err_out_free;
+		}
+		peers.fds[i].events = POLLIN;
+		peers.num++;
+	}
+
+	err = pthread_create(&peer_tid, NULL, bench_route_peer_process, &peers);
+	if (err) {
+		fprintf(stderr, "Failed to start peer thread: %d\n", err);
+		err = -err;
+		goto err_out_free;
+	}
+
+	printf("groups: %d, states per group: %d, ids per state: %d, lookups per thread: %ld\n",
+			group_num, state_num, id_num, num);
+
+	for (i = 0; i < thread_count; ++i) {
+		err = bench_route_run(n, "locked", bench_route_locked, thread_nums[i], num, group_num);
+		if (!err)
+			err = bench_route_run(n, "fullid", bench_route_fullid, thread_nums[i], num, group_num);
+		if (!err)
+			err = bench_route_run(n, "snapshot", bench_route_snapshot, thread_nums[i], num, group_num);
+		if (err)
+			break;
+	}
+
+	/* states are destroyed with the node, peer thread closes its ends then */
+	dnet_node_destroy(n);
+	pthread_join(peer_tid, NULL);
+
+	free(peers.fds);
+	free(ids);
+	return err;
+
+err_out_free:
+	dnet_node_destroy(n);
+
+	for (i = 0; i < peers.num; ++i)
+		close(peers.fds[i].fd);
+	free(peers.fds);
+	free(ids);
+	return err;
+}
@@ -0,0 +1,307 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Per-state transaction table benchmark.
+ *
+ * Keeps given number of transactions in flight and replaces them one by one:
+ * reply is searched and removed, new transaction with the next tid is inserted,
+ * like it happens on the state with a steady request stream. Replies come either
+ * in the order requests were sent, or in random order.
+ *
+ * Hash table is the one used by the library, rbtree is the tid-ordered tree
+ * it replaced, both work with the same transaction objects.
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+#include "../library/elliptics.h"
+#include "../library/rbtree.h"
+
+struct bench_trans {
+	struct rb_node		rb_entry;
+	struct dnet_trans	t;
+};
+
+struct bench_table {
+	const char		*name;
+	void			(* init)(void);
+	void			(* destroy)(void);
+	int			(* insert)(struct bench_trans *b);
+	struct dnet_trans	*(* search)(uint64_t tid);
+	void			(* remove)(struct bench_trans *b);
+};
+
+static struct dnet_trans_table bench_hash;
+static struct rb_root bench_root;
+
+static void bench_hash_init(void)
+{
+	memset(&bench_hash, 0, sizeof(struct dnet_trans_table));
+}
+
+static void bench_hash_destroy(void)
+{
+	dnet_trans_table_destroy(&bench_hash);
+}
+
+static int bench_hash_insert(struct bench_trans *b)
+{
+	return dnet_trans_insert_nolock(&bench_hash, &b->t);
+}
+
+static struct dnet_trans *bench_hash_search(uint64_t tid)
+{
+	return dnet_trans_search(&bench_hash, tid);
+}
+
+static void bench_hash_remove(struct bench_trans *b)
+{
+	dnet_trans_remove_nolock(&bench_hash, &b->t);
+}
+
+static void bench_rb_init(void)
+{
+	bench_root = RB_ROOT;
+}
+
+static void bench_rb_destroy(void)
+{
+	bench_root = RB_ROOT;
+}
+
+static int bench_rb_insert(struct bench_trans *a)
+{
+	struct rb_node **n = &bench_root.rb_node, *parent = NULL;
+	struct bench_trans *b;
+
+	while (*n) {
+		parent = *n;
+		b = rb_entry(parent, struct bench_trans, rb_entry);
+
+		if (b->t.trans > a->t.trans)
+			n = &parent->rb_left;
+		else if (b->t.trans < a->t.trans)
+			n = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(&a->rb_entry, parent, n);
+	rb_insert_color(&a->rb_entry, &bench_root);
+	return 0;
+}
+
+static struct dnet_trans *bench_rb_search(uint64_t tid)
+{
+	struct rb_node *n = bench_root.rb_node;
+	struct bench_trans *b;
+
+	while (n) {
+		b = rb_entry(n, struct bench_trans, rb_entry);
+
+		if (b->t.trans > tid)
+			n = n->rb_left;
+		else if (b->t.trans < tid)
+			n = n->rb_right;
+		else
+			return dnet_trans_get(&b->t);
+	}
+
+	return NULL;
+}
+
+static void bench_rb_remove(struct bench_trans *b)
+{
+	rb_erase(&b->rb_entry, &bench_root);
+}
+
+static struct bench_table bench_tables[] = {
+	{ "rbtree", bench_rb_init, bench_rb_destroy, bench_rb_insert, bench_rb_search, bench_rb_remove },
+	{ "hash", bench_hash_init, bench_hash_destroy, bench_hash_insert, bench_hash_search, bench_hash_remove },
+};
+
+static void bench_trans_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -n num                    - number of transactions in flight, can be repeated\n"
+			"                                (default: 10000, 100000, 1000000)\n"
+			"  -i num                    - number of replaced transactions (default: 2000000)\n"
+			"  -s num                    - maximum gap between tids of the state (default: 8)\n"
+			"  -h                        - this help\n"
+			, p);
+	exit(-1);
+}
+
+/*
+ * Tids are allocated by the node-wide counter,
+ * so tids of the single state grow with random gaps
+ */
+static inline uint64_t bench_next_tid(uint64_t tid, int gap)
+{
+	return tid + 1 + rand() % gap;
+}
+
+static int bench_trans_run(struct bench_table *table, struct bench_trans **trans, int num,
+		long iterations, int gap, int random_order)
+{
+	struct bench_trans *b;
+	struct dnet_trans *t;
+	struct timeval start, end;
+	uint64_t tid = 0;
+	long i;
+	int pos = 0, err;
+	double diff;
+
+	srand(0);
+	table->init();
+
+	for (i = 0; i < num; ++i) {
+		tid = bench_next_tid(tid, gap);
+		trans[i]->t.trans = tid;
+
+		err = table->insert(trans[i]);
+		if (err)
+			goto err_out_destroy;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; ++i) {
+		if (random_order)
+			pos = rand() % num;
+
+		b = trans[pos];
+
+		t = table->search(b->t.trans);
+		if (t != &b->t) {
+			err = -ENOENT;
+			goto err_out_destroy;
+		}
+		atomic_dec(&t->refcnt);
+
+		table->remove(b);
+
+		tid = bench_next_tid(tid, gap);
+		b->t.trans = tid;
+
+		err = table->insert(b);
+		if (err)
+			goto err_out_destroy;
+
+		if (!random_order && ++pos == num)
+			pos = 0;
+	}
+	gettimeofday(&end, NULL);
+
+	diff = (end.tv_sec - start.tv_sec) * 1000000. + (end.tv_usec - start.tv_usec);
+	printf("%8s: in-flight: %8d, replies: %6s, %7.1f nsec per search+remove+insert\n",
+			table->name, num, random_order ? "random" : "fifo", diff * 1000 / iterations);
+
+	/* objects are reused by the next run, only table itself is dropped */
+	for (i = 0; i < num; ++i)
+		table->remove(trans[i]);
+	err = 0;
+
+err_out_destroy:
+	table->destroy();
+	if (err)
+		fprintf(stderr, "%s: in-flight: %d: failed: %d\n", table->name, num, err);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	int default_nums[] = {10000, 100000, 1000000};
+	int nums[16], num_count = 0, max_num = 0;
+	struct bench_trans **trans;
+	long iterations = 2000000;
+	int gap = 8;
+	int ch, i, j, order, err = 0;
+
+	while ((ch = getopt(argc, argv, "n:i:s:h")) != -1) {
+		switch (ch) {
+			case 'n':
+				if (num_count < (int)ARRAY_SIZE(nums))
+					nums[num_count++] = atoi(optarg);
+				break;
+			case 'i':
+				iterations = atol(optarg);
+				break;
+			case 's':
+				gap = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				bench_trans_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (!num_count) {
+		memcpy(nums, default_nums, sizeof(default_nums));
+		num_count = ARRAY_SIZE(default_nums);
+	}
+
+	for (i = 0; i < num_count; ++i) {
+		if (nums[i] <= 0)
+			bench_trans_usage(argv[0]);
+		if (nums[i] > max_num)
+			max_num = nums[i];
+	}
+
+	if (iterations <= 0 || gap <= 0)
+		bench_trans_usage(argv[0]);
+
+	trans = calloc(max_num, sizeof(struct bench_trans *));
+	if (!trans)
+		return -ENOMEM;
+
+	/* transactions are allocated one by one, like they are in the library */
+	for (i = 0; i < max_num; ++i) {
+		trans[i] = calloc(1, sizeof(struct bench_trans));
+		if (!trans[i]) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		atomic_init(&trans[i]->t.refcnt, 1);
+		INIT_HLIST_NODE(&trans[i]->t.trans_entry);
+	}
+
+	for (i = 0; i < num_count; ++i) {
+		for (order = 0; order < 2; ++order) {
+			for (j = 0; j < (int)ARRAY_SIZE(bench_tables); ++j) {
+				err = bench_trans_run(&bench_tables[j], trans, nums[i], iterations, gap, order);
+				if (err)
+					goto err_out_free;
+			}
+		}
+	}
+
+err_out_free:
+	for (i = 0; i < max_num && trans[i]; ++i)
+		free(trans[i]);
+	free(trans);
+	return err;
+}
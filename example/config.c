@@ -110,6 +110,12 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.client_prio = value;
 	else if (!strcmp(key, "indexes_shard_count"))
 		dnet_cur_cfg_data->cfg_state.indexes_shard_count = value;
+	else if (!strcmp(key, "slow_request_threshold"))
+		dnet_cur_cfg_data->cfg_state.slow_request_threshold = value;
+	else if (!strcmp(key, "log_ring_size"))
+		dnet_cur_cfg_data->cfg_state.log_ring_size = value;
+	else if (!strcmp(key, "trace_sample_rate"))
+		dnet_cur_cfg_data->cfg_state.trace_sample_rate = value;
 	else
 		return -1;
 
@@ -336,6 +342,57 @@ static int dnet_set_cache_size(struct dnet_config_backend *b __unused, char *key
 	return 0;
 }
 
+static int dnet_set_send_limit(struct dnet_config_backend *b __unused, char *key, char *value)
+{
+	uint64_t limit = strtoull(value, NULL, 0);
+
+	if (!strcmp(key, "send_limit"))
+		dnet_cur_cfg_data->cfg_state.send_limit = limit;
+	else
+		dnet_cur_cfg_data->cfg_state.node_send_limit = limit;
+	return 0;
+}
+
+static int dnet_set_log_file(struct dnet_config_backend *b __unused, char *key, char *value)
+{
+	char **ptr = &dnet_cur_cfg_data->cfg_state.slow_log;
+
+	if (!strcmp(key, "trace_file"))
+		ptr = &dnet_cur_cfg_data->trace_file;
+
+	free(*ptr);
+
+	*ptr = strdup(value);
+	if (!*ptr)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dnet_set_cache_policy(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	if (!strcmp(value, "lru"))
+		dnet_cur_cfg_data->cfg_state.cache_policy = DNET_CACHE_POLICY_LRU;
+	else if (!strcmp(value, "tinylfu"))
+		dnet_cur_cfg_data->cfg_state.cache_policy = DNET_CACHE_POLICY_TINYLFU;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int dnet_set_net_engine(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	if (!strcmp(value, "epoll"))
+		dnet_cur_cfg_data->cfg_state.net_engine = DNET_NET_ENGINE_EPOLL;
+	else if (!strcmp(value, "uring"))
+		dnet_cur_cfg_data->cfg_state.net_engine = DNET_NET_ENGINE_URING;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
 static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"mallopt_mmap_threshold", dnet_set_malloc_options},
 	{"log_level", dnet_simple_set},
@@ -351,10 +408,14 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"backend", dnet_set_backend},
 	{"daemon", dnet_simple_set},
 	{"log", dnet_set_log},
+	{"log_ring_size", dnet_simple_set},
 	{"history", dnet_set_history_env},
 	{"io_thread_num", dnet_simple_set},
 	{"nonblocking_io_thread_num", dnet_simple_set},
 	{"net_thread_num", dnet_simple_set},
+	{"net_engine", dnet_set_net_engine},
+	{"send_limit", dnet_set_send_limit},
+	{"node_send_limit", dnet_set_send_limit},
 	{"bg_ionice_class", dnet_simple_set},
 	{"bg_ionice_prio", dnet_simple_set},
 	{"removal_delay", dnet_simple_set},
@@ -363,7 +424,12 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"client_net_prio", dnet_simple_set},
 	{"srw_config", dnet_set_srw},
 	{"cache_size", dnet_set_cache_size},
+	{"cache_policy", dnet_set_cache_policy},
 	{"indexes_shard_count", dnet_simple_set},
+	{"slow_request_threshold", dnet_simple_set},
+	{"slow_log", dnet_set_log_file},
+	{"trace_sample_rate", dnet_simple_set},
+	{"trace_file", dnet_set_log_file},
 };
 
 static int dnet_set_backend(struct dnet_config_backend *current_backend __unused, char *key __unused, char *value)
@@ -577,6 +643,7 @@ struct dnet_node *dnet_parse_config(const char *file, int mon)
 		/* backend cleanup is already called */
 		goto err_out_free;
 	}
+	dnet_cur_cfg_data->node = n;
 
 	err = dnet_common_add_remote_addr(n, dnet_cur_cfg_data->cfg_remotes);
 	if (err)
@@ -591,8 +658,11 @@ err_out_node_destroy:
 	dnet_cur_cfg_data = NULL;
 	dnet_server_node_destroy(n);
 err_out_free:
-	if (dnet_cur_cfg_data)
+	if (dnet_cur_cfg_data) {
 		free(dnet_cur_cfg_data->cfg_remotes);
+		free(dnet_cur_cfg_data->cfg_state.slow_log);
+		free(dnet_cur_cfg_data->trace_file);
+	}
 
 //err_out_eblob_exit:
 	dnet_eblob_backend_exit();
@@ -632,8 +702,30 @@ void dnet_backend_log_raw(int level, const char *format, ...)
 		return;
 
 	va_start(args, format);
-	vsnprintf(buf, buflen, format, args);
-	buf[buflen-1] = '\0';
-	l->log(l->log_private, level, buf);
+	if (dnet_cur_cfg_data->node) {
+		dnet_log_vraw(dnet_cur_cfg_data->node, level, format, args);
+	} else {
+		vsnprintf(buf, buflen, format, args);
+		buf[buflen-1] = '\0';
+		l->log(l->log_private, level, buf);
+	}
 	va_end(args);
 }
+
+void dnet_backend_log_binary(int level, const char *format, uint64_t *args, int num)
+{
+	char buf[1024];
+	struct dnet_log *l = dnet_cur_cfg_data->cfg_state.log;
+
+	if (!dnet_backend_check_log_level(level))
+		return;
+
+	if (dnet_cur_cfg_data->node) {
+		dnet_log_binary(dnet_cur_cfg_data->node, level, format, args, num);
+	} else {
+		snprintf(buf, sizeof(buf), format,
+				num > 0 ? args[0] : 0, num > 1 ? args[1] : 0, num > 2 ? args[2] : 0,
+				num > 3 ? args[3] : 0, num > 4 ? args[4] : 0, num > 5 ? args[5] : 0);
+		l->log(l->log_private, level, buf);
+	}
+}
@@ -156,8 +156,9 @@ static int blob_write(struct eblob_backend_config *c, void *state,
 	static const size_t ehdr_size = sizeof(struct dnet_ext_list_hdr);
 	int err;
 
-	dnet_backend_log(DNET_LOG_NOTICE, "%s: EBLOB: blob-write: WRITE: start: offset: %llu, size: %llu, ioflags: 0x%x.\n",
-		dnet_dump_id_str(io->id), (unsigned long long)io->offset, (unsigned long long)io->size, io->flags);
+	dnet_backend_log_fast(DNET_LOG_NOTICE, "%012llx: EBLOB: blob-write: WRITE: start: offset: %llu, size: %llu, ioflags: 0x%llx.\n",
+		dnet_backend_id_prefix(io->id), (unsigned long long)io->offset,
+		(unsigned long long)io->size, (unsigned long long)io->flags);
 
 	dnet_convert_io_attr(io);
 
@@ -211,9 +212,10 @@ static int blob_write(struct eblob_backend_config *c, void *state,
 			goto err_out_exit;
 		}
 
-		dnet_backend_log(DNET_LOG_NOTICE, "%s: EBLOB: blob-write: WRITE: Ok: "
-				"offset: %" PRIu64 ", size: %" PRIu64 ".\n",
-				dnet_dump_id_str(io->id), io->offset, io->size);
+		dnet_backend_log_fast(DNET_LOG_NOTICE, "%012llx: EBLOB: blob-write: WRITE: Ok: "
+				"offset: %llu, size: %llu.\n",
+				dnet_backend_id_prefix(io->id), (unsigned long long)io->offset,
+				(unsigned long long)io->size);
 	}
 
 	if (io->flags & DNET_IO_FLAGS_COMMIT) {
@@ -260,8 +262,9 @@ static int blob_write(struct eblob_backend_config *c, void *state,
 		goto err_out_exit;
 	}
 
-	dnet_backend_log(DNET_LOG_INFO, "%s: EBLOB: blob-write: fd: %d, offset: %" PRIu64 ", offset-within-fd: %" PRIu64 ", size: %" PRIu64 "\n",
-			dnet_dump_id_str(io->id), wc.data_fd, wc.offset, fd_offset, wc.size);
+	dnet_backend_log_fast(DNET_LOG_INFO, "%012llx: EBLOB: blob-write: fd: %lld, offset: %llu, offset-within-fd: %llu, size: %llu\n",
+			dnet_backend_id_prefix(io->id), (long long)wc.data_fd, (unsigned long long)wc.offset,
+			(unsigned long long)fd_offset, (unsigned long long)wc.size);
 
 err_out_exit:
 	dnet_ext_list_destroy(&elist);
@@ -44,7 +44,7 @@ using namespace ioremap::elliptics;
 #endif
 
 static struct dnet_log stat_logger;
-static int stat_mem, stat_la, stat_fs;
+static int stat_mem, stat_la, stat_fs, stat_latency;
 static FILE *stream = NULL;
 
 static void print_stat(const stat_result_entry &result)
@@ -97,6 +97,53 @@ static void print_stat(const stat_result_entry &result)
 	fflush(stream);
 }
 
+static void print_latency_hist(const char *type, const char *name, const uint64_t *hist, int bucket_num)
+{
+	unsigned long long total = 0;
+
+	for (int i = 0; i < bucket_num; ++i)
+		total += hist[i];
+
+	if (!total)
+		return;
+
+	fprintf(stream, "  %-8s %-16s count: %10llu, p50: %10llu, p99: %10llu, p999: %10llu usecs\n",
+		type, name, total,
+		(unsigned long long)dnet_latency_percentile(hist, bucket_num, 50),
+		(unsigned long long)dnet_latency_percentile(hist, bucket_num, 99),
+		(unsigned long long)dnet_latency_percentile(hist, bucket_num, 99.9));
+}
+
+static void print_latency(const stat_count_result_entry &result)
+{
+	dnet_latency_stat *ls = result.latency();
+	char str[64];
+	struct tm tm;
+	struct timeval tv;
+
+	if (!ls)
+		return;
+
+	gettimeofday(&tv, NULL);
+	localtime_r((time_t *)&tv.tv_sec, &tm);
+	strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+	fprintf(stream, "%s.%06lu : %s: %s: latency\n", str, (unsigned long)tv.tv_usec,
+		dnet_dump_id(&result.command()->id), dnet_server_convert_dnet_addr(result.address()));
+
+	for (int i = 0; i < ls->cmd_num; ++i)
+		print_latency_hist("command", dnet_counter_string(i, ls->cmd_num),
+				&ls->hist[i * ls->bucket_num], ls->bucket_num);
+	for (int i = 0; i < ls->cmd_num; ++i)
+		print_latency_hist("backend", dnet_counter_string(i, ls->cmd_num),
+				&ls->hist[(ls->cmd_num + i) * ls->bucket_num], ls->bucket_num);
+	for (int i = 0; i < ls->stage_num; ++i)
+		print_latency_hist("stage", dnet_stage_string(i),
+				&ls->hist[(ls->cmd_num * 2 + i) * ls->bucket_num], ls->bucket_num);
+
+	fflush(stream);
+}
+
 static void stat_usage(char *p)
 {
 	fprintf(stderr, "Usage: %s\n"
@@ -110,6 +157,7 @@ static void stat_usage(char *p)
 			" -M                   - show memory usage statistics\n"
 			" -F                   - show filesystem usage statistics\n"
 			" -A                   - show load average statistics\n"
+			" -C                   - show per-command and per-stage latency percentiles\n"
 	       , p);
 }
 
@@ -132,7 +180,7 @@ int main(int argc, char *argv[])
 
 	timeout = 1;
 
-	while ((ch = getopt(argc, argv, "g:MFAt:m:w:l:I:r:h")) != -1) {
+	while ((ch = getopt(argc, argv, "g:MFACt:m:w:l:I:r:h")) != -1) {
 		switch (ch) {
 			case 'g':
 				group = atoi(optarg);
@@ -146,6 +194,9 @@ int main(int argc, char *argv[])
 			case 'A':
 				stat_la = 1;
 				break;
+			case 'C':
+				stat_latency = 1;
+				break;
 			case 't':
 				timeout = atoi(optarg);
 				break;
@@ -205,6 +256,11 @@ int main(int argc, char *argv[])
 		for (;;) {
 			struct dnet_id raw;
 
+			if (stat_latency) {
+				auto result = sess.stat_log_count();
+				std::for_each(result.begin(), result.end(), print_latency);
+			}
+
 			if (!id_idx) {
 				auto result = sess.stat_log();
 				std::for_each(result.begin(), result.end(), print_stat);
@@ -147,6 +147,41 @@ void dnet_backend_log_raw(int level, const char *fmt, ...) __attribute__ ((forma
 			dnet_backend_log_raw(level, format, ##a); 	\
 	} while (0)
 
+/*
+ * Fast path for hot request logs: integer arguments are copied into thread
+ * log ring and formatted later by log thread. Format must be a string literal,
+ * all arguments are printed with 64-bit conversions like %llu or %llx and should
+ * be cast to (unsigned) long long, format is checked against them at compile time
+ */
+void dnet_backend_log_binary(int level, const char *format, uint64_t *args, int num);
+
+static inline void __attribute__ ((format(printf, 2, 3))) dnet_backend_log_fast_check(int level, const char *format, ...)
+{
+	(void) level;
+	(void) format;
+}
+
+#define dnet_backend_log_fast(level, format, a...)					\
+	do {										\
+		if (0)									\
+			dnet_backend_log_fast_check(level, format, ##a);		\
+		if (dnet_backend_check_log_level(level))				\
+			dnet_backend_log_binary(level, format, (uint64_t []){ a },	\
+					sizeof((uint64_t []){ a }) / sizeof(uint64_t));	\
+	} while (0)
+
+/* first DNET_DUMP_NUM bytes of id, printed with %012llx it matches dnet_dump_id_str() */
+static inline unsigned long long dnet_backend_id_prefix(const unsigned char *id)
+{
+	unsigned long long prefix = 0;
+	int i;
+
+	for (i = 0; i < DNET_DUMP_NUM; ++i)
+		prefix = (prefix << 8) | id[i];
+
+	return prefix;
+}
+
 #ifdef __cplusplus
 }
 #endif
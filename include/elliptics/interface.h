@@ -284,6 +284,25 @@ struct dnet_backend_callbacks {
 	char *			(* dir)(void);
 };
 
+/*
+ * Cache eviction policies: LRU admits everything,
+ * TinyLFU admits new entry read from disk only if it is accessed
+ * more frequently than the entry it would evict
+ */
+enum dnet_cache_policy {
+	DNET_CACHE_POLICY_LRU = 0,
+	DNET_CACHE_POLICY_TINYLFU,
+};
+
+/*
+ * Network engines: epoll is always available,
+ * io_uring requires elliptics to be built with liburing (WITH_URING)
+ */
+enum dnet_net_engine {
+	DNET_NET_ENGINE_EPOLL = 0,
+	DNET_NET_ENGINE_URING,
+};
+
 /*
  * Node configuration interface.
  */
@@ -395,8 +414,40 @@ struct dnet_config
 
 	int			cache_sync_timeout;
 
-	/* so that we do not change major version frequently */
-	int			reserved_for_future_use[11];
+	/*
+	 * Requests processed longer than @slow_request_threshold msecs (0 disables)
+	 * are logged with their stage timing into @slow_log file, or into node log if it is not set
+	 */
+	int			slow_request_threshold;
+
+	/*
+	 * Limits of queued outgoing data in bytes, 0 means no limit.
+	 * Reading from connection is paused when its queue exceeds @send_limit,
+	 * read requests fail with -ENOBUFS when whole node exceeds @node_send_limit
+	 */
+	uint64_t		send_limit;
+	uint64_t		node_send_limit;
+
+	/* see @slow_request_threshold */
+	char			*slow_log;
+
+	/*
+	 * Size of per-thread log ring in bytes, messages are written into log
+	 * by background thread. 0 means messages are logged synchronously.
+	 */
+	int			log_ring_size;
+
+	/*
+	 * 1 in @trace_sample_rate requests is traced: its processing stages are
+	 * written into file set by dnet_node_set_trace_file(), 0 disables tracing
+	 */
+	int			trace_sample_rate;
+
+	/* Cache eviction policy, DNET_CACHE_POLICY_* */
+	int			cache_policy;
+
+	/* Network engine, DNET_NET_ENGINE_* */
+	int			net_engine;
 };
 
 struct dnet_node *dnet_get_node_from_state(void *state);
@@ -912,6 +963,7 @@ int dnet_mix_states(struct dnet_session *s, struct dnet_id *id, int **groupsp);
 
 char * __attribute__((weak)) dnet_cmd_string(int cmd);
 char *dnet_counter_string(int cntr, int cmd_num);
+char *dnet_stage_string(int stage);
 
 int dnet_checksum_file(struct dnet_node *n, const char *file, uint64_t offset, uint64_t size, void *csum, int csize);
 int dnet_checksum_fd(struct dnet_node *n, int fd, uint64_t offset, uint64_t size, void *csum, int csize);
@@ -938,6 +990,12 @@ int dnet_send_cmd(struct dnet_session *s,
 int dnet_flags(struct dnet_node *n);
 void dnet_set_timeouts(struct dnet_node *n, int wait_timeout, int check_timeout);
 
+/*
+ * Opens file where traced requests are written, see dnet_config::trace_sample_rate.
+ * Can be set only once, returns negative error code on failure.
+ */
+int dnet_node_set_trace_file(struct dnet_node *n, const char *file);
+
 #define DNET_CONF_ADDR_DELIM	':'
 int dnet_parse_addr(char *addr, int *portp, int *familyp);
 
@@ -92,6 +92,24 @@ enum dnet_counters {
 	DNET_CNTR_DBR_ERROR,			/* Kyoto Cabinet DB read error */
 	DNET_CNTR_DBW_SYSTEM,			/* Kyoto Cabinet DB write error KCESYSTEM */
 	DNET_CNTR_DBW_ERROR,			/* Kyoto Cabinet DB write error */
+	DNET_CNTR_RECV_CACHE_HIT,		/* Receive buffers reused from network thread cache */
+	DNET_CNTR_RECV_CACHE_MISS,		/* Receive buffers allocated with malloc() */
+	DNET_CNTR_SEND_QUEUE_SIZE,		/* Bytes queued for sending on all connections (on given one in per-state stats) */
+	DNET_CNTR_SEND_QUEUE_PEAK,		/* Maximum of bytes queued for sending (on given connection in per-state stats) */
+	DNET_CNTR_SEND_QUEUE_LIMIT,		/* Node send queue limit, connection limit is in err */
+	DNET_CNTR_SEND_QUEUE_PAUSED,		/* Number of times reading was paused because of connection limit */
+	DNET_CNTR_SEND_QUEUE_REJECTED,		/* Requests failed with -ENOBUFS because of node limit */
+	DNET_CNTR_TRANS_POOL_USED,		/* Transaction objects currently allocated */
+	DNET_CNTR_TRANS_POOL_CACHED,		/* Free transaction objects kept in pool and thread caches */
+	DNET_CNTR_TRANS_POOL_MISS,		/* Transaction allocations which had to call malloc() */
+	DNET_CNTR_OPLOCK_SHARED_WAIT,		/* Shared oplocks which had to wait, total wait time in usecs is in err */
+	DNET_CNTR_OPLOCK_EXCL_WAIT,		/* Exclusive oplocks which had to wait, total wait time in usecs is in err */
+	DNET_CNTR_LOG_DROPPED,			/* Log messages dropped because thread log ring was full */
+	DNET_CNTR_CACHE_HIT,			/* Cache reads served from memory */
+	DNET_CNTR_CACHE_MISS,			/* Cache reads which did not find data in memory */
+	DNET_CNTR_CACHE_ADMIT_REJECT,		/* Data read from disk which was not admitted into cache by policy */
+	DNET_CNTR_CACHE_EVICT,			/* Entries evicted from cache to free space */
+	DNET_CNTR_CACHE_COALESCED,		/* Cache misses served by disk read already in flight for the same key */
 	DNET_CNTR_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown counters */
 	__DNET_CNTR_MAX,
 };
@@ -189,6 +207,9 @@ static inline void dnet_convert_cmd(struct dnet_cmd *cmd)
 /* What type of counters to fetch */
 #define DNET_ATTR_CNTR_GLOBAL			(1ULL<<32)
 
+/* Append per-command latency histograms to global counters */
+#define DNET_ATTR_CNTR_LATENCY			(1ULL<<33)
+
 /* Bulk request for checking files */
 #define DNET_ATTR_BULK_CHECK			(1ULL<<32)
 
@@ -568,6 +589,90 @@ static inline void dnet_convert_addr_stat(struct dnet_addr_stat *st, int num)
 	dnet_convert_stat_count(st->count, num);
 }
 
+/*
+ * Log-scale latency histogram: bucket 0 counts operations faster than 2 usecs,
+ * bucket i > 0 those which took [2^i, 2^(i+1)) usecs, the last one also gets slower ones.
+ */
+#define DNET_LATENCY_BUCKETS		32
+
+/* Stages of server side request processing */
+enum dnet_stage {
+	DNET_STAGE_QUEUE = 0,			/* Received request waited in io pool queue */
+	DNET_STAGE_LOCK,			/* Waited for the key oplock */
+	DNET_STAGE_PROCESS,			/* Command processing except backend handler */
+	DNET_STAGE_BACKEND,			/* Backend command handler */
+	DNET_STAGE_ACK,				/* Final reply queueing */
+	DNET_STAGE_SEND,			/* Any reply waited in connection send queue */
+	__DNET_STAGE_MAX,
+};
+
+/*
+ * Follows counters in global STAT_COUNT reply when DNET_ATTR_CNTR_LATENCY is set.
+ * There are 2 * cmd_num + stage_num histograms of bucket_num entries: whole command
+ * processing time for every command, then the time spent in backend command handler
+ * for every command, then time of every processing stage.
+ */
+struct dnet_latency_stat
+{
+	int				cmd_num;
+	int				bucket_num;
+	int				stage_num;
+	int				reserved;
+	uint64_t			hist[0];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_latency_stat(struct dnet_latency_stat *ls, int num)
+{
+	int i;
+
+	ls->cmd_num = dnet_bswap32(ls->cmd_num);
+	ls->bucket_num = dnet_bswap32(ls->bucket_num);
+	ls->stage_num = dnet_bswap32(ls->stage_num);
+	if (!num)
+		num = (ls->cmd_num * 2 + ls->stage_num) * ls->bucket_num;
+
+	for (i=0; i<num; ++i)
+		ls->hist[i] = dnet_bswap64(ls->hist[i]);
+}
+
+static inline int dnet_latency_bucket(uint64_t usecs)
+{
+	int bucket = 0;
+
+	while ((usecs >>= 1) && bucket < DNET_LATENCY_BUCKETS - 1)
+		bucket++;
+
+	return bucket;
+}
+
+/*
+ * Returns upper bound in usecs of the bucket where given percentile (0-100) falls,
+ * and 0 if histogram is empty
+ */
+static inline uint64_t dnet_latency_percentile(const uint64_t *hist, int bucket_num, double percentile)
+{
+	uint64_t total = 0, sum = 0, rank;
+	int i;
+
+	for (i=0; i<bucket_num; ++i)
+		total += hist[i];
+
+	if (!total)
+		return 0;
+
+	rank = (uint64_t)(total * percentile / 100.0);
+	if (rank >= total)
+		rank = total - 1;
+
+	for (i=0; i<bucket_num; ++i) {
+		sum += hist[i];
+		if (sum > rank)
+			break;
+	}
+
+	return 2ULL << i;
+}
+
 static inline void dnet_stat_inc(struct dnet_stat_count *st, int cmd, int err)
 {
 	if (cmd >= __DNET_CMD_MAX)
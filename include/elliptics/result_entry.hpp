@@ -160,6 +160,8 @@ class stat_count_result_entry : public callback_result_entry
 		stat_count_result_entry &operator =(const stat_count_result_entry &other);
 
 		struct dnet_addr_stat *statistics() const;
+		// latency histograms, NULL if the node did not send them
+		struct dnet_latency_stat *latency() const;
 };
 
 class exec_context;
@@ -401,6 +401,10 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Per-connection statistics: command counters of the state and its send queue,
+ * the latter is placed into counters part, so reply has the same layout as global one
+ */
 static int dnet_cmd_stat_count_single(struct dnet_net_state *orig, struct dnet_cmd *cmd, struct dnet_net_state *st, struct dnet_addr_stat *as)
 {
 	int i;
@@ -408,22 +412,33 @@ static int dnet_cmd_stat_count_single(struct dnet_net_state *orig, struct dnet_c
 	cmd->cmd = DNET_CMD_STAT_COUNT;
 
 	memcpy(&as->addr, &st->addr, sizeof(struct dnet_addr));
-	as->num = __DNET_CMD_MAX;
+	as->num = __DNET_CNTR_MAX;
 	as->cmd_num = __DNET_CMD_MAX;
 
-	for (i=0; i<as->num; ++i) {
+	memset(as->count, 0, __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
+
+	for (i=0; i<__DNET_CMD_MAX; ++i) {
 		as->count[i] = st->stat[i];
 	}
 
+	pthread_mutex_lock(&st->send_lock);
+	as->count[DNET_CNTR_SEND_QUEUE_SIZE].count = st->send_queue_bytes;
+	as->count[DNET_CNTR_SEND_QUEUE_PEAK].count = st->send_queue_peak;
+	pthread_mutex_unlock(&st->send_lock);
+	as->count[DNET_CNTR_SEND_QUEUE_LIMIT].err = st->n->send_limit;
+
 	dnet_convert_addr_stat(as, as->num);
 
-	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CMD_MAX * sizeof(struct dnet_stat_count), 1);
+	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count), 1);
 }
 
 static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_cmd *cmd,
 		struct dnet_node *n, struct dnet_addr_stat *as)
 {
 	struct dnet_stat st;
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	uint64_t hit, miss, used, cached;
+	size_t size;
 	int err = 0;
 
 	cmd->cmd = DNET_CMD_STAT_COUNT;
@@ -432,7 +447,25 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	as->num = __DNET_CNTR_MAX;
 	as->cmd_num = __DNET_CMD_MAX;
 
-	memcpy(as->count, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
+	/* reply array is packed, read into aligned storage first */
+	dnet_counter_read(n, counters);
+	memcpy(as->count, counters, sizeof(counters));
+
+	dnet_recv_cache_stat(n, &hit, &miss);
+	as->count[DNET_CNTR_RECV_CACHE_HIT].count = hit;
+	as->count[DNET_CNTR_RECV_CACHE_MISS].count = miss;
+
+	dnet_lock_lock(&n->send_queue_lock);
+	as->count[DNET_CNTR_SEND_QUEUE_SIZE].count = n->send_queue_bytes;
+	as->count[DNET_CNTR_SEND_QUEUE_PEAK].count = n->send_queue_peak;
+	dnet_lock_unlock(&n->send_queue_lock);
+	as->count[DNET_CNTR_SEND_QUEUE_LIMIT].count = n->node_send_limit;
+	as->count[DNET_CNTR_SEND_QUEUE_LIMIT].err = n->send_limit;
+
+	dnet_trans_pool_stat(n, &used, &cached, &miss);
+	as->count[DNET_CNTR_TRANS_POOL_USED].count = used;
+	as->count[DNET_CNTR_TRANS_POOL_CACHED].count = cached;
+	as->count[DNET_CNTR_TRANS_POOL_MISS].count = miss;
 
 	if (n->cb->storage_stat) {
 		err = n->cb->storage_stat(n->cb->command_private, &st);
@@ -459,9 +492,20 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 		as->count[DNET_CNTR_VM_BUFFERS].count = st.vm_buffers;
 	}
 
+	size = sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count);
+
+	if (cmd->flags & DNET_ATTR_CNTR_LATENCY) {
+		struct dnet_latency_stat *ls = (struct dnet_latency_stat *)&as->count[__DNET_CNTR_MAX];
+
+		dnet_counter_read_latency(n, ls);
+		dnet_convert_latency_stat(ls, DNET_LATENCY_HIST_NUM * DNET_LATENCY_BUCKETS);
+
+		size += sizeof(struct dnet_latency_stat) + sizeof(n->latency);
+	}
+
 	dnet_convert_addr_stat(as, as->num);
 
-	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count), 1);
+	return dnet_send_reply(orig, cmd, as, size, 1);
 }
 
 static int dnet_cmd_stat_count(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data __unused)
@@ -471,7 +515,8 @@ static int dnet_cmd_stat_count(struct dnet_net_state *orig, struct dnet_cmd *cmd
 	struct dnet_addr_stat *as;
 	int err = 0;
 
-	as = alloca(sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
+	as = alloca(sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count) +
+			sizeof(struct dnet_latency_stat) + sizeof(n->latency));
 	if (!as) {
 		err = -ENOMEM;
 		goto err_out_exit;
@@ -887,13 +932,138 @@ err_out_exit:
 	return err;
 }
 
+static void dnet_iterator_job_free(struct dnet_iterator_job *job)
+{
+	dnet_state_put(job->st);
+	free(job);
+}
+
+/*
+ * Returns next queued iterator for the thread which has finished its own,
+ * or drops the thread if there is nothing to run
+ */
+static struct dnet_iterator_job *dnet_iterator_job_next(struct dnet_node *n)
+{
+	struct dnet_iterator_job *job = NULL;
+
+	pthread_mutex_lock(&n->iterator_lock);
+	if (!n->need_exit && !list_empty(&n->iterator_jobs)) {
+		job = list_first_entry(&n->iterator_jobs, struct dnet_iterator_job, job_entry);
+		list_del(&job->job_entry);
+	} else if (--n->iterator_threads == 0) {
+		pthread_cond_broadcast(&n->iterator_wait);
+	}
+	pthread_mutex_unlock(&n->iterator_lock);
+
+	return job;
+}
+
+static void *dnet_iterator_process(void *data)
+{
+	struct dnet_iterator_job *job = data;
+	struct dnet_node *n = job->st->n;
+	int err;
+
+	dnet_set_name("iterator");
+
+	do {
+		err = dnet_iterator_start(job->st, &job->cmd, job->req, job->range);
+		dnet_send_ack(job->st, &job->cmd, err, 0);
+
+		dnet_iterator_job_free(job);
+	} while ((job = dnet_iterator_job_next(n)));
+
+	return NULL;
+}
+
+/*!
+ * Backend iterator is a synchronous loop which is throttled by the send
+ * queue watermarks, run it in its own detached thread, so that slow client
+ * only stalls its own iterator and not io pool threads.
+ * Final ack is sent by the iterator thread.
+ *
+ * Number of iterator threads is limited by number of IO threads,
+ * when all of them are busy new iterator is queued and started
+ * by the first thread which finishes its current iterator.
+ */
+static int dnet_iterator_start_thread(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_iterator_job *job, *queued_job, *tmp;
+	struct list_head failed;
+	pthread_t tid;
+	int err, queued = 0;
+
+	job = malloc(sizeof(struct dnet_iterator_job) + cmd->size);
+	if (!job) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memcpy(&job->cmd, cmd, sizeof(struct dnet_cmd));
+	memcpy(job->data, data, cmd->size);
+	job->req = (struct dnet_iterator_request *)job->data;
+	job->range = (struct dnet_iterator_range *)(job->data + sizeof(struct dnet_iterator_request));
+	job->st = dnet_state_get(st);
+
+	pthread_mutex_lock(&n->iterator_lock);
+	if (n->iterator_threads >= n->iterator_threads_max) {
+		list_add_tail(&job->job_entry, &n->iterator_jobs);
+		queued = 1;
+	} else {
+		n->iterator_threads++;
+	}
+	pthread_mutex_unlock(&n->iterator_lock);
+
+	if (queued) {
+		dnet_log(n, DNET_LOG_NOTICE, "%s: all %d iterator threads are busy, iterator is queued\n",
+				dnet_dump_id(&cmd->id), n->iterator_threads_max);
+		goto out_no_ack;
+	}
+
+	err = pthread_create(&tid, &n->attr, dnet_iterator_process, job);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "%s: failed to start iterator thread: %s [%d]\n",
+				dnet_dump_id(&cmd->id), strerror(-err), err);
+		goto err_out_put;
+	}
+
+out_no_ack:
+	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+	return 0;
+
+err_out_put:
+	/*
+	 * Queued iterators are picked up by running threads,
+	 * if there are none left, queued iterators fail with the same error
+	 */
+	INIT_LIST_HEAD(&failed);
+
+	pthread_mutex_lock(&n->iterator_lock);
+	if (--n->iterator_threads == 0) {
+		list_splice_init(&n->iterator_jobs, &failed);
+		pthread_cond_broadcast(&n->iterator_wait);
+	}
+	pthread_mutex_unlock(&n->iterator_lock);
+
+	list_for_each_entry_safe(queued_job, tmp, &failed, job_entry) {
+		list_del(&queued_job->job_entry);
+		dnet_send_ack(queued_job->st, &queued_job->cmd, err, 0);
+		dnet_iterator_job_free(queued_job);
+	}
+
+	dnet_iterator_job_free(job);
+err_out_exit:
+	return err;
+}
+
 /*!
  * Starts low-level backend iterator and passes data to network or file
  */
 static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_iterator_request *ireq = data;
-	struct dnet_iterator_range *irange = data + sizeof(struct dnet_iterator_request);
 	int err = 0;
 
 	/*
@@ -915,7 +1085,7 @@ static int dnet_cmd_iterator(struct dnet_net_state *st, struct dnet_cmd *cmd, vo
 	 */
 	switch (ireq->action) {
 	case DNET_ITERATOR_ACTION_START:
-		err = dnet_iterator_start(st, cmd, ireq, irange);
+		err = dnet_iterator_start_thread(st, cmd, data);
 		break;
 	case DNET_ITERATOR_ACTION_PAUSE:
 	case DNET_ITERATOR_ACTION_CONT:
@@ -934,6 +1104,31 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Reading commands share the key lock, all others, including CAS writes, are exclusive
+ */
+static int dnet_cmd_lock_shared(struct dnet_cmd *cmd)
+{
+	switch (cmd->cmd) {
+	case DNET_CMD_LOOKUP:
+	case DNET_CMD_READ:
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_BULK_READ:
+	case DNET_CMD_INDEXES_FIND:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void dnet_cmd_oplock(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	if (dnet_cmd_lock_shared(cmd))
+		dnet_oplock_shared(n, &cmd->id);
+	else
+		dnet_oplock(n, &cmd->id);
+}
+
 static int dnet_cmd_bulk_read(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
 {
 	int err = -1, ret;
@@ -980,7 +1175,7 @@ static int dnet_cmd_bulk_read(struct dnet_net_state *st, struct dnet_cmd *cmd, v
 	}
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(st->n, &cmd->id);
+		dnet_cmd_oplock(st->n, cmd);
 	}
 
 	return err;
@@ -1032,6 +1227,111 @@ int dnet_cas_local(struct dnet_node *n, struct dnet_id *id, void *remote_csum, i
 	return err;
 }
 
+/*
+ * Commands whose replies carry data are rejected while queued replies of the
+ * whole node exceed its limit, small replies (including this error) still pass
+ */
+static int dnet_cmd_send_limited(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	if (!n->node_send_limit || n->send_queue_bytes <= n->node_send_limit)
+		return 0;
+
+	switch (cmd->cmd) {
+	case DNET_CMD_READ:
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_BULK_READ:
+	case DNET_CMD_INDEXES_FIND:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Slow requests go to the dedicated log when it is configured,
+ * otherwise they are written into the node log.
+ * Send stage is not known yet, so only current send queue size is shown.
+ */
+static void dnet_slow_request_log(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, long *stage, long total)
+{
+	struct dnet_node *n = st->n;
+	char buf[512];
+	struct timeval tv;
+	struct tm tm;
+	int len, err_write;
+
+	gettimeofday(&tv, NULL);
+	localtime_r((time_t *)&tv.tv_sec, &tm);
+	len = strftime(buf, sizeof(buf), "%F %R:%S", &tm);
+
+	len += snprintf(buf + len, sizeof(buf) - len, ".%06lu %s: %s: %s: trace: %x, trans: %llu, err: %d, "
+			"time: %ld usecs, queue: %ld, lock: %ld, process: %ld, backend: %ld, ack: %ld, "
+			"send queue: %llu bytes\n",
+			(unsigned long)tv.tv_usec, dnet_state_dump_addr(st), dnet_dump_id(&cmd->id),
+			dnet_cmd_string(cmd->cmd), cmd->id.trace_id,
+			(unsigned long long)(cmd->trans & ~DNET_TRANS_REPLY), err, total,
+			stage[DNET_STAGE_QUEUE], stage[DNET_STAGE_LOCK], stage[DNET_STAGE_PROCESS],
+			stage[DNET_STAGE_BACKEND], stage[DNET_STAGE_ACK],
+			(unsigned long long)st->send_queue_bytes);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	if (n->slow_log_fd >= 0) {
+		err_write = write(n->slow_log_fd, buf, len);
+		if (err_write == len)
+			return;
+	}
+
+	dnet_log(n, DNET_LOG_NOTICE, "slow request: %s", buf);
+}
+
+/*
+ * Requests are sampled by trace id if it is set, so the same request is traced
+ * on every node, others are sampled by per-thread counter
+ */
+static int dnet_trace_sample(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	static __thread unsigned int counter;
+	uint32_t id = cmd->id.trace_id;
+
+	if (!n->trace_sample_rate || n->trace_fd < 0)
+		return 0;
+
+	if (id & DNET_TRACE_BIT)
+		return 1;
+
+	if (id)
+		return (id * 2654435761U) % n->trace_sample_rate == 0;
+
+	return ++counter % n->trace_sample_rate == 0;
+}
+
+static void dnet_trace_request(struct dnet_node *n, struct dnet_cmd *cmd, int err,
+		struct timeval *stage_start, long *stage)
+{
+	struct dnet_trace_span span;
+	int i;
+
+	memset(&span, 0, sizeof(struct dnet_trace_span));
+	span.trace_id = cmd->id.trace_id & ~DNET_TRACE_BIT;
+	span.cmd = cmd->cmd;
+	span.size = cmd->size;
+	span.err = err;
+	memcpy(span.id, cmd->id.id, sizeof(span.id));
+
+	for (i = 0; i < DNET_STAGE_SEND; ++i) {
+		/* queue stage is unknown for internal requests, backend is not always called */
+		if (!stage_start[i].tv_sec)
+			continue;
+
+		span.stage = i;
+		span.start = stage_start[i].tv_sec * 1000000ULL + stage_start[i].tv_usec;
+		span.duration = stage[i];
+
+		dnet_trace_span(n, &span);
+	}
+}
+
 int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive)
 {
 	int err = 0;
@@ -1042,17 +1342,44 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 #if 0
 	struct dnet_indexes_request *indexes_request;
 #endif
-	struct timeval start, end;
+	struct timeval start, end, backend_start, lock_start;
 	char time_str[64];
 	struct tm io_tm;
 	struct timeval io_tv;
-	long diff;
+	long diff, total;
+	long stage[__DNET_STAGE_MAX];
+	struct timeval stage_start[__DNET_STAGE_MAX];
+	int i, status;
+
+	memset(stage, 0, sizeof(stage));
+	memset(stage_start, 0, sizeof(stage_start));
+
+	if (!recursive)
+		dnet_trace_sampled = dnet_trace_sample(n, cmd);
+
+	gettimeofday(&lock_start, NULL);
+	if (!recursive && dnet_io_recv_time.tv_sec) {
+		stage[DNET_STAGE_QUEUE] = dnet_time_diff_usecs(&dnet_io_recv_time, &lock_start);
+		stage_start[DNET_STAGE_QUEUE] = dnet_io_recv_time;
+	}
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(n, &cmd->id);
+		dnet_cmd_oplock(n, cmd);
 	}
 
 	gettimeofday(&start, NULL);
+	stage[DNET_STAGE_LOCK] = dnet_time_diff_usecs(&lock_start, &start);
+	stage_start[DNET_STAGE_LOCK] = lock_start;
+	stage_start[DNET_STAGE_PROCESS] = start;
+
+	if (dnet_cmd_send_limited(n, cmd)) {
+		err = -ENOBUFS;
+		dnet_log(n, DNET_LOG_ERROR, "%s: %s: send queue of the node is full: %llu bytes, limit: %llu\n",
+				dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)n->send_queue_bytes, (unsigned long long)n->node_send_limit);
+		dnet_counter_inc(n, DNET_CNTR_SEND_QUEUE_REJECTED, 0);
+		goto err_out_stat;
+	}
 
 	switch (cmd->cmd) {
 		case DNET_CMD_AUTH:
@@ -1178,7 +1505,15 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			if ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ)) {
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
 			}
+			gettimeofday(&backend_start, NULL);
 			err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+			gettimeofday(&end, NULL);
+
+			diff = (end.tv_sec - backend_start.tv_sec) * 1000000 + (end.tv_usec - backend_start.tv_usec);
+			dnet_counter_latency(n, cmd->cmd, 1, diff);
+			stage[DNET_STAGE_BACKEND] += diff;
+			if (!stage_start[DNET_STAGE_BACKEND].tv_sec)
+				stage_start[DNET_STAGE_BACKEND] = backend_start;
 
 			/* If there was error in WRITE command - send empty reply
 			   to notify client with error code and destroy transaction */
@@ -1192,6 +1527,7 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			break;
 	}
 
+err_out_stat:
 	dnet_stat_inc(st->stat, cmd->cmd, err);
 	if (st->__join_state == DNET_JOIN)
 		dnet_counter_inc(n, cmd->cmd, err);
@@ -1201,15 +1537,41 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 	gettimeofday(&end, NULL);
 
 	diff = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	dnet_counter_latency(n, cmd->cmd, 0, diff);
+
 	dnet_log(n, DNET_LOG_INFO, "%s: %s: trans: %llu, cflags: 0x%llx, time: %ld usecs, err: %d.\n",
 			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), tid,
 			(unsigned long long)cmd->flags, diff, err);
 
+	stage[DNET_STAGE_PROCESS] = diff - stage[DNET_STAGE_BACKEND];
+	total = diff;
+	status = err;
+
 	err = dnet_send_ack(st, cmd, err, recursive);
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
 		dnet_opunlock(n, &cmd->id);
 
+	if (!recursive) {
+		gettimeofday(&start, NULL);
+		stage[DNET_STAGE_ACK] = dnet_time_diff_usecs(&end, &start);
+		stage_start[DNET_STAGE_ACK] = end;
+
+		for (i = 0; i < DNET_STAGE_SEND; ++i) {
+			dnet_counter_stage(n, i, stage[i]);
+			if (i != DNET_STAGE_PROCESS && i != DNET_STAGE_BACKEND)
+				total += stage[i];
+		}
+
+		if (n->slow_request_threshold && total >= n->slow_request_threshold)
+			dnet_slow_request_log(st, cmd, status, stage, total);
+
+		if (dnet_trace_sampled) {
+			dnet_trace_request(n, cmd, status, stage_start, stage);
+			dnet_trace_sampled = 0;
+		}
+	}
+
 	return err;
 }
 
@@ -1354,10 +1716,9 @@ err_out_exit:
 }
 */
 
-int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
-		int fd, uint64_t offset, int on_exit)
+static int __dnet_send_read_data(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit, void (* data_free)(void *priv), void *data_priv)
 {
-	struct dnet_net_state *st = state;
 	struct dnet_node *n = st->n;
 	struct dnet_cmd *c;
 	struct dnet_io_attr *rio;
@@ -1370,13 +1731,15 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	 * back to parental client, instead server will wrap data into
 	 * proper transaction reply next to this obscure packet.
 	 */
-	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING)
-		return 0;
+	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING) {
+		err = 0;
+		goto err_out_release;
+	}
 
 	c = malloc(hsize);
 	if (!c) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	memset(c, 0, hsize);
@@ -1413,17 +1776,40 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 			goto err_out_free;
 	}
 
-	if (data)
+	if (data && data_free) {
+		/* ownership of the data is transferred to the network code */
+		err = dnet_send_data_owned(st, c, hsize, data, rio->size, data_free, data_priv);
+		data_free = NULL;
+	} else if (data) {
 		err = dnet_send_data(st, c, hsize, data, rio->size);
-	else
+	} else {
 		err = dnet_send_fd(st, c, hsize, fd, offset, rio->size, on_exit);
+	}
 
 err_out_free:
 	free(c);
-err_out_exit:
+err_out_release:
+	if (data_free)
+		data_free(data_priv);
 	return err;
 }
 
+int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit)
+{
+	return __dnet_send_read_data(state, cmd, io, data, fd, offset, on_exit, NULL, NULL);
+}
+
+/*
+ * Send read reply with @data which is not copied, @data_free(@data_priv)
+ * is called when it is sent (or in case of error).
+ */
+int dnet_send_read_data_owned(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void (* data_free)(void *priv), void *data_priv)
+{
+	return __dnet_send_read_data(state, cmd, io, data, -1, 0, 0, data_free, data_priv);
+}
+
 static void dnet_fill_state_addr(void *state, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st = state;
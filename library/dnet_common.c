@@ -170,6 +170,24 @@ static char *dnet_counter_strings[] = {
 	[DNET_CNTR_DBR_ERROR] = "DNET_CNTR_DBR_ERROR",
 	[DNET_CNTR_DBW_SYSTEM] = "DNET_CNTR_DBW_SYSTEM",
 	[DNET_CNTR_DBW_ERROR] = "DNET_CNTR_DBW_ERROR",
+	[DNET_CNTR_RECV_CACHE_HIT] = "DNET_CNTR_RECV_CACHE_HIT",
+	[DNET_CNTR_RECV_CACHE_MISS] = "DNET_CNTR_RECV_CACHE_MISS",
+	[DNET_CNTR_SEND_QUEUE_SIZE] = "DNET_CNTR_SEND_QUEUE_SIZE",
+	[DNET_CNTR_SEND_QUEUE_PEAK] = "DNET_CNTR_SEND_QUEUE_PEAK",
+	[DNET_CNTR_SEND_QUEUE_LIMIT] = "DNET_CNTR_SEND_QUEUE_LIMIT",
+	[DNET_CNTR_SEND_QUEUE_PAUSED] = "DNET_CNTR_SEND_QUEUE_PAUSED",
+	[DNET_CNTR_SEND_QUEUE_REJECTED] = "DNET_CNTR_SEND_QUEUE_REJECTED",
+	[DNET_CNTR_TRANS_POOL_USED] = "DNET_CNTR_TRANS_POOL_USED",
+	[DNET_CNTR_TRANS_POOL_CACHED] = "DNET_CNTR_TRANS_POOL_CACHED",
+	[DNET_CNTR_TRANS_POOL_MISS] = "DNET_CNTR_TRANS_POOL_MISS",
+	[DNET_CNTR_OPLOCK_SHARED_WAIT] = "DNET_CNTR_OPLOCK_SHARED_WAIT",
+	[DNET_CNTR_OPLOCK_EXCL_WAIT] = "DNET_CNTR_OPLOCK_EXCL_WAIT",
+	[DNET_CNTR_LOG_DROPPED] = "DNET_CNTR_LOG_DROPPED",
+	[DNET_CNTR_CACHE_HIT] = "DNET_CNTR_CACHE_HIT",
+	[DNET_CNTR_CACHE_MISS] = "DNET_CNTR_CACHE_MISS",
+	[DNET_CNTR_CACHE_ADMIT_REJECT] = "DNET_CNTR_CACHE_ADMIT_REJECT",
+	[DNET_CNTR_CACHE_EVICT] = "DNET_CNTR_CACHE_EVICT",
+	[DNET_CNTR_CACHE_COALESCED] = "DNET_CNTR_CACHE_COALESCED",
 	[DNET_CNTR_UNKNOWN] = "UNKNOWN",
 };
 
@@ -181,6 +199,23 @@ char *dnet_cmd_string(int cmd)
 	return dnet_cmd_strings[cmd];
 }
 
+static char *dnet_stage_strings[] = {
+	[DNET_STAGE_QUEUE] = "QUEUE",
+	[DNET_STAGE_LOCK] = "LOCK",
+	[DNET_STAGE_PROCESS] = "PROCESS",
+	[DNET_STAGE_BACKEND] = "BACKEND",
+	[DNET_STAGE_ACK] = "ACK",
+	[DNET_STAGE_SEND] = "SEND",
+};
+
+char *dnet_stage_string(int stage)
+{
+	if (stage < 0 || stage >= __DNET_STAGE_MAX)
+		return "UNKNOWN";
+
+	return dnet_stage_strings[stage];
+}
+
 char *dnet_counter_string(int cntr, int cmd_num)
 {
 	if (cntr <= 0 || cntr >= __DNET_CNTR_MAX || cntr >= DNET_CNTR_UNKNOWN)
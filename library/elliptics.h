@@ -24,6 +24,7 @@
 #include <limits.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
 
@@ -32,6 +33,10 @@
 
 #include <eblob/blob.h>
 
+#ifdef HAVE_URING_SUPPORT
+#include <liburing.h>
+#endif
+
 #ifndef HAVE_UCHAR
 typedef unsigned char u_char;
 typedef unsigned short u_short;
@@ -69,6 +74,9 @@ extern __thread uint32_t trace_id;
 		} while (0)
 #define dnet_log_err(n, f, a...) dnet_log(n, DNET_LOG_ERROR, f ": %s [%d].\n", ##a, strerror(errno), errno)
 
+/* maximum number of arguments of binary log record, see dnet_backend_log_fast() */
+#define DNET_LOG_BINARY_ARGS	6
+
 struct dnet_io_req {
 	struct list_head	req_entry;
 
@@ -84,8 +92,27 @@ struct dnet_io_req {
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/*
+	 * If set, @data is not copied when request is queued, instead
+	 * @data_free(@data_priv) is called when request is destroyed
+	 */
+	void			(* data_free)(void *priv);
+	void			*data_priv;
+
+	/* when received request was read completely, or when reply was queued for sending */
+	struct timeval		time;
+
+	/* reply belongs to request sampled for tracing */
+	int			sampled;
 };
 
+/* receive time of the request currently processed by io thread, zero if there is none */
+extern __thread struct timeval dnet_io_recv_time;
+
+/* set while io thread processes request sampled for tracing */
+extern __thread int dnet_trace_sampled;
+
 /*
  * Currently executed network state machine:
  * receives and sends command and data.
@@ -99,6 +126,12 @@ struct dnet_io_req {
 
 #define DNET_STATE_MAX_WEIGHT		(1024 * 10)
 
+/*
+ * Size of the per-state receive buffer: small commands are read in batches
+ * and parsed from it, larger bodies are received directly into the request
+ */
+#define DNET_RECV_BUF_SIZE		(16 * 1024)
+
 /* Iterator watermarks for sending data and sleeping */
 #define DNET_SEND_WATERMARK_HIGH	(1024 * 100)
 #define DNET_SEND_WATERMARK_LOW		(512 * 100)
@@ -106,6 +139,21 @@ struct dnet_io_req {
 /* Internal flag to ignore cache */
 #define DNET_IO_FLAGS_NOCACHE		(1<<28)
 
+/* Internal dnet_io_req::on_exit flag: request was allocated by dnet_io_req_recv_alloc() */
+#define DNET_IO_REQ_FLAGS_RECV_BUF	(1<<30)
+
+/*
+ * Transactions sent over given state, hashed by transaction id.
+ * Hash is allocated with the first transaction and doubles
+ * when number of transactions exceeds number of buckets.
+ */
+struct dnet_trans_table
+{
+	struct hlist_head	*hash;
+	unsigned int		bits;
+	unsigned int		num;
+};
+
 struct dnet_net_state
 {
 	struct list_head	state_entry;
@@ -118,7 +166,12 @@ struct dnet_net_state
 
 	int			need_exit;
 
+	/*
+	 * Number of seconds with timed out transactions since the last reply,
+	 * @stall_time is the last such second
+	 */
 	int			stall;
+	long			stall_time;
 
 	int			__join_state;
 
@@ -140,10 +193,34 @@ struct dnet_net_state
 	unsigned int		rcv_flags;
 	void			*rcv_data;
 
+	/* received, but not yet parsed data is [rcv_buf_start, rcv_buf_end) */
+	void			*rcv_buf;
+	unsigned int		rcv_buf_start;
+	unsigned int		rcv_buf_end;
+
 	int			epoll_fd;
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
 	struct list_head	send_list;
+	/*
+	 * Socket is registered in epoll once in edge-triggered mode,
+	 * so send readiness is tracked here (all protected by send_lock).
+	 * @send_writable is cleared when send() returns EAGAIN and set on
+	 * EPOLLOUT edge, @send_ready_seq is incremented on every edge,
+	 * @send_busy is set while some thread drains @send_list
+	 */
+	int			send_writable;
+	int			send_busy;
+	unsigned int		send_ready_seq;
+	/*
+	 * Bytes of memory pinned by queued requests and its maximum,
+	 * reading is paused while it is above dnet_node.send_limit
+	 * (protected by send_lock)
+	 */
+	uint64_t		send_queue_bytes;
+	uint64_t		send_queue_peak;
+	int			recv_paused;
+	int			recv_resume;
 	/*
 	 * Condition variable to wait when send_queue_size reaches high
 	 * watermark
@@ -152,9 +229,23 @@ struct dnet_net_state
 	/* Number of queued requests in send queue from iterator */
 	atomic_t		send_queue_size;
 
+#ifdef HAVE_URING_SUPPORT
+	/*
+	 * DNET_NET_ENGINE_URING: @uring_send is owned by whoever set @send_busy,
+	 * everything else is touched by the network thread which reaps completions only.
+	 * Receive is in flight into @rcv_buf or directly into @rcv_data (@uring_recv_direct),
+	 * hangup poll is armed instead while reading is paused, @uring_closed is set
+	 * when network thread has dropped its reference
+	 */
+	struct dnet_uring_send	*uring_send;
+	int			uring_recv_armed;
+	int			uring_recv_direct;
+	int			uring_hup_armed;
+	int			uring_closed;
+#endif
+
 	pthread_mutex_t		trans_lock;
-	struct rb_root		trans_root;
-	struct list_head	trans_list;
+	struct dnet_trans_table	trans_table;
 
 
 	int			la;
@@ -196,6 +287,7 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		struct dnet_addr *addr, int s, int *errp, int join, int idx,
 		int (* process)(struct dnet_net_state *st, struct epoll_event *ev));
 
+/* takes n->state_lock, must not be called with it held */
 void dnet_state_reset(struct dnet_net_state *st, int error);
 void dnet_state_clean(struct dnet_net_state *st);
 void dnet_state_remove_nolock(struct dnet_net_state *st);
@@ -219,7 +311,6 @@ void dnet_schedule_command(struct dnet_net_state *st);
 int dnet_schedule_send(struct dnet_net_state *st);
 int dnet_schedule_recv(struct dnet_net_state *st);
 
-void dnet_unschedule_send(struct dnet_net_state *st);
 void dnet_unschedule_recv(struct dnet_net_state *st);
 
 int dnet_setup_control_nolock(struct dnet_net_state *st);
@@ -324,6 +415,55 @@ static inline void dnet_group_put(struct dnet_group *g)
 		dnet_group_destroy(g);
 }
 
+/*
+ * Route table snapshot. It is rebuilt from group list under n->state_lock
+ * on every route change, published by pointer swap and never modified,
+ * so lookups do not take any lock. Old snapshot is freed after all readers,
+ * which could see it, have left their read sections.
+ */
+struct dnet_route_id {
+	struct dnet_raw_id	raw;
+	struct dnet_net_state	*st;
+};
+
+/*
+ * Lookup goes through the first id byte jump table and then binary searches
+ * compact big-endian 64-bit id prefixes, full ids are compared only on prefix ties.
+ */
+struct dnet_route_group {
+	unsigned int		group_id;
+	int			id_num;
+	struct dnet_route_id	*ids;
+	uint64_t		*prefix;
+	int			jump[257];
+};
+
+struct dnet_route_table {
+	uint64_t		version;
+	unsigned int		hash_mask;
+	int			group_num;
+	struct dnet_route_group	**hash;
+	struct dnet_route_group	groups[];
+};
+
+/* read side counters are spread over cache lines, thread picks one at first use */
+#define DNET_ROUTE_READERS	32
+
+struct dnet_route_reader {
+	atomic_t		count[2];
+	char			pad[64];
+};
+
+struct dnet_route {
+	struct dnet_route_table	*table;
+	uint64_t		version;
+	int			epoch;
+	struct dnet_route_reader	readers[DNET_ROUTE_READERS];
+};
+
+void dnet_route_init(struct dnet_node *n);
+void dnet_route_cleanup(struct dnet_node *n);
+
 struct dnet_transform
 {
 	void			*priv;
@@ -335,10 +475,57 @@ struct dnet_transform
 int dnet_crypto_init(struct dnet_node *n);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
+/*
+ * Size-classed cache of receive buffers (dnet_io_req + command + data).
+ * Each network thread owns one: it allocates from @local lists without
+ * locking, buffers freed by other (IO) threads are returned into
+ * @returned lists and are spliced back when local list is empty.
+ * Payloads which do not fit into the largest class are allocated directly.
+ */
+#define DNET_RECV_CACHE_CLASSES		4
+#define DNET_RECV_CACHE_MAX_FREE	256
+
+struct dnet_recv_cache;
+struct dnet_recv_buf {
+	struct dnet_recv_buf	*next;
+	struct dnet_recv_cache	*cache;
+	int			cls;
+	int			pad;
+};
+
+struct dnet_recv_cache_class {
+	struct dnet_recv_buf	*local;
+	int			local_num;
+
+	struct dnet_lock	lock;
+	struct dnet_recv_buf	*returned;
+	int			returned_num;
+};
+
+struct dnet_recv_cache {
+	struct dnet_recv_cache_class	cls[DNET_RECV_CACHE_CLASSES];
+
+	/* updated by the owner thread only */
+	uint64_t		hit, miss;
+};
+
 struct dnet_net_io {
+	/* epoll descriptor or io_uring descriptor for DNET_NET_ENGINE_URING */
 	int			epoll_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+	struct dnet_recv_cache	recv_cache;
+
+#ifdef HAVE_URING_SUPPORT
+	/*
+	 * Submission queue is shared between network thread and threads which
+	 * start sending, completions are reaped by network thread only.
+	 * Every operation in flight holds a state reference.
+	 */
+	pthread_mutex_t		uring_lock;
+	struct io_uring		uring;
+	atomic_t		uring_inflight;
+#endif
 };
 
 enum dnet_work_io_mode {
@@ -347,13 +534,6 @@ enum dnet_work_io_mode {
 	DNET_WORK_IO_MODE_EXEC_BLOCKING,
 };
 
-struct dnet_work_pool;
-struct dnet_work_io {
-	struct list_head	wio_entry;
-	int			thread_index;
-	pthread_t		tid;
-	struct dnet_work_pool	*pool;
-};
 
 struct list_stat {
 	uint64_t		list_size;
@@ -394,21 +574,73 @@ static inline void list_stat_reset(struct list_stat *st, struct timeval *time) {
 	st->time_base.tv_usec = time->tv_usec;
 }
 
+struct dnet_work_pool;
+struct dnet_work_io {
+	struct list_head	wio_entry;
+	int			thread_index;
+	pthread_t		tid;
+	struct dnet_work_pool	*pool;
+
+	/*
+	 * Per-thread queue of commands which are not transaction replies.
+	 * Idle threads of the same pool steal from the head of it.
+	 */
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	struct list_head	list;
+	struct list_stat	list_stats;
+
+	/* thread sleeps on @wait, set and cleared under @lock */
+	int			idle;
+	int			wakeup;
+
+	/* transaction whose reply is being processed, protected by pool lock */
+	struct dnet_work_trans	*trans;
+};
+
+/*
+ * Queued replies of the single transaction. They are processed in order
+ * and never concurrently: @owner is set while one of them is processed.
+ * Structure lives only while there are queued or processed replies.
+ */
+struct dnet_work_trans {
+	struct hlist_node	hash_entry;
+	struct list_head	ready_entry;
+	struct list_head	list;
+	uint64_t		tid;
+	struct dnet_work_io	*owner;
+};
+
+#define DNET_WORK_TRANS_HASH_SIZE	1024
+
 struct dnet_work_pool {
 	struct dnet_node	*n;
 	int			mode;
 	int			num;
-	struct list_head	list;
+
+	/* round-robin position for the next non-reply command */
+	atomic_t		pos;
+
+	/*
+	 * Transaction replies: they must be processed in order, so they are
+	 * grouped by transaction id in @trans_hash. Groups which have queued
+	 * replies and are not processed right now live in @ready_list.
+	 * Everything is protected by @lock.
+	 */
+	struct list_head	ready_list;
 	struct list_stat	list_stats;
 	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
+	struct hlist_head	trans_hash[DNET_WORK_TRANS_HASH_SIZE];
+
 	struct list_head	wio_list;
-	uint64_t		*trans;
+	struct dnet_work_io	**wio;
 };
 
 struct dnet_io {
 	int			need_exit;
 
+	int			net_engine;
+
 	int			net_thread_num, net_thread_pos;
 	struct dnet_net_io	*net;
 
@@ -422,26 +654,60 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
 void dnet_io_exit(struct dnet_node *n);
 
 void dnet_io_req_free(struct dnet_io_req *r);
+void dnet_io_req_recv_free(struct dnet_io_req *r);
+void dnet_recv_cache_stat(struct dnet_node *n, uint64_t *hit, uint64_t *miss);
+
+/*
+ * Oplocks live in a hash table split into independently locked stripes,
+ * every stripe grows its own buckets array with load. Entry's wait condition
+ * is used with its stripe lock, free entries are cached per stripe.
+ */
+#define DNET_LOCKS_STRIPES		64
+#define DNET_LOCKS_MIN_BITS		4
+#define DNET_LOCKS_FREE_MAX		64
 
+/* contended lock waits longer than this are logged with the key */
+#define DNET_OPLOCK_WAIT_LOG_USECS	100000
+
+/*
+ * Shared/exclusive lock: new readers queue behind waiting writers,
+ * and when writer unlocks, readers waiting at that moment (@read_phase)
+ * are let in before the next writer, so neither side starves.
+ * Writer's unlock bumps @read_gen, only readers which started waiting
+ * before that are admitted and consume @read_phase.
+ */
 struct dnet_locks_entry {
-	struct rb_node		lock_tree_entry;
-	struct list_head	lock_list_entry;
-	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
+	struct hlist_node	hash_entry;
+	pthread_cond_t		read_wait;
+	pthread_cond_t		write_wait;
 	struct dnet_raw_id	id;
-	int			locked;
-	atomic_t		refcnt;
+	int			writer;
+	int			readers;
+	int			readers_waiting;
+	int			writers_waiting;
+	int			read_phase;
+	unsigned int		read_gen;
+	int			refcnt;
 };
 
-struct dnet_locks {
-	struct list_head	lock_list;
-	struct rb_root		lock_tree;
+struct dnet_locks_stripe {
 	pthread_mutex_t		lock;
+	struct hlist_head	*hash;
+	unsigned int		bits;
+	unsigned int		num;
+	struct hlist_head	free_list;
+	unsigned int		free_num;
+	char			pad[64];
+};
+
+struct dnet_locks {
+	struct dnet_locks_stripe	stripe[DNET_LOCKS_STRIPES];
 };
 
 void dnet_locks_destroy(struct dnet_node *n);
 int dnet_locks_init(struct dnet_node *n, int num);
 void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
+void dnet_oplock_shared(struct dnet_node *n, struct dnet_id *key);
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
 
@@ -457,14 +723,26 @@ struct dnet_config_data
 	char *cfg_remotes;
 	int daemon_mode;
 
+	/* file where traced requests are written, see dnet_node_set_trace_file() */
+	char *trace_file;
+
 	struct dnet_config_entry *cfg_entries;
 	int cfg_size;
 	struct dnet_config_backend *cfg_current_backend;
 
 	struct dnet_config_backend *cfg_backend;
 	int cfg_backend_num;
+
+	/* set when server node is created, backend messages are logged through it */
+	struct dnet_node *node;
 };
 
+/* whole command processing histograms are followed by backend handler and stage ones */
+#define DNET_LATENCY_HIST_NUM		(__DNET_CMD_MAX * 2 + __DNET_STAGE_MAX)
+#define DNET_LATENCY_CMD(cmd)		(cmd)
+#define DNET_LATENCY_BACKEND(cmd)	(__DNET_CMD_MAX + (cmd))
+#define DNET_LATENCY_STAGE(stage)	(__DNET_CMD_MAX * 2 + (stage))
+
 struct dnet_node
 {
 	struct list_head	check_entry;
@@ -488,6 +766,7 @@ struct dnet_node
 
 	pthread_mutex_t		state_lock;
 	struct list_head	group_list;
+	struct dnet_route	route;
 
 	/* hosts client states, i.e. those who didn't join network */
 	struct list_head	empty_state_list;
@@ -503,6 +782,23 @@ struct dnet_node
 
 	struct dnet_log		*log;
 
+	/* 1 in @trace_sample_rate requests is traced into @trace_fd, 0 disables tracing */
+	int			trace_sample_rate;
+	int			trace_fd;
+
+	/*
+	 * Asynchronous logging: threads put messages into their own rings,
+	 * log thread drains them, @log_ring_size is 0 when it is not running
+	 */
+	int			log_ring_size;
+	int			log_need_exit;
+	int			log_wakeup;
+	pthread_t		log_tid;
+	pthread_key_t		log_key;
+	pthread_mutex_t		log_lock;
+	pthread_cond_t		log_wait;
+	struct list_head	log_rings;
+
 	struct dnet_wait	*wait;
 	struct timespec		wait_ts;
 
@@ -513,6 +809,8 @@ struct dnet_node
 	int			cache_sync_timeout;
 
 	pthread_t		check_tid;
+	struct dnet_timer	*timer;
+	struct dnet_trans_pool	*trans_pool;
 	pthread_t		reconnect_tid;
 	long			stall_count;
 
@@ -527,8 +825,15 @@ struct dnet_node
 	pthread_mutex_t		reconnect_lock;
 	struct list_head	reconnect_list;
 
-	struct dnet_lock	counters_lock;
+	/*
+	 * Counters are updated in per-thread slabs without locking, @counters
+	 * keeps values of exited threads and is summed with live slabs on read
+	 */
+	pthread_key_t		counters_key;
+	pthread_mutex_t		counters_lock;
+	struct list_head	counters_slabs;
 	struct dnet_stat_count	counters[__DNET_CNTR_MAX];
+	uint64_t		latency[DNET_LATENCY_HIST_NUM][DNET_LATENCY_BUCKETS];
 
 	int			bg_ionice_class;
 	int			bg_ionice_prio;
@@ -553,10 +858,37 @@ struct dnet_node
 	 * Lock used for list management
 	 */
 	pthread_mutex_t		iterator_lock;
+	/*
+	 * Number of running iterator threads, it is limited by @iterator_threads_max
+	 * (equal to number of IO threads), iterators started over the limit wait
+	 * in @iterator_jobs and are picked up by threads which finish theirs.
+	 * Node cleanup waits on @iterator_wait until all threads exit.
+	 * Protected by @iterator_lock
+	 */
+	int			iterator_threads;
+	int			iterator_threads_max;
+	struct list_head	iterator_jobs;
+	pthread_cond_t		iterator_wait;
 
 	size_t			cache_size;
+	int			cache_policy;
 	void			*cache;
 
+	/*
+	 * Send queue limits in bytes: per connection and for the whole node,
+	 * 0 means no limit. Node-wide queued bytes and its maximum are
+	 * protected by send_queue_lock
+	 */
+	uint64_t		send_limit;
+	uint64_t		node_send_limit;
+	struct dnet_lock	send_queue_lock;
+	uint64_t		send_queue_bytes;
+	uint64_t		send_queue_peak;
+
+	/* slow request threshold in usecs, log fd is -1 when node log is used instead */
+	long			slow_request_threshold;
+	int			slow_log_fd;
+
 	struct dnet_config_data *config_data;
 };
 
@@ -587,46 +919,141 @@ struct dnet_session {
 	int			nsize;
 };
 
-static inline int dnet_counter_init(struct dnet_node *n)
+struct dnet_counter_slab {
+	struct list_head	slab_entry;
+	struct dnet_node	*n;
+	struct dnet_stat_count	counters[__DNET_CNTR_MAX];
+	uint64_t		latency[DNET_LATENCY_HIST_NUM][DNET_LATENCY_BUCKETS];
+};
+
+/*
+ * Single producer, single consumer ring of log records,
+ * @head is moved only by owner thread, @tail only by log thread
+ */
+struct dnet_log_ring {
+	struct list_head	ring_entry;
+	struct dnet_node	*n;
+	char			*data;
+	uint64_t		size;
+	volatile uint64_t	head;
+	volatile uint64_t	tail;
+	volatile uint64_t	dropped;
+	uint64_t		dropped_reported;
+	volatile int		dead;
+};
+
+/*
+ * Span of sampled request processing, stored in thread log ring
+ * and written into trace file as text line by log thread
+ */
+struct dnet_trace_span {
+	uint64_t		start;			/* usecs since epoch */
+	uint64_t		size;
+	uint32_t		trace_id;
+	uint32_t		duration;		/* usecs */
+	int			err;
+	uint16_t		cmd;
+	uint16_t		stage;
+	uint8_t			id[8];			/* key id prefix */
+};
+
+void dnet_trace_span(struct dnet_node *n, struct dnet_trace_span *span);
+
+/* thread ring size used when tracing is enabled without asynchronous logging */
+#define DNET_LOG_RING_DEFAULT_SIZE	(1024 * 1024)
+
+int dnet_log_thread_start(struct dnet_node *n, int ring_size);
+void dnet_log_thread_stop(struct dnet_node *n);
+void dnet_log_vraw(struct dnet_node *n, int level, const char *format, va_list args);
+void dnet_log_binary(struct dnet_node *n, int level, const char *format, uint64_t *args, int num);
+
+int dnet_counter_init(struct dnet_node *n);
+void dnet_counter_destroy(struct dnet_node *n);
+struct dnet_counter_slab *dnet_counter_slab(struct dnet_node *n);
+void dnet_counter_read(struct dnet_node *n, struct dnet_stat_count *counters);
+void dnet_counter_read_latency(struct dnet_node *n, struct dnet_latency_stat *ls);
+
+/* slow path used when thread slab can not be allocated */
+void dnet_counter_add_locked(struct dnet_node *n, int counter, uint64_t count, uint64_t err);
+
+static inline void dnet_counter_add(struct dnet_node *n, int counter, uint64_t count, uint64_t err)
 {
-	memset(&n->counters, 0, __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
-	return dnet_lock_init(&n->counters_lock);
+	struct dnet_counter_slab *slab;
+
+	if (counter >= __DNET_CNTR_MAX)
+		counter = DNET_CNTR_UNKNOWN;
+
+	slab = dnet_counter_slab(n);
+	if (!slab) {
+		dnet_counter_add_locked(n, counter, count, err);
+		return;
+	}
+
+	slab->counters[counter].count += count;
+	slab->counters[counter].err += err;
 }
 
-static inline void dnet_counter_destroy(struct dnet_node *n)
+/* slow path used when thread slab can not be allocated */
+void dnet_counter_latency_locked(struct dnet_node *n, int hist, int bucket);
+
+static inline void __dnet_counter_latency(struct dnet_node *n, int hist, long usecs)
 {
-	return dnet_lock_destroy(&n->counters_lock);
+	struct dnet_counter_slab *slab;
+	int bucket = dnet_latency_bucket(usecs > 0 ? usecs : 0);
+
+	slab = dnet_counter_slab(n);
+	if (!slab) {
+		dnet_counter_latency_locked(n, hist, bucket);
+		return;
+	}
+
+	slab->latency[hist][bucket]++;
+}
+
+static inline void dnet_counter_latency(struct dnet_node *n, int cmd, int backend, long usecs)
+{
+	if (cmd < 0 || cmd >= __DNET_CMD_MAX)
+		cmd = DNET_CMD_UNKNOWN;
+
+	__dnet_counter_latency(n, backend ? DNET_LATENCY_BACKEND(cmd) : DNET_LATENCY_CMD(cmd), usecs);
+}
+
+static inline void dnet_counter_stage(struct dnet_node *n, int stage, long usecs)
+{
+	__dnet_counter_latency(n, DNET_LATENCY_STAGE(stage), usecs);
+}
+
+static inline long dnet_time_diff_usecs(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000 + end->tv_usec - start->tv_usec;
 }
 
 static inline void dnet_counter_inc(struct dnet_node *n, int counter, int err)
 {
+	struct dnet_counter_slab *slab;
+
 	if (counter >= __DNET_CNTR_MAX)
 		counter = DNET_CNTR_UNKNOWN;
 
-	dnet_lock_lock(&n->counters_lock);
 	if (!err)
-		n->counters[counter].count++;
+		dnet_counter_add(n, counter, 1, 0);
 	else
-		n->counters[counter].err++;
-	dnet_lock_unlock(&n->counters_lock);
+		dnet_counter_add(n, counter, 0, 1);
 
-	dnet_log(n, DNET_LOG_DEBUG, "Incrementing counter: %d, err: %d, value is: %llu %llu.\n",
+	slab = dnet_counter_slab(n);
+	dnet_log(n, DNET_LOG_DEBUG, "Incrementing counter: %d, err: %d, thread value is: %llu %llu.\n",
 				counter, err,
-				(unsigned long long)n->counters[counter].count,
-				(unsigned long long)n->counters[counter].err);
+				slab ? (unsigned long long)slab->counters[counter].count : 0ULL,
+				slab ? (unsigned long long)slab->counters[counter].err : 0ULL);
 }
 
-static inline void dnet_counter_set(struct dnet_node *n, int counter, int err, int64_t val)
+static inline void dnet_node_send_queue_add(struct dnet_node *n, int64_t size)
 {
-	if (counter >= __DNET_CNTR_MAX)
-		counter = DNET_CNTR_UNKNOWN;
-
-	dnet_lock_lock(&n->counters_lock);
-	if (!err)
-		n->counters[counter].count = val;
-	else
-		n->counters[counter].err = val;
-	dnet_lock_unlock(&n->counters_lock);
+	dnet_lock_lock(&n->send_queue_lock);
+	n->send_queue_bytes += size;
+	if (n->send_queue_bytes > n->send_queue_peak)
+		n->send_queue_peak = n->send_queue_bytes;
+	dnet_lock_unlock(&n->send_queue_lock);
 }
 
 struct dnet_trans;
@@ -638,6 +1065,36 @@ int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t
 
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
 
+/* maximum number of queued requests sent with single sendmsg() call */
+#define DNET_SEND_BATCH_MAX	64
+int dnet_send_request_batch(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, int more);
+int dnet_send_batch_iov(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, struct iovec *iov);
+int dnet_send_batch_sent(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, size_t sent);
+
+#ifdef HAVE_URING_SUPPORT
+/*
+ * DNET_NET_ENGINE_URING: send in flight, allocated on the first send.
+ * Memory-only requests are sent with a single IORING_OP_SENDMSG,
+ * file part is spliced into the pipe and from the pipe into the socket.
+ */
+struct dnet_uring_send {
+	struct msghdr		msg;
+	struct iovec		iov[DNET_SEND_BATCH_MAX * 2];
+	struct dnet_io_req	*reqs[DNET_SEND_BATCH_MAX];
+	int			num;
+	/* operations in flight and the first error they returned */
+	int			ops;
+	int			err;
+	/* pipe for file part and number of bytes spliced into it but not yet sent */
+	int			pipe[2];
+	unsigned int		pipe_bytes;
+	/* socket was full for the last splice, next one waits for POLLOUT */
+	int			wait_out;
+};
+
+void dnet_uring_state_destroy(struct dnet_net_state *st);
+#endif
+
 int __attribute__((weak)) dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int recursive);
 
 struct dnet_config;
@@ -656,12 +1113,23 @@ int __attribute__((weak)) dnet_state_join_nolock(struct dnet_net_state *st);
 
 struct dnet_trans
 {
-	struct rb_node			trans_entry;
+	struct hlist_node		trans_entry;
+	/* timer wheel slot or list of timed out transactions */
 	struct list_head		trans_list_entry;
 
-	struct timeval			time, start;
+	struct timeval			start;
 	struct timespec			wait_ts;
 
+	/*
+	 * Timer state is protected by timer shard lock, @timer_seq is also
+	 * changed under state's trans_lock, @expire_* are used by timer thread only
+	 */
+	uint64_t			expires;	/* msec, CLOCK_MONOTONIC */
+	unsigned int			timer_seq;
+	int				timer_armed;
+	unsigned int			expire_seq;
+	struct list_head		expire_entry;
+
 	struct dnet_net_state		*orig; /* only for forward */
 
 	struct dnet_net_state		*st;
@@ -678,11 +1146,89 @@ struct dnet_trans
 						     void *priv);
 };
 
+/*
+ * Transaction objects pool. Objects with small trailing payload are
+ * allocated from one of size classes and cached in per-thread caches,
+ * which exchange objects with node-wide pool in batches.
+ */
+#define DNET_TRANS_POOL_CLASSES		3
+#define DNET_TRANS_CACHE_MAX		64
+#define DNET_TRANS_POOL_MAX_FREE	4096
+
+struct dnet_trans_pool;
+struct dnet_trans_obj {
+	struct dnet_trans_obj		*next;
+	struct dnet_trans_pool		*pool;
+	int				cls;		/* -1 if allocated with malloc() */
+	int				pad;
+};
+
+struct dnet_trans_cache {
+	struct list_head		cache_entry;
+	struct dnet_trans_pool		*pool;
+	struct dnet_trans_obj		*free[DNET_TRANS_POOL_CLASSES];
+	int				num[DNET_TRANS_POOL_CLASSES];
+
+	/* updated by the owner thread only */
+	uint64_t			alloc, freed, miss;
+};
+
+struct dnet_trans_pool {
+	pthread_key_t			key;
+	pthread_mutex_t			lock;
+	struct list_head		cache_list;
+	struct dnet_trans_obj		*free[DNET_TRANS_POOL_CLASSES];
+	int				num[DNET_TRANS_POOL_CLASSES];
+
+	/* counters of exited threads and threads without cache */
+	uint64_t			alloc, freed, miss;
+};
+
+int dnet_trans_pool_init(struct dnet_node *n);
+void dnet_trans_pool_cleanup(struct dnet_node *n);
+void dnet_trans_pool_stat(struct dnet_node *n, uint64_t *used, uint64_t *cached, uint64_t *miss);
+
 void dnet_trans_destroy(struct dnet_trans *t);
 struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size);
 int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl);
 int dnet_trans_timer_setup(struct dnet_trans *t);
 
+/*
+ * Transaction timeouts: hierarchical timer wheel with millisecond ticks,
+ * sharded by transaction id. Level 0 has 256 one-tick slots, every next
+ * level has 64 slots covering the whole previous level each.
+ */
+#define DNET_TIMER_SHARDS		8
+#define DNET_TIMER_LEVELS		4
+#define DNET_TIMER_L0_BITS		8
+#define DNET_TIMER_LN_BITS		6
+#define DNET_TIMER_SLOTS		((1 << DNET_TIMER_L0_BITS) + (DNET_TIMER_LEVELS - 1) * (1 << DNET_TIMER_LN_BITS))
+
+struct dnet_timer_shard {
+	pthread_mutex_t			lock;
+	uint64_t			now;		/* last processed tick */
+	struct list_head		slots[DNET_TIMER_SLOTS];
+};
+
+struct dnet_timer {
+	struct dnet_timer_shard		shard[DNET_TIMER_SHARDS];
+
+	/*
+	 * Timer thread sleeps on @wait, @earliest is the earliest
+	 * expiration time added since its last run
+	 */
+	pthread_mutex_t			wait_lock;
+	pthread_cond_t			wait;
+	uint64_t			earliest;
+};
+
+uint64_t dnet_time_ms(void);
+int dnet_trans_timer_init(struct dnet_node *n);
+void dnet_trans_timer_cleanup(struct dnet_node *n);
+/* must be called under t->st->trans_lock */
+void dnet_trans_timer_add(struct dnet_trans *t, struct timespec *wait_ts);
+void dnet_trans_timer_del(struct dnet_trans *t);
+
 static inline struct dnet_trans *dnet_trans_get(struct dnet_trans *t)
 {
 	atomic_inc(&t->refcnt);
@@ -695,10 +1241,11 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 		dnet_trans_destroy(t);
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a);
+int dnet_trans_insert_nolock(struct dnet_trans_table *table, struct dnet_trans *a);
 void dnet_trans_remove(struct dnet_trans *t);
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t);
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans);
+void dnet_trans_remove_nolock(struct dnet_trans_table *table, struct dnet_trans *t);
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *table, uint64_t trans);
+void dnet_trans_table_destroy(struct dnet_trans_table *table);
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req);
 
@@ -707,6 +1254,10 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_owned(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (* data_free)(void *priv), void *data_priv);
+int dnet_send_read_data_owned(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void (* data_free)(void *priv), void *data_priv);
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -834,6 +1385,18 @@ struct dnet_iterator_file_private {
 	int				fd;		/* Append mode file descriptor */
 };
 
+/*
+ * Iterator started in its own thread, holds copy of the original command
+ */
+struct dnet_iterator_job {
+	struct list_head		job_entry;	/* Entry in n->iterator_jobs while queued */
+	struct dnet_net_state		*st;		/* State to reply to, referenced */
+	struct dnet_cmd			cmd;		/* Copy of original command */
+	struct dnet_iterator_request	*req;		/* Points into data */
+	struct dnet_iterator_range	*range;		/* Points into data */
+	char				data[0];	/* Copy of command data */
+};
+
 #ifndef CONFIG_ELLIPTICS_VERSION_0
 #error "Elliptics version macros is not defined"
 #endif
@@ -14,6 +14,7 @@
  */
 
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,256 +24,396 @@
 
 #include "elliptics.h"
 
-void dnet_locks_destroy(struct dnet_node *n)
+static inline uint64_t dnet_locks_hash(const unsigned char *id)
 {
-	struct dnet_locks_entry *r, *tmp;
+	uint64_t a, b;
 
-	if (n->locks) {
+	memcpy(&a, id, sizeof(uint64_t));
+	memcpy(&b, id + sizeof(uint64_t), sizeof(uint64_t));
+
+	return (a ^ (b * 0xc6a4a7935bd1e995ULL)) * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline struct dnet_locks_stripe *dnet_locks_stripe(struct dnet_node *n, uint64_t hash)
+{
+	return &n->locks->stripe[(hash >> 32) & (DNET_LOCKS_STRIPES - 1)];
+}
+
+static inline struct hlist_head *dnet_locks_bucket(struct dnet_locks_stripe *stripe, uint64_t hash)
+{
+	return &stripe->hash[hash >> (64 - stripe->bits)];
+}
+
+static int dnet_locks_resize(struct dnet_locks_stripe *stripe, unsigned int bits)
+{
+	struct hlist_head *old = stripe->hash;
+	unsigned int old_size = old ? 1U << stripe->bits : 0;
+	struct dnet_locks_entry *entry;
+	struct hlist_node *pos, *tmp;
+	unsigned int i;
+
+	stripe->hash = malloc(sizeof(struct hlist_head) << bits);
+	if (!stripe->hash) {
+		stripe->hash = old;
+		return -ENOMEM;
+	}
 
-		list_for_each_entry_safe(r, tmp, &n->locks->lock_list, lock_list_entry) {
-			list_del(&r->lock_list_entry);
-			pthread_mutex_destroy(&r->lock);
-			pthread_cond_destroy(&r->wait);
+	for (i = 0; i < (1U << bits); ++i)
+		INIT_HLIST_HEAD(&stripe->hash[i]);
+	stripe->bits = bits;
 
-			if (r->lock_tree_entry.rb_parent_color) {
-				rb_erase(&r->lock_tree_entry, &n->locks->lock_tree);
+	for (i = 0; i < old_size; ++i) {
+		hlist_for_each_entry_safe(entry, pos, tmp, &old[i], hash_entry)
+			hlist_add_head(&entry->hash_entry, dnet_locks_bucket(stripe, dnet_locks_hash(entry->id.id)));
+	}
+
+	free(old);
+	return 0;
+}
+
+static void dnet_locks_entry_free(struct dnet_locks_entry *entry)
+{
+	pthread_cond_destroy(&entry->read_wait);
+	pthread_cond_destroy(&entry->write_wait);
+	free(entry);
+}
+
+static void dnet_locks_stripe_destroy(struct dnet_locks_stripe *stripe)
+{
+	struct dnet_locks_entry *entry;
+	struct hlist_node *pos, *tmp;
+	unsigned int i;
+
+	if (stripe->hash) {
+		for (i = 0; i < (1U << stripe->bits); ++i) {
+			hlist_for_each_entry_safe(entry, pos, tmp, &stripe->hash[i], hash_entry) {
+				hlist_del(&entry->hash_entry);
+				dnet_locks_entry_free(entry);
 			}
 		}
+	}
+
+	hlist_for_each_entry_safe(entry, pos, tmp, &stripe->free_list, hash_entry) {
+		hlist_del(&entry->hash_entry);
+		dnet_locks_entry_free(entry);
+	}
+
+	free(stripe->hash);
+	pthread_mutex_destroy(&stripe->lock);
+}
+
+void dnet_locks_destroy(struct dnet_node *n)
+{
+	int i;
+
+	if (n->locks) {
+		for (i = 0; i < DNET_LOCKS_STRIPES; ++i)
+			dnet_locks_stripe_destroy(&n->locks->stripe[i]);
 
 		free(n->locks);
 		n->locks = NULL;
 	}
 }
 
+/*
+ * @num is the expected number of concurrently locked keys,
+ * it is only used to size initial hash tables, they grow with load.
+ */
 int dnet_locks_init(struct dnet_node *n, int num)
 {
+	struct dnet_locks_stripe *stripe;
+	unsigned int bits = DNET_LOCKS_MIN_BITS;
 	int err, i;
-	struct dnet_locks_entry *entry;
 
-	n->locks = malloc(sizeof(struct dnet_locks) + num * sizeof(struct dnet_locks_entry));
+	n->locks = malloc(sizeof(struct dnet_locks));
 	if (!n->locks) {
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
 
-	INIT_LIST_HEAD(&n->locks->lock_list);
-	n->locks->lock_tree = RB_ROOT;
+	memset(n->locks, 0, sizeof(struct dnet_locks));
 
-	err = pthread_mutex_init(&n->locks->lock, NULL);
-	if (err) {
-		err = -err;
-		dnet_log(n, DNET_LOG_ERROR, "Could not create lock: %s [%d]\n", strerror(-err), err);
+	while ((1 << bits) < num / DNET_LOCKS_STRIPES)
+		bits++;
 
-		goto err_out_destroy;
-	}
-
-	entry = (struct dnet_locks_entry *) (n->locks + 1);
+	for (i = 0; i < DNET_LOCKS_STRIPES; ++i) {
+		stripe = &n->locks->stripe[i];
 
-	for (i = 0; i < num; ++i, ++entry) {
-		entry->locked = 0;
-
-		err = pthread_mutex_init(&entry->lock, NULL);
+		err = pthread_mutex_init(&stripe->lock, NULL);
 		if (err) {
 			err = -err;
-			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]\n", i, num, strerror(-err), err);
-
+			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]\n",
+					i, DNET_LOCKS_STRIPES, strerror(-err), err);
 			goto err_out_destroy;
 		}
-		err = pthread_cond_init(&entry->wait, NULL);
-		if (err) {
-			err = -err;
-			dnet_log(n, DNET_LOG_ERROR, "Could not create cond %d/%d: %s [%d]\n", i, num, strerror(-err), err);
 
-			pthread_mutex_destroy(&entry->lock);
+		INIT_HLIST_HEAD(&stripe->free_list);
+
+		err = dnet_locks_resize(stripe, bits);
+		if (err) {
+			pthread_mutex_destroy(&stripe->lock);
 			goto err_out_destroy;
 		}
-
-		memset(&entry->lock_tree_entry, 0, sizeof(struct rb_node));
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
 	}
 
 	return 0;
 
 err_out_destroy:
-	dnet_locks_destroy(n);
+	while (--i >= 0)
+		dnet_locks_stripe_destroy(&n->locks->stripe[i]);
+	free(n->locks);
+	n->locks = NULL;
 err_out_exit:
 	return err;
 }
 
-static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_node *n, struct dnet_id *id)
+/* must be called under stripe lock */
+static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_locks_stripe *stripe,
+		struct dnet_id *id, uint64_t hash)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node *node = root->rb_node;
-	struct dnet_locks_entry *entry = NULL;
-	int cmp = 1;
-
-	while (node) {
-		entry = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
-
-		cmp = memcmp(entry->id.id, id->id, DNET_ID_SIZE);
-		if (cmp < 0)
-			node = node->rb_left;
-		else if (cmp > 0)
-			node = node->rb_right;
-		else
+	struct dnet_locks_entry *entry;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(entry, pos, dnet_locks_bucket(stripe, hash), hash_entry) {
+		if (!memcmp(entry->id.id, id->id, DNET_ID_SIZE))
 			return entry;
 	}
 
 	return NULL;
 }
 
-static int dnet_oplock_insert_nolock(struct dnet_node *n, struct dnet_locks_entry *a)
+/*
+ * Returns referenced entry for given key, it is created if there is none.
+ * Must be called under stripe lock.
+ */
+static struct dnet_locks_entry *dnet_oplock_get_nolock(struct dnet_node *n, struct dnet_locks_stripe *stripe,
+		struct dnet_id *id, uint64_t hash)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node **node = &root->rb_node, *parent = NULL;
-	struct dnet_locks_entry *t;
-	int cmp;
-
-	while (*node) {
-		parent = *node;
-
-		t = rb_entry(parent, struct dnet_locks_entry, lock_tree_entry);
-
-		cmp = memcmp(t->id.id, a->id.id, DNET_ID_SIZE);
-		if (cmp < 0)
-			node = &parent->rb_left;
-		else if (cmp > 0)
-			node = &parent->rb_right;
-		else
-			return -EEXIST;
+	struct dnet_locks_entry *entry;
+
+	entry = dnet_oplock_search_nolock(stripe, id, hash);
+	if (entry) {
+		entry->refcnt++;
+		return entry;
 	}
 
-	rb_link_node(&a->lock_tree_entry, parent, node);
-	rb_insert_color(&a->lock_tree_entry, root);
-	return 0;
-}
+	if (stripe->num >= (1U << stripe->bits)) {
+		/* table still works when overloaded, only chains become longer */
+		if (dnet_locks_resize(stripe, stripe->bits + 1))
+			dnet_log(n, DNET_LOG_ERROR, "%s: could not grow oplock table: %u entries.\n",
+					dnet_dump_id(id), stripe->num);
+	}
 
-static void dnet_oplock_remove_nolock(struct dnet_node *n, struct dnet_locks_entry *entry)
-{
-	struct rb_root *root = &n->locks->lock_tree;
+	if (!hlist_empty(&stripe->free_list)) {
+		entry = hlist_entry(stripe->free_list.first, struct dnet_locks_entry, hash_entry);
+		hlist_del(&entry->hash_entry);
+		stripe->free_num--;
+	} else {
+		entry = malloc(sizeof(struct dnet_locks_entry));
+		if (!entry)
+			goto err_out_exit;
 
-	if (!entry->lock_tree_entry.rb_parent_color) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: trying to remove non-existen oplock.\n",
-			dnet_dump_id_str(entry->id.id));
-		return;
-	}
+		if (pthread_cond_init(&entry->read_wait, NULL)) {
+			free(entry);
+			goto err_out_exit;
+		}
 
-	if (entry) {
-		rb_erase(&entry->lock_tree_entry, root);
-		entry->lock_tree_entry.rb_parent_color = 0;
+		if (pthread_cond_init(&entry->write_wait, NULL)) {
+			pthread_cond_destroy(&entry->read_wait);
+			free(entry);
+			goto err_out_exit;
+		}
 	}
-}
 
-static struct dnet_locks_entry *dnet_oplock_ensure(struct dnet_node *n, struct dnet_id *id)
-{
-	struct dnet_locks_entry *entry = NULL;
+	entry->writer = 0;
+	entry->readers = 0;
+	entry->readers_waiting = 0;
+	entry->writers_waiting = 0;
+	entry->read_phase = 0;
+	entry->read_gen = 0;
+	entry->refcnt = 1;
+	memcpy(entry->id.id, id->id, sizeof(entry->id.id));
 
-	pthread_mutex_lock(&n->locks->lock);
+	hlist_add_head(&entry->hash_entry, dnet_locks_bucket(stripe, hash));
+	stripe->num++;
 
-	entry = dnet_oplock_search_nolock(n, id);
+	return entry;
 
-	if (entry) {
-		atomic_inc(&entry->refcnt);
-	} else if (!list_empty(&n->locks->lock_list)) {
-		entry = list_first_entry(&n->locks->lock_list, struct dnet_locks_entry, lock_list_entry);
-		list_del(&entry->lock_list_entry);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "%s: could not allocate oplock.\n", dnet_dump_id(id));
+	return NULL;
+}
 
-		entry->locked = 0;
-		atomic_init(&entry->refcnt, 1);
+/* must be called under stripe lock */
+static void dnet_oplock_put_nolock(struct dnet_locks_stripe *stripe, struct dnet_locks_entry *entry)
+{
+	if (--entry->refcnt)
+		return;
 
-		memcpy(entry->id.id, id->id, sizeof(entry->id.id));
+	hlist_del(&entry->hash_entry);
+	stripe->num--;
 
-		dnet_oplock_insert_nolock(n, entry);
+	if (stripe->free_num < DNET_LOCKS_FREE_MAX) {
+		hlist_add_head(&entry->hash_entry, &stripe->free_list);
+		stripe->free_num++;
 	} else {
-		dnet_log(n, DNET_LOG_ERROR, "%s: oplock list is empty.\n", dnet_dump_id(id));
+		dnet_locks_entry_free(entry);
 	}
+}
 
-	pthread_mutex_unlock(&n->locks->lock);
+static long dnet_oplock_wait_time(struct timeval *start)
+{
+	struct timeval end;
 
-	return entry;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000000 + end.tv_usec - start->tv_usec;
 }
 
-static struct dnet_locks_entry *dnet_oplock_take(struct dnet_node *n, struct dnet_id *id)
+static void dnet_oplock_wait_stat(struct dnet_node *n, struct dnet_id *key, int shared, long diff)
 {
-	struct dnet_locks_entry *entry = NULL;
+	dnet_counter_add(n, shared ? DNET_CNTR_OPLOCK_SHARED_WAIT : DNET_CNTR_OPLOCK_EXCL_WAIT, 1, diff);
 
-	pthread_mutex_lock(&n->locks->lock);
+	if (diff >= DNET_OPLOCK_WAIT_LOG_USECS)
+		dnet_log(n, DNET_LOG_NOTICE, "%s: %s oplock wait: %ld usecs.\n",
+				dnet_dump_id(key), shared ? "shared" : "exclusive", diff);
+}
 
-	entry = dnet_oplock_search_nolock(n, id);
+/* new readers do not pass waiting writers, even when previous readers are being let in */
+static inline int dnet_oplock_read_blocked(struct dnet_locks_entry *entry)
+{
+	return entry->writer || entry->writers_waiting;
+}
 
-	if (!entry) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: lock not found.\n", dnet_dump_id(id));
-		goto err_out_complete;
-	}
+static inline int dnet_oplock_write_blocked(struct dnet_locks_entry *entry)
+{
+	return entry->writer || entry->readers || entry->read_phase;
+}
 
-	if (entry && atomic_dec_and_test(&entry->refcnt)) {
-		dnet_oplock_remove_nolock(n, entry);
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
+static void __dnet_oplock(struct dnet_node *n, struct dnet_id *key, int shared)
+{
+	uint64_t hash = dnet_locks_hash(key->id);
+	struct dnet_locks_stripe *stripe = dnet_locks_stripe(n, hash);
+	struct dnet_locks_entry *entry;
+	struct timeval start;
+	unsigned int gen;
+	long diff = -1;
 
-		entry = NULL;
-		goto err_out_complete;
-	}
+	pthread_mutex_lock(&stripe->lock);
 
-err_out_complete:
-	pthread_mutex_unlock(&n->locks->lock);
+	entry = dnet_oplock_get_nolock(n, stripe, key, hash);
+	if (!entry)
+		goto err_out_unlock;
 
-	return entry;
-}
+	if (shared) {
+		if (dnet_oplock_read_blocked(entry)) {
+			gettimeofday(&start, NULL);
 
-void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
-{
-	struct dnet_locks_entry *entry = dnet_oplock_ensure(n, key);
+			/* waiting reader is admitted by the writer's unlock, which bumps generation */
+			gen = entry->read_gen;
+			entry->readers_waiting++;
+			while (entry->read_gen == gen)
+				pthread_cond_wait(&entry->read_wait, &stripe->lock);
+			entry->readers_waiting--;
+			entry->read_phase--;
 
-	if (!entry) {
-		return;
-	}
+			diff = dnet_oplock_wait_time(&start);
+		}
+
+		entry->readers++;
+	} else {
+		if (dnet_oplock_write_blocked(entry)) {
+			gettimeofday(&start, NULL);
 
-	pthread_mutex_lock(&entry->lock);
+			entry->writers_waiting++;
+			while (dnet_oplock_write_blocked(entry))
+				pthread_cond_wait(&entry->write_wait, &stripe->lock);
+			entry->writers_waiting--;
 
-	while (entry->locked) {
-		pthread_cond_wait(&entry->wait, &entry->lock);
+			diff = dnet_oplock_wait_time(&start);
+		}
+
+		entry->writer = 1;
 	}
 
-	entry->locked = 1;
+err_out_unlock:
+	pthread_mutex_unlock(&stripe->lock);
 
-	pthread_mutex_unlock(&entry->lock);
+	if (diff >= 0)
+		dnet_oplock_wait_stat(n, key, shared, diff);
 }
 
+void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
+{
+	__dnet_oplock(n, key, 0);
+}
+
+void dnet_oplock_shared(struct dnet_node *n, struct dnet_id *key)
+{
+	__dnet_oplock(n, key, 1);
+}
+
+/* releases either shared or exclusive lock, whichever is held */
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key)
 {
-	struct dnet_locks_entry *entry = dnet_oplock_take(n, key);
+	uint64_t hash = dnet_locks_hash(key->id);
+	struct dnet_locks_stripe *stripe = dnet_locks_stripe(n, hash);
+	struct dnet_locks_entry *entry;
+
+	pthread_mutex_lock(&stripe->lock);
 
+	entry = dnet_oplock_search_nolock(stripe, key, hash);
 	if (!entry) {
-		return;
+		dnet_log(n, DNET_LOG_ERROR, "%s: lock not found.\n", dnet_dump_id(key));
+		goto err_out_unlock;
 	}
 
-	pthread_mutex_lock(&entry->lock);
+	if (entry->writer) {
+		entry->writer = 0;
 
-	entry->locked = 0;
+		if (entry->readers_waiting) {
+			entry->read_phase = entry->readers_waiting;
+			entry->read_gen++;
+			pthread_cond_broadcast(&entry->read_wait);
+		} else if (entry->writers_waiting) {
+			pthread_cond_signal(&entry->write_wait);
+		}
+	} else if (entry->readers) {
+		if (--entry->readers == 0 && entry->writers_waiting && !entry->read_phase)
+			pthread_cond_signal(&entry->write_wait);
+	} else {
+		dnet_log(n, DNET_LOG_ERROR, "%s: unlocking oplock which is not locked.\n", dnet_dump_id(key));
+	}
 
-	pthread_cond_signal(&entry->wait);
+	dnet_oplock_put_nolock(stripe, entry);
 
-	pthread_mutex_unlock(&entry->lock);
+err_out_unlock:
+	pthread_mutex_unlock(&stripe->lock);
 }
 
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key)
 {
-	struct dnet_locks_entry *entry = dnet_oplock_ensure(n, key);
+	uint64_t hash = dnet_locks_hash(key->id);
+	struct dnet_locks_stripe *stripe = dnet_locks_stripe(n, hash);
+	struct dnet_locks_entry *entry;
 	int err = 0;
 
+	pthread_mutex_lock(&stripe->lock);
+
+	entry = dnet_oplock_get_nolock(n, stripe, key, hash);
 	if (!entry) {
-		return -ENOENT;
+		err = -ENOENT;
+		goto err_out_unlock;
 	}
 
-	pthread_mutex_lock(&entry->lock);
-
-	if (entry->locked)
+	if (dnet_oplock_write_blocked(entry)) {
 		err = -EBUSY;
-	else
-		entry->locked = 1;
+		dnet_oplock_put_nolock(stripe, entry);
+	} else {
+		entry->writer = 1;
+	}
 
-	pthread_mutex_unlock(&entry->lock);
+err_out_unlock:
+	pthread_mutex_unlock(&stripe->lock);
 
 	return err;
 }
-
@@ -34,6 +34,28 @@
 
 extern __thread uint32_t trace_id;
 
+enum dnet_log_record_type {
+	DNET_LOG_RECORD_TEXT = 0,
+	DNET_LOG_RECORD_BINARY,
+	DNET_LOG_RECORD_TRACE,
+	DNET_LOG_RECORD_SKIP,			/* rest of the ring till its end is unused */
+};
+
+/* every record is 8 bytes aligned and followed by its payload */
+struct dnet_log_record {
+	uint32_t		size;
+	uint16_t		type;
+	int16_t			level;
+};
+
+struct dnet_log_binary_record {
+	const char		*format;
+	uint64_t		args[DNET_LOG_BINARY_ARGS];
+};
+
+#define DNET_LOG_RING_MIN_SIZE		4096
+#define DNET_LOG_FLUSH_TIMEOUT_MS	10
+
 int dnet_log_init(struct dnet_node *n, struct dnet_log *l)
 {
 	if (!n)
@@ -44,9 +66,305 @@ int dnet_log_init(struct dnet_node *n, struct dnet_log *l)
 	return 0;
 }
 
-void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
+/* thread exit: ring is freed by log thread when drained */
+static void dnet_log_ring_destroy(void *data)
+{
+	struct dnet_log_ring *r = data;
+
+	__sync_synchronize();
+	r->dead = 1;
+}
+
+static struct dnet_log_ring *dnet_log_ring(struct dnet_node *n)
+{
+	struct dnet_log_ring *r;
+	int size = n->log_ring_size;
+
+	r = pthread_getspecific(n->log_key);
+	if (r || !size)
+		return r;
+
+	r = malloc(sizeof(struct dnet_log_ring) + size);
+	if (!r)
+		return NULL;
+
+	memset(r, 0, sizeof(struct dnet_log_ring));
+	r->n = n;
+	r->data = (char *)(r + 1);
+	r->size = size;
+
+	if (pthread_setspecific(n->log_key, r)) {
+		free(r);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&n->log_lock);
+	list_add_tail(&r->ring_entry, &n->log_rings);
+	pthread_mutex_unlock(&n->log_lock);
+
+	return r;
+}
+
+/*
+ * Returns negative error if there is no ring and message has to be logged synchronously,
+ * message is dropped if ring is full
+ */
+static int dnet_log_ring_put(struct dnet_node *n, int level, int type, const void *data, size_t size)
+{
+	struct dnet_log_ring *r;
+	struct dnet_log_record *rec;
+	uint64_t head, off, room, need;
+
+	r = dnet_log_ring(n);
+	if (!r)
+		return -ENOMEM;
+
+	size = ALIGN(sizeof(struct dnet_log_record) + size, 8);
+
+	head = r->head;
+	off = head & (r->size - 1);
+	room = r->size - off;
+
+	need = size;
+	if (room < size)
+		need += room;
+
+	if (r->size - (head - r->tail) < need) {
+		r->dropped++;
+		return 0;
+	}
+
+	if (room < size) {
+		rec = (struct dnet_log_record *)(r->data + off);
+		rec->size = room;
+		rec->type = DNET_LOG_RECORD_SKIP;
+
+		head += room;
+		off = 0;
+	}
+
+	rec = (struct dnet_log_record *)(r->data + off);
+	rec->size = size;
+	rec->type = type;
+	rec->level = level;
+	memcpy(rec + 1, data, size - sizeof(struct dnet_log_record));
+
+	__sync_synchronize();
+	r->head = head + size;
+
+	if ((r->head - r->tail > r->size / 2) && !n->log_wakeup) {
+		n->log_wakeup = 1;
+		pthread_cond_signal(&n->log_wait);
+	}
+
+	return 0;
+}
+
+static void dnet_log_format_binary(char *buf, size_t size, struct dnet_log_binary_record *b)
+{
+	snprintf(buf, size, b->format, b->args[0], b->args[1], b->args[2],
+			b->args[3], b->args[4], b->args[5]);
+}
+
+void dnet_trace_span(struct dnet_node *n, struct dnet_trace_span *span)
+{
+	if (n->trace_fd >= 0 && n->log_ring_size)
+		dnet_log_ring_put(n, 0, DNET_LOG_RECORD_TRACE, span, sizeof(struct dnet_trace_span));
+}
+
+static void dnet_trace_write(struct dnet_node *n, struct dnet_trace_span *span)
+{
+	char buf[256];
+	int len, i, err;
+
+	len = snprintf(buf, sizeof(buf), "%llu.%06llu %08x %s %s %u %llu %d ",
+			(unsigned long long)span->start / 1000000, (unsigned long long)span->start % 1000000,
+			span->trace_id, dnet_cmd_string(span->cmd), dnet_stage_string(span->stage),
+			span->duration, (unsigned long long)span->size, span->err);
+
+	for (i = 0; i < (int)sizeof(span->id); ++i)
+		len += snprintf(buf + len, sizeof(buf) - len, "%02x", span->id[i]);
+	buf[len++] = '\n';
+
+	err = write(n->trace_fd, buf, len);
+	(void) err;
+}
+
+static void dnet_log_ring_drain(struct dnet_node *n, struct dnet_log_ring *r)
+{
+	struct dnet_log *l = n->log;
+	struct dnet_log_record *rec;
+	uint64_t head, tail, size, dropped;
+	char buf[1024];
+
+	head = r->head;
+	__sync_synchronize();
+
+	for (tail = r->tail; tail != head; tail += size) {
+		rec = (struct dnet_log_record *)(r->data + (tail & (r->size - 1)));
+		size = rec->size;
+
+		if (rec->type == DNET_LOG_RECORD_TEXT) {
+			l->log(l->log_private, rec->level, (char *)(rec + 1));
+		} else if (rec->type == DNET_LOG_RECORD_BINARY) {
+			dnet_log_format_binary(buf, sizeof(buf), (struct dnet_log_binary_record *)(rec + 1));
+			l->log(l->log_private, rec->level, buf);
+		} else if (rec->type == DNET_LOG_RECORD_TRACE) {
+			dnet_trace_write(n, (struct dnet_trace_span *)(rec + 1));
+		}
+
+		/* record must be read completely before producer can reuse its space */
+		__sync_synchronize();
+		r->tail = tail + size;
+	}
+
+	dropped = r->dropped;
+	if (dropped != r->dropped_reported) {
+		dnet_counter_add(n, DNET_CNTR_LOG_DROPPED, dropped - r->dropped_reported, 0);
+
+		if (l->log_level >= DNET_LOG_ERROR) {
+			snprintf(buf, sizeof(buf), "%llu log messages were dropped, thread log ring is full\n",
+					(unsigned long long)(dropped - r->dropped_reported));
+			l->log(l->log_private, DNET_LOG_ERROR, buf);
+		}
+
+		r->dropped_reported = dropped;
+	}
+}
+
+static void *dnet_log_process(void *data)
+{
+	struct dnet_node *n = data;
+	struct dnet_log_ring *r, *tmp;
+	struct timespec ts;
+	int need_exit, dead;
+
+	dnet_set_name("dnet_log");
+
+	pthread_mutex_lock(&n->log_lock);
+	while (1) {
+		need_exit = n->log_need_exit;
+
+		list_for_each_entry_safe(r, tmp, &n->log_rings, ring_entry) {
+			dead = r->dead;
+			__sync_synchronize();
+
+			dnet_log_ring_drain(n, r);
+
+			if (dead) {
+				list_del(&r->ring_entry);
+				free(r);
+			}
+		}
+
+		if (need_exit)
+			break;
+
+		if (!n->log_wakeup) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += DNET_LOG_FLUSH_TIMEOUT_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			pthread_cond_timedwait(&n->log_wait, &n->log_lock, &ts);
+		}
+		n->log_wakeup = 0;
+	}
+	pthread_mutex_unlock(&n->log_lock);
+
+	return NULL;
+}
+
+int dnet_log_thread_start(struct dnet_node *n, int ring_size)
+{
+	int size = DNET_LOG_RING_MIN_SIZE;
+	int err;
+
+	if (ring_size <= 0)
+		return 0;
+
+	while (size < ring_size)
+		size <<= 1;
+
+	INIT_LIST_HEAD(&n->log_rings);
+	n->log_need_exit = 0;
+	n->log_wakeup = 0;
+
+	err = pthread_mutex_init(&n->log_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_exit;
+	}
+
+	err = pthread_cond_init(&n->log_wait, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_lock_destroy;
+	}
+
+	err = pthread_key_create(&n->log_key, dnet_log_ring_destroy);
+	if (err) {
+		err = -err;
+		goto err_out_cond_destroy;
+	}
+
+	err = pthread_create(&n->log_tid, NULL, dnet_log_process, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Failed to start log thread: %d\n", err);
+		goto err_out_key_delete;
+	}
+
+	n->log_ring_size = size;
+	dnet_log(n, DNET_LOG_INFO, "Started asynchronous logging, thread ring size: %d bytes\n", size);
+	return 0;
+
+err_out_key_delete:
+	pthread_key_delete(n->log_key);
+err_out_cond_destroy:
+	pthread_cond_destroy(&n->log_wait);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&n->log_lock);
+err_out_exit:
+	return err;
+}
+
+/*
+ * Must be called when node threads are stopped,
+ * all queued messages are written and logging becomes synchronous again
+ */
+void dnet_log_thread_stop(struct dnet_node *n)
+{
+	struct dnet_log_ring *r, *tmp;
+
+	if (!n->log_ring_size)
+		return;
+
+	n->log_ring_size = 0;
+	__sync_synchronize();
+
+	pthread_mutex_lock(&n->log_lock);
+	n->log_need_exit = 1;
+	pthread_cond_signal(&n->log_wait);
+	pthread_mutex_unlock(&n->log_lock);
+
+	pthread_join(n->log_tid, NULL);
+
+	pthread_key_delete(n->log_key);
+
+	list_for_each_entry_safe(r, tmp, &n->log_rings, ring_entry) {
+		list_del(&r->ring_entry);
+		free(r);
+	}
+
+	pthread_cond_destroy(&n->log_wait);
+	pthread_mutex_destroy(&n->log_lock);
+}
+
+void dnet_log_vraw(struct dnet_node *n, int level, const char *format, va_list args)
 {
-	va_list args;
 	char buf[1024];
 	struct dnet_log *l = n->log;
 	int buflen = sizeof(buf);
@@ -54,9 +372,42 @@ void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
 	if (!l->log || ((l->log_level < level) && !(trace_id & DNET_TRACE_BIT)))
 		return;
 
-	va_start(args, format);
 	vsnprintf(buf, buflen, format, args);
 	buf[buflen-1] = '\0';
+
+	if (n->log_ring_size && !dnet_log_ring_put(n, level, DNET_LOG_RECORD_TEXT, buf, strlen(buf) + 1))
+		return;
+
 	l->log(l->log_private, level, buf);
+}
+
+void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	dnet_log_vraw(n, level, format, args);
 	va_end(args);
 }
+
+void dnet_log_binary(struct dnet_node *n, int level, const char *format, uint64_t *args, int num)
+{
+	struct dnet_log_binary_record b;
+	struct dnet_log *l = n->log;
+	char buf[1024];
+
+	if (!l->log)
+		return;
+
+	memset(&b, 0, sizeof(struct dnet_log_binary_record));
+	b.format = format;
+	if (num > DNET_LOG_BINARY_ARGS)
+		num = DNET_LOG_BINARY_ARGS;
+	memcpy(b.args, args, num * sizeof(uint64_t));
+
+	if (n->log_ring_size && !dnet_log_ring_put(n, level, DNET_LOG_RECORD_BINARY, &b, sizeof(b)))
+		return;
+
+	dnet_log_format_binary(buf, sizeof(buf), &b);
+	l->log(l->log_private, level, buf);
+}
@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -245,25 +246,26 @@ err_out_exit:
 
 void dnet_state_clean(struct dnet_net_state *st)
 {
-	struct rb_node *rb_node;
-	struct dnet_trans *t;
+	struct dnet_trans_table *table = &st->trans_table;
+	struct hlist_node *pos, *hpos;
+	struct dnet_trans *t, *tmp;
+	LIST_HEAD(head);
+	unsigned int i;
 	int num = 0;
 
-	while (1) {
-		t = NULL;
-
-		pthread_mutex_lock(&st->trans_lock);
-		rb_node = rb_first(&st->trans_root);
-		if (rb_node) {
-			t = rb_entry(rb_node, struct dnet_trans, trans_entry);
+	pthread_mutex_lock(&st->trans_lock);
+	for (i = 0; table->hash && i < (1U << table->bits); ++i) {
+		hlist_for_each_entry_safe(t, pos, hpos, &table->hash[i], trans_entry) {
 			dnet_trans_get(t);
-			dnet_trans_remove_nolock(&st->trans_root, t);
-			list_del_init(&t->trans_list_entry);
+			dnet_trans_remove_nolock(table, t);
+			dnet_trans_timer_del(t);
+			list_move_tail(&t->trans_list_entry, &head);
 		}
-		pthread_mutex_unlock(&st->trans_lock);
+	}
+	pthread_mutex_unlock(&st->trans_lock);
 
-		if (!t)
-			break;
+	list_for_each_entry_safe(t, tmp, &head, trans_list_entry) {
+		list_del_init(&t->trans_list_entry);
 
 		dnet_trans_put(t);
 		dnet_trans_put(t);
@@ -274,23 +276,30 @@ void dnet_state_clean(struct dnet_net_state *st)
 }
 
 /*
- * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
- * Large data blocks are being sent through sendfile anyway, so it should not be _that_ costly operation.
+ * Header and data are copied into the queued request, unless caller has handed
+ * over data ownership with @orig->data_free - it is called when request is destroyed
+ * or when it can not be queued.
  */
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
 	void *buf;
 	struct dnet_io_req *r;
+	size_t copy_dsize = orig->data_free ? 0 : orig->dsize;
+	uint64_t size;
 	int offset = 0;
 	int err = 0;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+	buf = r = malloc(sizeof(struct dnet_io_req) + copy_dsize + orig->hsize);
 	if (!r) {
+		if (orig->data_free)
+			orig->data_free(orig->data_priv);
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
 	memset(r, 0, sizeof(struct dnet_io_req));
 	r->fd = -1;
+	gettimeofday(&r->time, NULL);
+	r->sampled = dnet_trace_sampled;
 
 	if (orig->header && orig->hsize) {
 		r->header = buf + sizeof(struct dnet_io_req);
@@ -300,7 +309,12 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		memcpy(r->header, orig->header, r->hsize);
 	}
 
-	if (orig->data && orig->dsize) {
+	if (orig->data_free) {
+		r->data = orig->data;
+		r->dsize = orig->dsize;
+		r->data_free = orig->data_free;
+		r->data_priv = orig->data_priv;
+	} else if (orig->data && orig->dsize) {
 		r->data = buf + sizeof(struct dnet_io_req) + offset;
 		r->dsize = orig->dsize;
 
@@ -310,17 +324,28 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 
 	if (orig->fd >= 0 && orig->fsize) {
 		r->fd = orig->fd;
-		r->on_exit = orig->on_exit;
+		r->on_exit = orig->on_exit & ~DNET_IO_REQ_FLAGS_RECV_BUF;
 		r->local_offset = orig->local_offset;
 		r->fsize = orig->fsize;
 	}
 
+	/*
+	 * Request can be sent and freed by network thread as soon as it is in the list,
+	 * so node accounting is done first, completion subtracts it
+	 */
+	size = r->hsize + r->dsize;
+	dnet_node_send_queue_add(st->n, size);
+
 	pthread_mutex_lock(&st->send_lock);
 	list_add_tail(&r->req_entry, &st->send_list);
 
+	st->send_queue_bytes += size;
+	if (st->send_queue_bytes > st->send_queue_peak)
+		st->send_queue_peak = st->send_queue_bytes;
+	pthread_mutex_unlock(&st->send_lock);
+
 	if (!st->need_exit)
 		dnet_schedule_send(st);
-	pthread_mutex_unlock(&st->send_lock);
 
 err_out_exit:
 	return err;
@@ -334,7 +359,14 @@ void dnet_io_req_free(struct dnet_io_req *r)
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE)
 			close(r->fd);
 	}
-	free(r);
+
+	if (r->data_free)
+		r->data_free(r->data_priv);
+
+	if (r->on_exit & DNET_IO_REQ_FLAGS_RECV_BUF)
+		dnet_io_req_recv_free(r);
+	else
+		free(r);
 }
 
 static int dnet_wait(struct dnet_net_state *st, unsigned int events, long timeout)
@@ -445,6 +477,27 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	return dnet_io_req_queue(st, &r);
 }
 
+/*
+ * Queue @data without copying it, @data_free(@data_priv) is called when it is sent
+ * or dropped. Ownership is transferred even if this function fails.
+ */
+ssize_t dnet_send_data_owned(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (* data_free)(void *priv), void *data_priv)
+{
+	struct dnet_io_req r;
+
+	memset(&r, 0, sizeof(r));
+	r.header = header;
+	r.hsize = hsize;
+	r.data = data;
+	r.dsize = dsize;
+	r.fd = -1;
+	r.data_free = data_free;
+	r.data_priv = data_priv;
+
+	return dnet_io_req_queue(st, &r);
+}
+
 static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
 {
 	ssize_t err;
@@ -486,14 +539,9 @@ ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 
 static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	struct timespec *wait_ts = t->wait_ts.tv_sec ? &t->wait_ts : &st->n->wait_ts;
-
-	gettimeofday(&t->time, NULL);
-
-	t->time.tv_sec += wait_ts->tv_sec;
-	t->time.tv_usec += wait_ts->tv_nsec / 1000;
+	struct timespec *wait_ts = (t->wait_ts.tv_sec || t->wait_ts.tv_nsec) ? &t->wait_ts : &st->n->wait_ts;
 
-	list_move_tail(&t->trans_list_entry, &st->trans_list);
+	dnet_trans_timer_add(t, wait_ts);
 }
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
@@ -504,7 +552,7 @@ int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 	dnet_trans_get(t);
 
 	pthread_mutex_lock(&st->trans_lock);
-	err = dnet_trans_insert_nolock(&st->trans_root, t);
+	err = dnet_trans_insert_nolock(&st->trans_table, t);
 	if (!err)
 		dnet_trans_timestamp(st, t);
 	pthread_mutex_unlock(&st->trans_lock);
@@ -688,20 +736,20 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 		uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
 
 		pthread_mutex_lock(&st->trans_lock);
-		t = dnet_trans_search(&st->trans_root, tid);
+		t = dnet_trans_search(&st->trans_table, tid);
 		if (t) {
 			if (!(cmd->flags & DNET_FLAGS_MORE)) {
-				dnet_trans_remove_nolock(&st->trans_root, t);
+				dnet_trans_remove_nolock(&st->trans_table, t);
 			} else {
 				dnet_trans_timestamp(st, t);
 			}
 
 			/*
-			 * Always remove transaction from 'timeout' list,
-			 * thus it will not be found by checker thread and
+			 * Always remove transaction from timer wheel,
+			 * thus it will not be expired by timer thread and
 			 * its callback will not be called under us
 			 */
-			list_del_init(&t->trans_list_entry);
+			dnet_trans_timer_del(t);
 		}
 		pthread_mutex_unlock(&st->trans_lock);
 
@@ -712,6 +760,16 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 			goto err_out_exit;
 		}
 
+		if (st->stall) {
+			st->stall = 0;
+
+			if (st->weight < DNET_STATE_MAX_WEIGHT)
+				st->weight *= 1.2;
+
+			dnet_log(n, DNET_LOG_INFO, "%s: reseting state stall counter: weight: %f\n",
+					dnet_state_dump_addr(st), st->weight);
+		}
+
 		if (t->complete)
 			t->complete(t->st, cmd, t->priv);
 
@@ -721,7 +779,7 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 			dnet_trans_put(t);
 		} else {
 			/*
-			 * Put transaction back into the end of 'timeout' list with updated timestamp
+			 * Put transaction back into timer wheel with updated timeout
 			 */
 
 			pthread_mutex_lock(&st->trans_lock);
@@ -791,9 +849,9 @@ void dnet_state_reset(struct dnet_net_state *st, int error)
 	dnet_log(st->n, DNET_LOG_ERROR, "%s: resetting state: %s [%d]\n",
 			dnet_state_dump_addr(st), strerror(-error), error);
 
-	pthread_mutex_lock(&st->send_lock);
+	dnet_state_remove(st);
 
-	dnet_state_remove_nolock(st);
+	pthread_mutex_lock(&st->send_lock);
 
 	if (!st->need_exit)
 		st->need_exit = error;
@@ -801,6 +859,9 @@ void dnet_state_reset(struct dnet_net_state *st, int error)
 	shutdown(st->read_s, 2);
 	shutdown(st->write_s, 2);
 
+	/* wake up producers waiting for send queue to drain, it never will */
+	pthread_cond_broadcast(&st->send_wait);
+
 	pthread_mutex_unlock(&st->send_lock);
 }
 
@@ -854,7 +915,6 @@ int dnet_setup_control_nolock(struct dnet_net_state *st)
 	return 0;
 
 err_out_unschedule:
-	dnet_unschedule_send(st);
 	dnet_unschedule_recv(st);
 
 	st->epoll_fd = -1;
@@ -927,8 +987,6 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	INIT_LIST_HEAD(&st->state_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
 
-	st->trans_root = RB_ROOT;
-	INIT_LIST_HEAD(&st->trans_list);
 
 	st->epoll_fd = -1;
 
@@ -940,6 +998,7 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	}
 
 	INIT_LIST_HEAD(&st->send_list);
+	st->send_writable = 1;
 	err = pthread_mutex_init(&st->send_lock, NULL);
 	if (err) {
 		err = -err;
@@ -1119,8 +1178,10 @@ static void dnet_state_send_clean(struct dnet_net_state *st)
 
 	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
 		list_del(&r->req_entry);
+		dnet_node_send_queue_add(st->n, -(int64_t)(r->hsize + r->dsize));
 		dnet_io_req_free(r);
 	}
+	st->send_queue_bytes = 0;
 }
 
 void dnet_state_destroy(struct dnet_net_state *st)
@@ -1133,15 +1194,22 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	}
 
 	dnet_state_clean(st);
+	dnet_trans_table_destroy(&st->trans_table);
 
 	dnet_state_send_clean(st);
 
+#ifdef HAVE_URING_SUPPORT
+	dnet_uring_state_destroy(st);
+#endif
+
 	pthread_mutex_destroy(&st->send_lock);
 	pthread_mutex_destroy(&st->trans_lock);
 
-	dnet_log(st->n, DNET_LOG_NOTICE, "Freeing state %s, socket: %d/%d, addr-num: %d.\n",
-		dnet_server_convert_dnet_addr(&st->addr), st->read_s, st->write_s, st->addr_num);
+	dnet_log(st->n, DNET_LOG_NOTICE, "Freeing state %s, socket: %d/%d, addr-num: %d, send queue peak: %llu bytes.\n",
+		dnet_server_convert_dnet_addr(&st->addr), st->read_s, st->write_s, st->addr_num,
+		(unsigned long long)st->send_queue_peak);
 
+	free(st->rcv_buf);
 	free(st->addrs);
 	free(st);
 }
@@ -1150,6 +1218,10 @@ void dnet_state_destroy(struct dnet_net_state *st)
  * Queue replies to send queue wrt high and low watermark limits.
  * This is usefull to avoid memory bloat (and hence OOM) when data gets queued
  * into send queue faster than it could be send over wire.
+ *
+ * Caller is blocked until queue drains down to low watermark, so it must
+ * be called from the producer's own thread (like network iterator),
+ * never from io pool, where it would stall unrelated requests.
  */
 int dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd,
 		void *odata, unsigned int size, int more)
@@ -1171,8 +1243,14 @@ int dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd,
 					dnet_server_convert_dnet_addr(&st->addr),
 					atomic_read(&st->send_queue_size));
 
+			/*
+			 * Queue size is decreased and low watermark is signalled under send_lock
+			 * in dnet_send_complete(), state reset and node exit wake us up too
+			 */
 			pthread_mutex_lock(&st->send_lock);
-			pthread_cond_wait(&st->send_wait, &st->send_lock);
+			while (atomic_read(&st->send_queue_size) > DNET_SEND_WATERMARK_LOW &&
+					!st->need_exit && !st->n->need_exit)
+				pthread_cond_wait(&st->send_wait, &st->send_lock);
 			pthread_mutex_unlock(&st->send_lock);
 
 			dnet_log(st->n, DNET_LOG_DEBUG, "State woken up: %s: %d",
@@ -1224,6 +1302,127 @@ int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int
 	return err;
 }
 
+/*
+ * Fill @iov with unsent parts of memory-only requests @reqs (no file part),
+ * the first request may be already partially sent, its progress is st->send_offset.
+ * @iov must have room for 2 * @num entries. Returns number of filled iovecs.
+ */
+int dnet_send_batch_iov(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, struct iovec *iov)
+{
+	struct dnet_io_req *r;
+	size_t offset = st->send_offset;
+	int i, iov_num = 0;
+
+	for (i = 0; i < num; ++i) {
+		r = reqs[i];
+
+		if (offset < r->hsize) {
+			iov[iov_num].iov_base = r->header + offset;
+			iov[iov_num].iov_len = r->hsize - offset;
+			iov_num++;
+			offset = 0;
+		} else {
+			offset -= r->hsize;
+		}
+
+		if (offset < r->dsize) {
+			iov[iov_num].iov_base = r->data + offset;
+			iov[iov_num].iov_len = r->dsize - offset;
+			iov_num++;
+		}
+
+		offset = 0;
+	}
+
+	return iov_num;
+}
+
+/*
+ * Account @sent bytes of the batch built by dnet_send_batch_iov().
+ * Returns number of completely sent requests, st->send_offset is updated
+ * to the progress of the first incomplete one.
+ */
+int dnet_send_batch_sent(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, size_t sent)
+{
+	struct dnet_io_req *r;
+	size_t left;
+	int i, done = 0;
+
+	for (i = 0; i < num; ++i) {
+		r = reqs[i];
+		left = r->hsize + r->dsize - st->send_offset;
+
+		if (sent < left) {
+			st->send_offset += sent;
+			break;
+		}
+
+		sent -= left;
+		st->send_offset = 0;
+		done++;
+	}
+
+	return done;
+}
+
+/*
+ * Send memory-only requests @reqs (no file part) with a single sendmsg() call.
+ * The first request may be already partially sent, its progress is st->send_offset.
+ *
+ * @more means there is more data queued after this batch, kernel is asked
+ * to hold partial frame until it arrives.
+ *
+ * Returns number of completely sent requests, st->send_offset is updated to the progress
+ * of the first incomplete one. Returns negative error if nothing was sent.
+ */
+int dnet_send_request_batch(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, int more)
+{
+	struct iovec iov[DNET_SEND_BATCH_MAX * 2];
+	struct msghdr msg;
+	ssize_t sent;
+	int iov_num, done;
+
+	iov_num = dnet_send_batch_iov(st, reqs, num, iov);
+	if (!iov_num) {
+		st->send_offset = 0;
+		return num;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_num;
+
+	sent = sendmsg(st->write_s, &msg, more ? MSG_MORE : 0);
+	if (sent < 0) {
+		sent = -errno;
+		if (sent != -EAGAIN) {
+			dnet_log_err(st->n, "%s: failed to send batch: requests: %d, socket: %d",
+					dnet_state_dump_addr(st), num, st->write_s);
+			st->need_exit = sent;
+		}
+		return sent;
+	}
+
+	if (sent == 0) {
+		dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n", dnet_state_dump_addr(st), st->write_s);
+		st->need_exit = -ECONNRESET;
+		return -ECONNRESET;
+	}
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "%s: sent batch: requests: %d, iovecs: %d, bytes: %zd, more: %d\n",
+			dnet_state_dump_addr(st), num, iov_num, sent, more);
+
+	done = dnet_send_batch_sent(st, reqs, num, sent);
+
+	/* flush tail of the batch, see dnet_send_request() */
+	if (done == num && !more) {
+		int nodelay = 1;
+		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
+	}
+
+	return done;
+}
+
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 {
 	int cork;
@@ -19,11 +19,159 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <signal.h>
 
 #include "elliptics.h"
 #include "elliptics/interface.h"
 
+/* thread exit: slab values are merged into node counters */
+static void dnet_counter_slab_destroy(void *data)
+{
+	struct dnet_counter_slab *slab = data;
+	struct dnet_node *n = slab->n;
+	int i, j;
+
+	pthread_mutex_lock(&n->counters_lock);
+	for (i = 0; i < __DNET_CNTR_MAX; ++i) {
+		n->counters[i].count += slab->counters[i].count;
+		n->counters[i].err += slab->counters[i].err;
+	}
+	for (i = 0; i < DNET_LATENCY_HIST_NUM; ++i) {
+		for (j = 0; j < DNET_LATENCY_BUCKETS; ++j)
+			n->latency[i][j] += slab->latency[i][j];
+	}
+	list_del(&slab->slab_entry);
+	pthread_mutex_unlock(&n->counters_lock);
+
+	free(slab);
+}
+
+int dnet_counter_init(struct dnet_node *n)
+{
+	int err;
+
+	memset(&n->counters, 0, __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
+	memset(&n->latency, 0, sizeof(n->latency));
+	INIT_LIST_HEAD(&n->counters_slabs);
+
+	err = pthread_mutex_init(&n->counters_lock, NULL);
+	if (err)
+		return -err;
+
+	err = pthread_key_create(&n->counters_key, dnet_counter_slab_destroy);
+	if (err) {
+		pthread_mutex_destroy(&n->counters_lock);
+		return -err;
+	}
+
+	return 0;
+}
+
+void dnet_counter_destroy(struct dnet_node *n)
+{
+	struct dnet_counter_slab *slab, *tmp;
+
+	pthread_key_delete(n->counters_key);
+
+	list_for_each_entry_safe(slab, tmp, &n->counters_slabs, slab_entry) {
+		list_del(&slab->slab_entry);
+		free(slab);
+	}
+
+	pthread_mutex_destroy(&n->counters_lock);
+}
+
+struct dnet_counter_slab *dnet_counter_slab(struct dnet_node *n)
+{
+	struct dnet_counter_slab *slab;
+
+	slab = pthread_getspecific(n->counters_key);
+	if (slab)
+		return slab;
+
+	slab = malloc(sizeof(struct dnet_counter_slab));
+	if (!slab)
+		return NULL;
+
+	memset(slab, 0, sizeof(struct dnet_counter_slab));
+	slab->n = n;
+
+	if (pthread_setspecific(n->counters_key, slab)) {
+		free(slab);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&n->counters_lock);
+	list_add_tail(&slab->slab_entry, &n->counters_slabs);
+	pthread_mutex_unlock(&n->counters_lock);
+
+	return slab;
+}
+
+void dnet_counter_add_locked(struct dnet_node *n, int counter, uint64_t count, uint64_t err)
+{
+	pthread_mutex_lock(&n->counters_lock);
+	n->counters[counter].count += count;
+	n->counters[counter].err += err;
+	pthread_mutex_unlock(&n->counters_lock);
+}
+
+void dnet_counter_latency_locked(struct dnet_node *n, int hist, int bucket)
+{
+	pthread_mutex_lock(&n->counters_lock);
+	n->latency[hist][bucket]++;
+	pthread_mutex_unlock(&n->counters_lock);
+}
+
+/*
+ * Sums node counters and all thread slabs. Slabs are updated by their owners
+ * without locks, so the result is a snapshot accurate to in-flight updates.
+ */
+void dnet_counter_read(struct dnet_node *n, struct dnet_stat_count *counters)
+{
+	struct dnet_counter_slab *slab;
+	int i;
+
+	pthread_mutex_lock(&n->counters_lock);
+	memcpy(counters, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
+
+	list_for_each_entry(slab, &n->counters_slabs, slab_entry) {
+		for (i = 0; i < __DNET_CNTR_MAX; ++i) {
+			counters[i].count += slab->counters[i].count;
+			counters[i].err += slab->counters[i].err;
+		}
+	}
+	pthread_mutex_unlock(&n->counters_lock);
+}
+
+/* fills header and histograms of the latency part of STAT_COUNT reply */
+void dnet_counter_read_latency(struct dnet_node *n, struct dnet_latency_stat *ls)
+{
+	struct dnet_counter_slab *slab;
+	uint64_t hist[DNET_LATENCY_HIST_NUM][DNET_LATENCY_BUCKETS];
+	int i, j;
+
+	ls->cmd_num = __DNET_CMD_MAX;
+	ls->bucket_num = DNET_LATENCY_BUCKETS;
+	ls->stage_num = __DNET_STAGE_MAX;
+	ls->reserved = 0;
+
+	pthread_mutex_lock(&n->counters_lock);
+	memcpy(hist, n->latency, sizeof(hist));
+
+	list_for_each_entry(slab, &n->counters_slabs, slab_entry) {
+		for (i = 0; i < DNET_LATENCY_HIST_NUM; ++i) {
+			for (j = 0; j < DNET_LATENCY_BUCKETS; ++j)
+				hist[i][j] += slab->latency[i][j];
+		}
+	}
+	pthread_mutex_unlock(&n->counters_lock);
+
+	/* reply is packed, histograms are summed in aligned storage */
+	memcpy(ls->hist, hist, sizeof(hist));
+}
+
 static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 {
 	struct dnet_node *n;
@@ -36,6 +184,9 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 	memset(n, 0, sizeof(struct dnet_node));
 
 	atomic_init(&n->trans, 0);
+	dnet_route_init(n);
+	n->slow_log_fd = -1;
+	n->trace_fd = -1;
 
 	err = dnet_log_init(n, cfg->log);
 	if (err)
@@ -66,14 +217,35 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 		goto err_out_destroy_counter;
 	}
 
+	err = pthread_cond_init(&n->iterator_wait, NULL);
+	if (err) {
+		err = -err;
+		dnet_log_err(n, "Failed to initialize iterator wait condition: err: %d", err);
+		goto err_out_destroy_reconnect_lock;
+	}
+
 	err = pthread_attr_init(&n->attr);
 	if (err) {
 		err = -err;
 		dnet_log_err(n, "Failed to initialize pthread attributes: err: %d", err);
-		goto err_out_destroy_reconnect_lock;
+		goto err_out_destroy_iterator_wait;
 	}
 	pthread_attr_setdetachstate(&n->attr, PTHREAD_CREATE_DETACHED);
 
+	err = dnet_lock_init(&n->send_queue_lock);
+	if (err) {
+		dnet_log_err(n, "Failed to initialize send queue lock: err: %d", err);
+		goto err_out_destroy_attr;
+	}
+
+	err = dnet_trans_timer_init(n);
+	if (err)
+		goto err_out_destroy_send_queue_lock;
+
+	err = dnet_trans_pool_init(n);
+	if (err)
+		goto err_out_destroy_timer;
+
 	n->autodiscovery_socket = -1;
 
 	INIT_LIST_HEAD(&n->group_list);
@@ -81,6 +253,7 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 	INIT_LIST_HEAD(&n->storage_state_list);
 	INIT_LIST_HEAD(&n->reconnect_list);
 	INIT_LIST_HEAD(&n->iterator_list);
+	INIT_LIST_HEAD(&n->iterator_jobs);
 
 	INIT_LIST_HEAD(&n->check_entry);
 
@@ -88,6 +261,14 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 
 	return n;
 
+err_out_destroy_timer:
+	dnet_trans_timer_cleanup(n);
+err_out_destroy_send_queue_lock:
+	dnet_lock_destroy(&n->send_queue_lock);
+err_out_destroy_attr:
+	pthread_attr_destroy(&n->attr);
+err_out_destroy_iterator_wait:
+	pthread_cond_destroy(&n->iterator_wait);
 err_out_destroy_reconnect_lock:
 	pthread_mutex_destroy(&n->reconnect_lock);
 err_out_destroy_counter:
@@ -172,6 +353,8 @@ static void dnet_idc_remove_ids(struct dnet_net_state *st, struct dnet_group *g)
 	st->idc = NULL;
 }
 
+static void dnet_route_update_nolock(struct dnet_node *n);
+
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num)
 {
 	struct dnet_node *n = st->n;
@@ -249,6 +432,7 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	if (err)
 		goto err_out_remove_nolock;
 
+	dnet_route_update_nolock(n);
 	pthread_mutex_unlock(&n->state_lock);
 
 	gettimeofday(&end, NULL);
@@ -306,98 +490,261 @@ void dnet_idc_destroy_nolock(struct dnet_net_state *st)
 	dnet_idc_remove_ids(st, g);
 	dnet_group_put(g);
 	free(idc);
+
+	dnet_route_update_nolock(st->n);
 }
 
-static int __dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
+static inline uint64_t dnet_route_prefix(const unsigned char *id)
 {
-	int low, high, i, cmp;
-	struct dnet_state_id *sid;
+	uint64_t prefix = 0;
+	int i;
+
+	for (i = 0; i < (int)sizeof(uint64_t); ++i)
+		prefix = (prefix << 8) | id[i];
+
+	return prefix;
+}
 
-	for (low = -1, high = g->id_num; high-low > 1; ) {
+/*
+ * Returns position of the last id not bigger than given one,
+ * or the last id in the ring if all of them are bigger.
+ */
+static int __dnet_idc_search(struct dnet_route_group *g, struct dnet_id *id)
+{
+	uint64_t key = dnet_route_prefix(id->id);
+	int low, high, i;
+
+	low = g->jump[id->id[0]];
+	high = g->jump[id->id[0] + 1];
+
+	while (low < high) {
 		i = low + (high - low)/2;
-		sid = &g->ids[i];
 
-		cmp = dnet_id_cmp_str(sid->raw.id, id->id);
-		if (cmp < 0)
-			low = i;
-		else if (cmp > 0)
-			high = i;
+		if (g->prefix[i] < key)
+			low = i + 1;
 		else
-			goto out;
+			high = i;
 	}
-	i = high - 1;
 
-out:
-	if (i == -1)
+	for (i = low; i < g->id_num && g->prefix[i] == key; ++i) {
+		if (dnet_id_cmp_str(g->ids[i].raw.id, id->id) > 0)
+			break;
+	}
+
+	if (--i == -1)
 		i = g->id_num - 1;
 
 	return i;
 }
 
-static struct dnet_state_id *dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
+static __thread int dnet_route_slot = -1;
+static int dnet_route_slot_next;
+
+void dnet_route_init(struct dnet_node *n)
 {
-	return &g->ids[__dnet_idc_search(g, id)];
+	int i;
+
+	for (i = 0; i < DNET_ROUTE_READERS; ++i) {
+		atomic_init(&n->route.readers[i].count[0], 0);
+		atomic_init(&n->route.readers[i].count[1], 0);
+	}
 }
 
-static int dnet_search_range_nolock(struct dnet_node *n, struct dnet_id *id, struct dnet_raw_id *start, struct dnet_raw_id *next)
+void dnet_route_cleanup(struct dnet_node *n)
 {
-	struct dnet_state_id *sid;
-	struct dnet_group *group;
-	int idc_pos;
+	free(n->route.table);
+	n->route.table = NULL;
+}
 
-	group = dnet_group_search(n, id->group_id);
-	if (!group)
-		return -ENXIO;
+/*
+ * Enters read section and returns current snapshot (which may be NULL),
+ * it stays valid until dnet_route_read_unlock(). Must not block inside.
+ */
+static struct dnet_route_table *dnet_route_read_lock(struct dnet_node *n, atomic_t **cnt)
+{
+	if (dnet_route_slot < 0)
+		dnet_route_slot = __sync_fetch_and_add(&dnet_route_slot_next, 1) % DNET_ROUTE_READERS;
 
-	idc_pos = __dnet_idc_search(group, id);
-	sid = &group->ids[idc_pos];
-	memcpy(start, &sid->raw, sizeof(struct dnet_raw_id));
+	*cnt = &n->route.readers[dnet_route_slot].count[*(volatile int *)&n->route.epoch & 1];
+	atomic_inc(*cnt);
+	__sync_synchronize();
 
-	if (++idc_pos >= group->id_num)
-		idc_pos = 0;
-	sid = &group->ids[idc_pos];
-	memcpy(next, &sid->raw, sizeof(struct dnet_raw_id));
+	return *(struct dnet_route_table * volatile *)&n->route.table;
+}
 
-	dnet_group_put(group);
+static void dnet_route_read_unlock(atomic_t *cnt)
+{
+	__sync_synchronize();
+	atomic_dec(cnt);
+}
 
-	return 0;
+static void dnet_route_wait_readers(struct dnet_node *n, int idx)
+{
+	int i;
+
+	for (i = 0; i < DNET_ROUTE_READERS; ++i) {
+		while (atomic_read(&n->route.readers[i].count[idx]))
+			sched_yield();
+	}
 }
 
-int dnet_search_range(struct dnet_node *n, struct dnet_id *id, struct dnet_raw_id *start, struct dnet_raw_id *next)
+/*
+ * Waits until every reader, which could have seen previous snapshot, leaves its read section.
+ * Epoch is flipped twice, since reader could sample epoch before the first flip
+ * and increment its counter after we have already waited for it.
+ */
+static void dnet_route_synchronize(struct dnet_node *n)
 {
-	int err;
+	int idx, i;
 
-	pthread_mutex_lock(&n->state_lock);
-	err = dnet_search_range_nolock(n, id, start, next);
-	pthread_mutex_unlock(&n->state_lock);
+	for (i = 0; i < 2; ++i) {
+		__sync_synchronize();
+		idx = n->route.epoch & 1;
+		*(volatile int *)&n->route.epoch = n->route.epoch + 1;
+		__sync_synchronize();
 
-	return err;
+		dnet_route_wait_readers(n, idx);
+	}
+}
+
+static struct dnet_route_group *dnet_route_group_search(struct dnet_route_table *t, unsigned int group_id)
+{
+	struct dnet_route_group *g;
+	unsigned int pos;
+
+	for (pos = (group_id * 2654435761U) & t->hash_mask; (g = t->hash[pos]); pos = (pos + 1) & t->hash_mask) {
+		if (g->group_id == group_id)
+			return g;
+	}
+
+	return NULL;
 }
 
-static struct dnet_state_id *__dnet_state_search_id(struct dnet_node *n, struct dnet_id *id)
+/* must be called under n->state_lock */
+static struct dnet_route_table *dnet_route_table_create(struct dnet_node *n)
 {
-	struct dnet_state_id *sid;
-	struct dnet_group *group;
+	struct dnet_route_table *t;
+	struct dnet_route_group *rg;
+	struct dnet_route_id *rid;
+	struct dnet_group *g;
+	uint64_t *prefix;
+	unsigned int hash_size = 8, pos;
+	int group_num = 0, id_num = 0, i, b;
+	size_t size;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (g->id_num) {
+			group_num++;
+			id_num += g->id_num;
+		}
+	}
 
-	group = dnet_group_search(n, id->group_id);
-	if (!group)
+	/* keep open addressing hash at most half full */
+	while (hash_size < (unsigned int)group_num * 2)
+		hash_size <<= 1;
+
+	size = sizeof(struct dnet_route_table) + group_num * sizeof(struct dnet_route_group) +
+		hash_size * sizeof(struct dnet_route_group *) +
+		id_num * (sizeof(struct dnet_route_id) + sizeof(uint64_t));
+
+	t = malloc(size);
+	if (!t)
 		return NULL;
 
-	sid = dnet_idc_search(group, id);
+	memset(t, 0, size);
+
+	t->version = ++n->route.version;
+	t->hash_mask = hash_size - 1;
+	t->group_num = group_num;
+	t->hash = (struct dnet_route_group **)&t->groups[group_num];
+
+	rid = (struct dnet_route_id *)&t->hash[hash_size];
+	prefix = (uint64_t *)&rid[id_num];
+	rg = t->groups;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (!g->id_num)
+			continue;
 
-	dnet_group_put(group);
+		rg->group_id = g->group_id;
+		rg->id_num = g->id_num;
+		rg->ids = rid;
+		rg->prefix = prefix;
 
-	return sid;
+		for (i = 0, b = 0; i < g->id_num; ++i) {
+			memcpy(&rid[i].raw, &g->ids[i].raw, sizeof(struct dnet_raw_id));
+			rid[i].st = g->ids[i].idc->st;
+			prefix[i] = dnet_route_prefix(rid[i].raw.id);
+
+			while (b <= rid[i].raw.id[0])
+				rg->jump[b++] = i;
+		}
+		while (b <= 256)
+			rg->jump[b++] = g->id_num;
+
+		rid += g->id_num;
+		prefix += g->id_num;
+
+		for (pos = (g->group_id * 2654435761U) & t->hash_mask; t->hash[pos]; pos = (pos + 1) & t->hash_mask)
+			;
+		t->hash[pos] = rg;
+
+		rg++;
+	}
+
+	return t;
 }
 
-static struct dnet_net_state *__dnet_state_search(struct dnet_node *n, struct dnet_id *id)
+/*
+ * Publishes new route table snapshot, must be called under n->state_lock after every
+ * group ids change. If snapshot can not be allocated, lookups fail until next update,
+ * since old one may point to states which are about to be freed.
+ */
+static void dnet_route_update_nolock(struct dnet_node *n)
 {
-	struct dnet_state_id *sid = __dnet_state_search_id(n, id);
+	struct dnet_route_table *old = n->route.table, *t;
 
-	if (!sid)
-		return NULL;
+	t = dnet_route_table_create(n);
+	if (!t)
+		dnet_log(n, DNET_LOG_ERROR, "Failed to allocate route table, routing is disabled until next update.\n");
+	else
+		dnet_log(n, DNET_LOG_DEBUG, "Route table updated: version: %llu, groups: %d.\n",
+				(unsigned long long)t->version, t->group_num);
+
+	__sync_synchronize();
+	*(struct dnet_route_table * volatile *)&n->route.table = t;
+
+	dnet_route_synchronize(n);
+	free(old);
+}
 
-	return dnet_state_get(sid->idc->st);
+int dnet_search_range(struct dnet_node *n, struct dnet_id *id, struct dnet_raw_id *start, struct dnet_raw_id *next)
+{
+	struct dnet_route_table *t;
+	struct dnet_route_group *g;
+	atomic_t *cnt;
+	int idc_pos, err = -ENXIO;
+
+	t = dnet_route_read_lock(n, &cnt);
+	if (!t)
+		goto err_out_unlock;
+
+	g = dnet_route_group_search(t, id->group_id);
+	if (!g)
+		goto err_out_unlock;
+
+	idc_pos = __dnet_idc_search(g, id);
+	memcpy(start, &g->ids[idc_pos].raw, sizeof(struct dnet_raw_id));
+
+	if (++idc_pos >= g->id_num)
+		idc_pos = 0;
+	memcpy(next, &g->ids[idc_pos].raw, sizeof(struct dnet_raw_id));
+
+	err = 0;
+
+err_out_unlock:
+	dnet_route_read_unlock(cnt);
+	return err;
 }
 
 struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dnet_addr *addr)
@@ -423,23 +770,29 @@ struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dne
 	return found;
 }
 
+/*
+ * Route table is read without n->state_lock, name is kept for callers,
+ * which may still hold it for their own list walks.
+ */
 struct dnet_net_state *dnet_state_search_nolock(struct dnet_node *n, struct dnet_id *id)
 {
-	struct dnet_net_state *found;
+	struct dnet_net_state *found = NULL;
+	struct dnet_route_table *t;
+	struct dnet_route_group *g;
+	atomic_t *cnt;
 
-	found = __dnet_state_search(n, id);
-	if (!found) {
-		struct dnet_group *g;
+	t = dnet_route_read_lock(n, &cnt);
+	if (!t)
+		goto err_out_unlock;
 
-		g = dnet_group_search(n, id->group_id);
-		if (!g)
-			goto err_out_exit;
+	g = dnet_route_group_search(t, id->group_id);
+	if (!g)
+		goto err_out_unlock;
 
-		found = dnet_state_get(g->ids[0].idc->st);
-		dnet_group_put(g);
-	}
+	found = dnet_state_get(g->ids[__dnet_idc_search(g, id)].st);
 
-err_out_exit:
+err_out_unlock:
+	dnet_route_read_unlock(cnt);
 	return found;
 }
 
@@ -447,15 +800,12 @@ struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id
 {
 	struct dnet_net_state *found;
 
-	pthread_mutex_lock(&n->state_lock);
 	found = dnet_state_search_nolock(n, id);
 	if (found == n->st) {
 		dnet_state_put(found);
 		found = NULL;
 	}
 
-	pthread_mutex_unlock(&n->state_lock);
-
 	return found;
 }
 void dnet_state_put(struct dnet_net_state *st)
@@ -473,18 +823,13 @@ void dnet_state_put(struct dnet_net_state *st)
  */
 struct dnet_net_state *dnet_node_state(struct dnet_node *n)
 {
-	struct dnet_net_state *found;
-
-	pthread_mutex_lock(&n->state_lock);
-	found = dnet_state_search_nolock(n, &n->id);
-	pthread_mutex_unlock(&n->state_lock);
-
-	return found;
+	return dnet_state_search_nolock(n, &n->id);
 }
 
 struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 {
 	struct dnet_node *n;
+	int log_ring_size;
 	int err = -ENOMEM;
 
 	sigset_t previous_sigset;
@@ -553,7 +898,12 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	n->removal_delay = cfg->removal_delay;
 	n->flags = cfg->flags;
 	n->cache_size = cfg->cache_size;
+	n->iterator_threads_max = cfg->io_thread_num;
+	n->cache_policy = cfg->cache_policy;
 	n->indexes_shard_count = cfg->indexes_shard_count;
+	n->send_limit = cfg->send_limit;
+	n->node_send_limit = cfg->node_send_limit;
+	n->slow_request_threshold = cfg->slow_request_threshold * 1000L;
 
 	if (!n->log)
 		dnet_log_init(n, cfg->log);
@@ -593,6 +943,12 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 				n->indexes_shard_count);
 	}
 
+	if (n->slow_request_threshold && cfg->slow_log) {
+		n->slow_log_fd = open(cfg->slow_log, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (n->slow_log_fd < 0)
+			dnet_log_err(n, "Failed to open slow request log '%s', using node log", cfg->slow_log);
+	}
+
 	err = dnet_crypto_init(n);
 	if (err)
 		goto err_out_free;
@@ -605,10 +961,24 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	if (err)
 		goto err_out_io_exit;
 
+	/* trace spans are written by log thread, so tracing needs log ring */
+	log_ring_size = cfg->log_ring_size;
+	if (cfg->trace_sample_rate > 0) {
+		n->trace_sample_rate = cfg->trace_sample_rate;
+		if (log_ring_size <= 0)
+			log_ring_size = DNET_LOG_RING_DEFAULT_SIZE;
+	}
+
+	err = dnet_log_thread_start(n, log_ring_size);
+	if (err)
+		goto err_out_check_stop;
+
 	dnet_log(n, DNET_LOG_DEBUG, "New node has been created.\n");
 	pthread_sigmask(SIG_SETMASK, &previous_sigset, NULL);
 	return n;
 
+err_out_check_stop:
+	dnet_check_thread_stop(n);
 err_out_io_exit:
 	dnet_io_exit(n);
 err_out_crypto_cleanup:
@@ -639,14 +1009,47 @@ void dnet_set_need_exit(struct dnet_node *n)
 void dnet_node_cleanup_common_resources(struct dnet_node *n)
 {
 	struct dnet_addr_storage *it, *atmp;
+	struct dnet_iterator_job *job, *jtmp;
+	struct dnet_net_state *st;
 
 	n->need_exit = 1;
 	dnet_iterator_cancel_all(n);
+
+	/* wake up iterators throttled on send queues, they check need_exit under send_lock */
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(st, &n->storage_state_list, storage_state_entry) {
+		pthread_mutex_lock(&st->send_lock);
+		pthread_cond_broadcast(&st->send_wait);
+		pthread_mutex_unlock(&st->send_lock);
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	/* iterator threads are detached, they notice need_exit or cancel and exit */
+	pthread_mutex_lock(&n->iterator_lock);
+	while (n->iterator_threads > 0)
+		pthread_cond_wait(&n->iterator_wait, &n->iterator_lock);
+	pthread_mutex_unlock(&n->iterator_lock);
+
+	/* iterators which have not been started yet are dropped */
+	list_for_each_entry_safe(job, jtmp, &n->iterator_jobs, job_entry) {
+		list_del(&job->job_entry);
+		dnet_state_put(job->st);
+		free(job);
+	}
+
 	dnet_check_thread_stop(n);
 
 	dnet_io_exit(n);
+	dnet_log_thread_stop(n);
+
+	n->trace_sample_rate = 0;
+	if (n->trace_fd >= 0)
+		close(n->trace_fd);
 
 	pthread_attr_destroy(&n->attr);
+	pthread_cond_destroy(&n->iterator_wait);
+	dnet_lock_destroy(&n->send_queue_lock);
+	dnet_trans_timer_cleanup(n);
 
 	pthread_mutex_destroy(&n->state_lock);
 	dnet_crypto_cleanup(n);
@@ -661,6 +1064,13 @@ void dnet_node_cleanup_common_resources(struct dnet_node *n)
 	dnet_wait_put(n->wait);
 
 	close(n->autodiscovery_socket);
+
+	if (n->slow_log_fd >= 0)
+		close(n->slow_log_fd);
+
+	/* all transactions are destroyed by now, their memory goes back here */
+	dnet_trans_pool_cleanup(n);
+	dnet_route_cleanup(n);
 }
 
 void dnet_node_destroy(struct dnet_node *n)
@@ -831,6 +1241,29 @@ void dnet_set_timeouts(struct dnet_node *n, int wait_timeout, int check_timeout)
 	n->check_timeout = check_timeout;
 }
 
+int dnet_node_set_trace_file(struct dnet_node *n, const char *file)
+{
+	int fd, err;
+
+	if (n->trace_fd >= 0) {
+		err = -EEXIST;
+		goto err_out_exit;
+	}
+
+	fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		dnet_log_err(n, "Failed to open trace file '%s'", file);
+		goto err_out_exit;
+	}
+
+	n->trace_fd = fd;
+	return 0;
+
+err_out_exit:
+	return err;
+}
+
 struct dnet_node *dnet_session_get_node(struct dnet_session *s)
 {
 	return s->node;
@@ -13,12 +13,20 @@
  * GNU General Public License for more details.
  */
 
+/* splice flags and pipe2() used by io_uring network engine */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/stat.h>
 
+#include <netinet/tcp.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 
 #include "elliptics.h"
@@ -30,6 +38,8 @@ static char *dnet_work_io_mode_string[] = {
 };
 
 __thread uint32_t trace_id = 0;
+__thread struct timeval dnet_io_recv_time;
+__thread int dnet_trace_sampled;
 
 static char *dnet_work_io_mode_str(int mode)
 {
@@ -39,26 +49,61 @@ static char *dnet_work_io_mode_str(int mode)
 	return dnet_work_io_mode_string[mode];
 }
 
+static void dnet_work_io_wakeup(struct dnet_work_io *wio)
+{
+	pthread_mutex_lock(&wio->lock);
+	wio->wakeup = 1;
+	pthread_cond_signal(&wio->wait);
+	pthread_mutex_unlock(&wio->lock);
+}
+
+static void dnet_work_io_free(struct dnet_work_io *wio)
+{
+	struct dnet_io_req *r, *tmp;
+
+	list_for_each_entry_safe(r, tmp, &wio->list, req_entry) {
+		list_del(&r->req_entry);
+		dnet_io_req_free(r);
+	}
+
+	pthread_cond_destroy(&wio->wait);
+	pthread_mutex_destroy(&wio->lock);
+	free(wio);
+}
+
 static void dnet_work_pool_cleanup(struct dnet_work_pool *pool)
 {
 	struct dnet_io_req *r, *tmp;
 	struct dnet_work_io *wio, *wio_tmp;
+	struct dnet_work_trans *t;
+	struct hlist_node *pos, *hpos;
+	int i;
+
+	/* threads sleep without timeout, kick them to notice @need_exit */
+	list_for_each_entry(wio, &pool->wio_list, wio_entry)
+		dnet_work_io_wakeup(wio);
 
 	list_for_each_entry_safe(wio, wio_tmp, &pool->wio_list, wio_entry) {
 		pthread_join(wio->tid, NULL);
 		list_del(&wio->wio_entry);
-		free(wio);
+		dnet_work_io_free(wio);
 	}
 
 
-	list_for_each_entry_safe(r, tmp, &pool->list, req_entry) {
-		list_del(&r->req_entry);
-		dnet_io_req_free(r);
+	for (i = 0; i < DNET_WORK_TRANS_HASH_SIZE; ++i) {
+		hlist_for_each_entry_safe(t, pos, hpos, &pool->trans_hash[i], hash_entry) {
+			list_for_each_entry_safe(r, tmp, &t->list, req_entry) {
+				list_del(&r->req_entry);
+				dnet_io_req_free(r);
+			}
+
+			hlist_del(&t->hash_entry);
+			free(t);
+		}
 	}
 
-	pthread_cond_destroy(&pool->wait);
 	pthread_mutex_destroy(&pool->lock);
-	free(pool->trans);
+	free(pool->wio);
 	free(pool);
 }
 
@@ -66,26 +111,58 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 {
 	int i, err;
 	struct dnet_work_io *wio, *tmp;
+	struct dnet_work_io **wios;
 
 	pthread_mutex_lock(&pool->lock);
 
-	pool->trans = realloc(pool->trans, sizeof(uint64_t) * (pool->num + num));
+	wios = realloc(pool->wio, sizeof(struct dnet_work_io *) * (pool->num + num));
+	if (!wios) {
+		err = -ENOMEM;
+		goto err_out_unlock;
+	}
+	pool->wio = wios;
 
+	/*
+	 * Every queue has to be ready before the first thread starts,
+	 * since threads steal from each other
+	 */
 	for (i = 0; i < num; ++i) {
 		wio = malloc(sizeof(struct dnet_work_io));
 		if (!wio) {
 			err = -ENOMEM;
-			goto err_out_io_threads;
+			goto err_out_free_queues;
 		}
 
-		wio->thread_index = i;
+		memset(wio, 0, sizeof(struct dnet_work_io));
+
+		wio->thread_index = pool->num + i;
 		wio->pool = pool;
+		INIT_LIST_HEAD(&wio->list);
+		list_stat_init(&wio->list_stats);
+
+		err = pthread_mutex_init(&wio->lock, NULL);
+		if (err) {
+			free(wio);
+			err = -err;
+			goto err_out_free_queues;
+		}
+
+		err = pthread_cond_init(&wio->wait, NULL);
+		if (err) {
+			pthread_mutex_destroy(&wio->lock);
+			free(wio);
+			err = -err;
+			goto err_out_free_queues;
+		}
+
+		pool->wio[pool->num + i] = wio;
+	}
 
-		pool->trans[pool->num + i] = ~0ULL;
+	for (i = 0; i < num; ++i) {
+		wio = pool->wio[pool->num + i];
 
 		err = pthread_create(&wio->tid, NULL, process, wio);
 		if (err) {
-			free(wio);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create IO thread: %d\n", err);
 			goto err_out_io_threads;
@@ -104,11 +181,15 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 
 err_out_io_threads:
 	list_for_each_entry_safe(wio, tmp, &pool->wio_list, wio_entry) {
+		dnet_work_io_wakeup(wio);
 		pthread_join(wio->tid, NULL);
 		list_del(&wio->wio_entry);
-		free(wio);
 	}
-
+	i = num;
+err_out_free_queues:
+	while (--i >= 0)
+		dnet_work_io_free(pool->wio[pool->num + i]);
+err_out_unlock:
 	pthread_mutex_unlock(&pool->lock);
 
 	return err;
@@ -117,7 +198,7 @@ err_out_io_threads:
 static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int mode, void *(* process)(void *))
 {
 	struct dnet_work_pool *pool;
-	int err;
+	int err, i;
 
 	pool = malloc(sizeof(struct dnet_work_pool));
 	if (!pool) {
@@ -130,8 +211,11 @@ static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num,
 	pool->num = 0;
 	pool->mode = mode;
 	pool->n = n;
-	INIT_LIST_HEAD(&pool->list);
+	atomic_init(&pool->pos, 0);
+	INIT_LIST_HEAD(&pool->ready_list);
 	list_stat_init(&pool->list_stats);
+	for (i = 0; i < DNET_WORK_TRANS_HASH_SIZE; ++i)
+		INIT_HLIST_HEAD(&pool->trans_hash[i]);
 	INIT_LIST_HEAD(&pool->wio_list);
 
 	err = pthread_mutex_init(&pool->lock, NULL);
@@ -140,22 +224,15 @@ static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num,
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&pool->wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_mutex_destroy;
-	}
-
 	err = dnet_work_pool_grow(n, pool, num, process);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_mutex_destroy;
 
 	return pool;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&pool->wait);
 err_out_mutex_destroy:
 	pthread_mutex_destroy(&pool->lock);
+	free(pool->wio);
 err_out_free:
 	free(pool);
 err_out_exit:
@@ -163,28 +240,118 @@ err_out_exit:
 }
 
 /* As an example (with hardcoded loglevel and one second interval) */
-static inline void list_stat_log(struct list_stat *st, struct dnet_node *node, const char *list_name) {
+static inline void list_stat_log(struct list_stat *st, struct dnet_node *node, const char *list_name, int index) {
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 
 	if ((tv.tv_sec - st->time_base.tv_sec) >= 1) {
 		double elapsed_seconds = (double)(tv.tv_sec - st->time_base.tv_sec) * 1000000 + (tv.tv_usec - st->time_base.tv_usec);
 		elapsed_seconds /= 1000000;
-		dnet_log(node, DNET_LOG_INFO, "%s report: elapsed: %.3f s, current size: %ld, min: %ld, max: %ld, volume: %ld\n",
-			list_name, elapsed_seconds, st->list_size, st->min_list_size, st->max_list_size, st->volume);
+		dnet_log(node, DNET_LOG_INFO, "%s %d report: elapsed: %.3f s, current size: %ld, min: %ld, max: %ld, volume: %ld\n",
+			list_name, index, elapsed_seconds, st->list_size, st->min_list_size, st->max_list_size, st->volume);
 
 		list_stat_reset(st, &tv);
 	}
 }
 
+/*
+ * Wake up the first idle thread starting from @start (if any),
+ * it will pick up a reply or steal a command from the busy thread.
+ */
+static void dnet_work_pool_kick(struct dnet_work_pool *pool, int start)
+{
+	struct dnet_work_io *wio;
+	int i;
+
+	for (i = 0; i < pool->num; ++i) {
+		wio = pool->wio[(start + i) % pool->num];
+
+		if (wio->idle) {
+			dnet_work_io_wakeup(wio);
+			break;
+		}
+	}
+}
+
+static inline struct hlist_head *dnet_work_trans_bucket(struct dnet_work_pool *pool, uint64_t tid)
+{
+	return &pool->trans_hash[(tid ^ (tid >> 32)) & (DNET_WORK_TRANS_HASH_SIZE - 1)];
+}
+
+static struct dnet_work_trans *dnet_work_trans_search(struct dnet_work_pool *pool, uint64_t tid)
+{
+	struct dnet_work_trans *t;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(t, pos, dnet_work_trans_bucket(pool, tid), hash_entry) {
+		if (t->tid == tid)
+			return t;
+	}
+
+	return NULL;
+}
+
+/*
+ * Queue transaction reply into its transaction group.
+ *
+ * Returns 1 when there is no group and reply is the last one
+ * (or group can not be allocated) - such reply can be processed
+ * by any thread just like a plain command.
+ */
+static int dnet_work_pool_queue_reply(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
+	struct dnet_work_trans *t;
+	int kick;
+
+	pthread_mutex_lock(&pool->lock);
+
+	t = dnet_work_trans_search(pool, tid);
+	if (!t) {
+		if (!(cmd->flags & DNET_FLAGS_MORE)) {
+			pthread_mutex_unlock(&pool->lock);
+			return 1;
+		}
+
+		t = malloc(sizeof(struct dnet_work_trans));
+		if (!t) {
+			pthread_mutex_unlock(&pool->lock);
+			dnet_log(pool->n, DNET_LOG_ERROR, "%s: %s: failed to allocate reply group, trans: %llu\n",
+				dnet_state_dump_addr(r->st), dnet_dump_id(&cmd->id), (unsigned long long)tid);
+			return 1;
+		}
+
+		t->tid = tid;
+		t->owner = NULL;
+		INIT_LIST_HEAD(&t->list);
+		hlist_add_head(&t->hash_entry, dnet_work_trans_bucket(pool, tid));
+		list_add_tail(&t->ready_entry, &pool->ready_list);
+	}
+
+	list_add_tail(&r->req_entry, &t->list);
+	list_stat_size_increase(&pool->list_stats, 1);
+	list_stat_log(&pool->list_stats, r->st->n, "input reply queue", pool->mode);
+
+	/* owner will put group back into ready list when it completes current reply */
+	kick = !t->owner;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (kick)
+		dnet_work_pool_kick(pool, 0);
+
+	return 0;
+}
 
 static void *dnet_io_process(void *data_);
 static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 {
 	struct dnet_io *io = n->io;
 	struct dnet_work_pool *pool = io->recv_pool;
+	struct dnet_work_io *wio;
 	struct dnet_cmd *cmd = r->header;
 	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
+	int pos, idle;
 
 	if (cmd->size > 0) {
 		dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: RECV cmd: %s: cmd-size: %llu, nonblocking: %d\n",
@@ -205,14 +372,195 @@ static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 	if (nonblocking)
 		pool = io->recv_pool_nb;
 
-	pthread_mutex_lock(&pool->lock);
-	list_add_tail(&r->req_entry, &pool->list);
-	list_stat_size_increase(&pool->list_stats, 1);
-	list_stat_log(&pool->list_stats, r->st->n, "input io queue");
-	pthread_cond_signal(&pool->wait);
-	pthread_mutex_unlock(&pool->lock);
+	if ((cmd->trans & DNET_TRANS_REPLY) && !dnet_work_pool_queue_reply(pool, r))
+		return;
+
+	/*
+	 * Commands are spread over per-thread queues, so that network threads
+	 * and IO threads do not contend on the single pool lock
+	 */
+	pos = (unsigned int)atomic_inc(&pool->pos) % pool->num;
+	wio = pool->wio[pos];
+
+	pthread_mutex_lock(&wio->lock);
+	list_add_tail(&r->req_entry, &wio->list);
+	list_stat_size_increase(&wio->list_stats, 1);
+	list_stat_log(&wio->list_stats, r->st->n, "input io queue", wio->thread_index);
+
+	idle = wio->idle;
+	if (idle) {
+		wio->wakeup = 1;
+		pthread_cond_signal(&wio->wait);
+	}
+	pthread_mutex_unlock(&wio->lock);
+
+	if (!idle)
+		dnet_work_pool_kick(pool, pos + 1);
+}
+
+
+/*
+ * Receive buffer cache. Sizes include dnet_recv_buf, dnet_io_req and dnet_cmd headers,
+ * the smallest class covers ACKs and small lookups.
+ */
+static const size_t dnet_recv_cache_sizes[DNET_RECV_CACHE_CLASSES] = {256, 1024, 4096, 16384};
+
+/* cache of the network thread we are running in, NULL in all other threads */
+static __thread struct dnet_recv_cache *dnet_recv_cache_current;
+
+static int dnet_recv_cache_init(struct dnet_recv_cache *cache)
+{
+	int i, err;
+
+	memset(cache, 0, sizeof(struct dnet_recv_cache));
+
+	for (i = 0; i < DNET_RECV_CACHE_CLASSES; ++i) {
+		err = dnet_lock_init(&cache->cls[i].lock);
+		if (err)
+			goto err_out_destroy;
+	}
+
+	return 0;
+
+err_out_destroy:
+	while (--i >= 0)
+		dnet_lock_destroy(&cache->cls[i].lock);
+	return -err;
+}
+
+static void dnet_recv_buf_free_list(struct dnet_recv_buf *b)
+{
+	struct dnet_recv_buf *next;
+
+	while (b) {
+		next = b->next;
+		free(b);
+		b = next;
+	}
+}
+
+static void dnet_recv_cache_destroy(struct dnet_recv_cache *cache)
+{
+	struct dnet_recv_cache_class *cl;
+	int i;
+
+	for (i = 0; i < DNET_RECV_CACHE_CLASSES; ++i) {
+		cl = &cache->cls[i];
+
+		dnet_recv_buf_free_list(cl->local);
+		dnet_recv_buf_free_list(cl->returned);
+		dnet_lock_destroy(&cl->lock);
+	}
+}
+
+static void dnet_recv_cache_refill(struct dnet_recv_cache_class *cl)
+{
+	dnet_lock_lock(&cl->lock);
+	cl->local = cl->returned;
+	cl->local_num = cl->returned_num;
+	cl->returned = NULL;
+	cl->returned_num = 0;
+	dnet_lock_unlock(&cl->lock);
+}
+
+static struct dnet_io_req *dnet_io_req_recv_alloc(uint64_t size)
+{
+	struct dnet_recv_cache *cache = dnet_recv_cache_current;
+	struct dnet_recv_cache_class *cl;
+	struct dnet_recv_buf *b = NULL;
+	struct dnet_io_req *r;
+	uint64_t total = sizeof(struct dnet_recv_buf) + sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + size;
+	int i = DNET_RECV_CACHE_CLASSES;
+
+	if (cache) {
+		for (i = 0; i < DNET_RECV_CACHE_CLASSES; ++i) {
+			if (total <= dnet_recv_cache_sizes[i])
+				break;
+		}
+	}
+
+	if (i < DNET_RECV_CACHE_CLASSES) {
+		cl = &cache->cls[i];
+
+		if (!cl->local && cl->returned)
+			dnet_recv_cache_refill(cl);
+
+		b = cl->local;
+		if (b) {
+			cl->local = b->next;
+			cl->local_num--;
+			cache->hit++;
+		} else {
+			b = malloc(dnet_recv_cache_sizes[i]);
+			cache->miss++;
+		}
+	} else {
+		b = malloc(total);
+		i = -1;
+		if (cache)
+			cache->miss++;
+	}
+
+	if (!b)
+		return NULL;
+
+	b->cache = cache;
+	b->cls = i;
+
+	r = (struct dnet_io_req *)(b + 1);
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->on_exit = DNET_IO_REQ_FLAGS_RECV_BUF;
+
+	return r;
+}
+
+void dnet_io_req_recv_free(struct dnet_io_req *r)
+{
+	struct dnet_recv_buf *b = (struct dnet_recv_buf *)r - 1;
+	struct dnet_recv_cache_class *cl;
+
+	if (b->cls < 0) {
+		free(b);
+		return;
+	}
+
+	cl = &b->cache->cls[b->cls];
+
+	if (b->cache == dnet_recv_cache_current) {
+		if (cl->local_num < DNET_RECV_CACHE_MAX_FREE) {
+			b->next = cl->local;
+			cl->local = b;
+			cl->local_num++;
+			return;
+		}
+	} else {
+		dnet_lock_lock(&cl->lock);
+		if (cl->returned_num < DNET_RECV_CACHE_MAX_FREE) {
+			b->next = cl->returned;
+			cl->returned = b;
+			cl->returned_num++;
+			b = NULL;
+		}
+		dnet_lock_unlock(&cl->lock);
+	}
+
+	free(b);
 }
 
+void dnet_recv_cache_stat(struct dnet_node *n, uint64_t *hit, uint64_t *miss)
+{
+	int i;
+
+	*hit = *miss = 0;
+
+	if (!n->io)
+		return;
+
+	for (i = 0; i < n->io->net_thread_num; ++i) {
+		*hit += n->io->net[i].recv_cache.hit;
+		*miss += n->io->net[i].recv_cache.miss;
+	}
+}
 
 void dnet_schedule_command(struct dnet_net_state *st)
 {
@@ -225,7 +573,7 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		dnet_log(st->n, DNET_LOG_DEBUG, "freed: size: %llu, trans: %llu, reply: %d, ptr: %p.\n",
 						(unsigned long long)c->size, tid, tid != c->trans, st->rcv_data);
 #endif
-		free(st->rcv_data);
+		dnet_io_req_recv_free(st->rcv_data);
 		st->rcv_data = NULL;
 	}
 
@@ -233,6 +581,49 @@ void dnet_schedule_command(struct dnet_net_state *st)
 	st->rcv_offset = 0;
 }
 
+/*
+ * Receive up to @size bytes into @data. Small reads are served from the state's
+ * receive buffer, which is refilled with a single large recv() when empty,
+ * so that many pipelined commands are parsed per system call.
+ * Return value and errno follow recv() semantics.
+ */
+static ssize_t dnet_state_recv(struct dnet_net_state *st, void *data, uint64_t size)
+{
+	unsigned int avail = st->rcv_buf_end - st->rcv_buf_start;
+	ssize_t err;
+
+	/* io_uring engine receives into the buffer or request itself, see dnet_uring_recv_arm() */
+	if (!avail && st->n->io->net_engine == DNET_NET_ENGINE_URING) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (!avail && size < DNET_RECV_BUF_SIZE) {
+		if (!st->rcv_buf)
+			st->rcv_buf = malloc(DNET_RECV_BUF_SIZE);
+
+		if (st->rcv_buf) {
+			err = recv(st->read_s, st->rcv_buf, DNET_RECV_BUF_SIZE, 0);
+			if (err <= 0)
+				return err;
+
+			st->rcv_buf_start = 0;
+			st->rcv_buf_end = avail = err;
+		}
+	}
+
+	if (avail) {
+		if (size > avail)
+			size = avail;
+
+		memcpy(data, st->rcv_buf + st->rcv_buf_start, size);
+		st->rcv_buf_start += size;
+		return size;
+	}
+
+	return recv(st->read_s, data, size, 0);
+}
+
 static int dnet_process_recv_single(struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
@@ -253,10 +644,14 @@ again:
 	size = st->rcv_end - st->rcv_offset;
 
 	if (size) {
-		err = recv(st->read_s, data, size, 0);
+		err = dnet_state_recv(st, data, size);
 		if (err < 0) {
+			/* there will be no new edge for already received data */
+			if (errno == EINTR)
+				goto again;
+
 			err = -EAGAIN;
-			if (errno != EAGAIN && errno != EINTR) {
+			if (errno != EAGAIN) {
 				err = -errno;
 				dnet_log_err(n, "failed to receive data, socket: %d", st->read_s);
 				goto out;
@@ -292,12 +687,11 @@ again:
 				!!(c->trans & DNET_TRANS_REPLY),
 				(unsigned long long)c->size, (unsigned long long)c->flags, c->status);
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		r = dnet_io_req_recv_alloc(c->size);
 		if (!r) {
 			err = -ENOMEM;
 			goto out;
 		}
-		memset(r, 0, sizeof(struct dnet_io_req));
 
 		r->header = r + 1;
 		r->hsize = sizeof(struct dnet_cmd);
@@ -325,6 +719,7 @@ again:
 	dnet_schedule_command(st);
 
 	r->st = dnet_state_get(st);
+	gettimeofday(&r->time, NULL);
 
 	dnet_schedule_io(n, r);
 	return 0;
@@ -430,123 +825,1105 @@ err_out_exit:
 	return err;
 }
 
-void dnet_unschedule_send(struct dnet_net_state *st)
+static int dnet_process_network_event(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev);
+static void dnet_send_complete(struct dnet_net_state *st, struct dnet_io_req **reqs, int num);
+
+/*
+ * State is not reset on send error here, caller may hold n->state_lock:
+ * socket is shut down instead and network thread resets the state
+ * when it gets the hangup event.
+ */
+static void dnet_send_shutdown(struct dnet_net_state *st, int err)
 {
-	struct epoll_event ev;
+	pthread_mutex_lock(&st->send_lock);
+	if (!st->need_exit)
+		st->need_exit = err;
 
-	ev.events = EPOLLOUT;
-	ev.data.ptr = st;
+	shutdown(st->read_s, 2);
+	shutdown(st->write_s, 2);
+	pthread_mutex_unlock(&st->send_lock);
+}
+
+#ifdef HAVE_URING_SUPPORT
+/*
+ * io_uring network engine.
+ *
+ * Data is moved by the ring. Every state has IORING_OP_RECV in flight into its
+ * receive buffer, or directly into the request body if the rest of it is larger
+ * than the buffer. Received data is parsed by the same state machine as with epoll,
+ * dnet_state_recv() returns -EAGAIN when the buffer is empty instead of calling recv().
+ *
+ * Queued requests are sent with IORING_OP_SENDMSG by the thread which finds nobody
+ * sending (@send_busy), partial sends are tracked in st->send_offset like with epoll,
+ * and the rest of the queue is submitted by network thread when completion is reaped.
+ * File part is spliced into per-state pipe and from the pipe into the socket
+ * with linked IORING_OP_SPLICE operations.
+ *
+ * Every operation holds a state reference until its completion is reaped, so buffers
+ * it points to are not freed under it. Listening socket is polled with one-shot
+ * IORING_OP_POLL_ADD, which is rearmed after accept loop, accept() itself is not changed.
+ */
+
+#define DNET_URING_ENTRIES		4096
+#define DNET_URING_BATCH		256
+/* file part is spliced in chunks of default pipe capacity */
+#define DNET_URING_PIPE_SIZE		(64 * 1024)
+#define DNET_URING_RECV_MAX		(1U << 30)
+
+/* operation is stored in the low bits of completion data, states are at least 8-byte aligned */
+enum dnet_uring_op {
+	DNET_URING_OP_RECV = 0,
+	DNET_URING_OP_SENDMSG,
+	DNET_URING_OP_SPLICE_IN,
+	DNET_URING_OP_SPLICE_OUT,
+	DNET_URING_OP_POLL_OUT,
+	DNET_URING_OP_POLL,
+	DNET_URING_OP_RESUME,
+};
+#define DNET_URING_OP_MASK		7UL
+
+static __thread struct dnet_net_io *dnet_uring_current;
+
+static struct dnet_net_io *dnet_uring_nio(struct dnet_net_state *st)
+{
+	struct dnet_io *io = st->n->io;
+	int i;
+
+	if (st->epoll_fd == -1)
+		return NULL;
 
-	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->write_s, &ev);
+	for (i = 0; i < io->net_thread_num; ++i) {
+		if (io->net[i].epoll_fd == st->epoll_fd)
+			return &io->net[i];
+	}
+
+	return NULL;
 }
 
-void dnet_unschedule_recv(struct dnet_net_state *st)
+/*
+ * Makes sure there is room for @num entries, so that linked operations
+ * are never split by submission. Caller holds nio->uring_lock.
+ */
+static int dnet_uring_reserve(struct dnet_net_io *nio, unsigned int num)
 {
-	struct epoll_event ev;
+	if (io_uring_sq_space_left(&nio->uring) < num)
+		io_uring_submit(&nio->uring);
 
-	ev.events = EPOLLIN;
-	ev.data.ptr = st;
+	if (io_uring_sq_space_left(&nio->uring) < num)
+		return -EBUSY;
 
-	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
+	return 0;
 }
 
-static int dnet_process_send_single(struct dnet_net_state *st)
+static void dnet_uring_sqe_set_state(struct dnet_net_io *nio, struct io_uring_sqe *sqe,
+		struct dnet_net_state *st, enum dnet_uring_op op)
 {
-	struct dnet_io_req *r = NULL;
+	io_uring_sqe_set_data(sqe, (void *)((uintptr_t)st | op));
+	dnet_state_get(st);
+	atomic_inc(&nio->uring_inflight);
+}
+
+/* network thread submits everything at once before it waits for completions */
+static void dnet_uring_submit_nolock(struct dnet_net_io *nio)
+{
+	if (dnet_uring_current != nio)
+		io_uring_submit(&nio->uring);
+}
+
+/*
+ * Arms receive after everything received has been parsed.
+ *
+ * Receive is not armed while reading is paused: unparsed data may be left in the buffer,
+ * it is parsed when dnet_recv_resume() queues DNET_URING_OP_RESUME. Poll without events
+ * is armed instead, it only reports hangup, so that state reset is noticed.
+ * Listening socket gets one-shot POLLIN poll.
+ */
+static int dnet_uring_recv_arm(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	struct io_uring_sqe *sqe;
+	void *data = NULL;
+	uint64_t size = 0;
+	int paused, listening = st->process == dnet_state_accept_process;
 	int err;
 
-	while (1) {
-		r = NULL;
+	if (st->uring_recv_armed || st->need_exit)
+		return 0;
 
-		pthread_mutex_lock(&st->send_lock);
-		if (!list_empty(&st->send_list)) {
-			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
-		} else {
-			dnet_unschedule_send(st);
-		}
-		pthread_mutex_unlock(&st->send_lock);
+	pthread_mutex_lock(&st->send_lock);
+	paused = st->recv_paused || st->rcv_buf_start != st->rcv_buf_end;
+	pthread_mutex_unlock(&st->send_lock);
 
-		if (!r) {
-			err = -EAGAIN;
-			goto err_out_exit;
-		}
+	if (paused && st->uring_hup_armed)
+		return 0;
 
-		err = dnet_send_request(st, r);
-		if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-			pthread_mutex_lock(&st->send_lock);
-			list_del(&r->req_entry);
-			pthread_mutex_unlock(&st->send_lock);
+	if (!paused && !listening) {
+		size = st->rcv_end - st->rcv_offset;
 
-			if (atomic_read(&st->send_queue_size) > 0)
-				if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
-					dnet_log(st->n, DNET_LOG_DEBUG,
-							"State low_watermark reached: %s: %d, waking up\n",
-							dnet_server_convert_dnet_addr(&st->addr),
-							atomic_read(&st->send_queue_size));
-					pthread_cond_broadcast(&st->send_wait);
-				}
+		if (!(st->rcv_flags & DNET_IO_CMD) && size >= DNET_RECV_BUF_SIZE) {
+			st->uring_recv_direct = 1;
+			data = st->rcv_data + st->rcv_offset;
+			if (size > DNET_URING_RECV_MAX)
+				size = DNET_URING_RECV_MAX;
+		} else {
+			if (!st->rcv_buf) {
+				st->rcv_buf = malloc(DNET_RECV_BUF_SIZE);
+				if (!st->rcv_buf)
+					return -ENOMEM;
+			}
 
-			dnet_io_req_free(r);
-			st->send_offset = 0;
+			st->uring_recv_direct = 0;
+			data = st->rcv_buf;
+			size = DNET_RECV_BUF_SIZE;
 		}
+	}
 
-		if (err)
-			goto err_out_exit;
+	pthread_mutex_lock(&nio->uring_lock);
+	err = dnet_uring_reserve(nio, 1);
+	if (err) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to arm receive: submission queue is full\n",
+				dnet_state_dump_addr(st));
+		goto err_out_unlock;
 	}
 
-err_out_exit:
+	sqe = io_uring_get_sqe(&nio->uring);
+	if (listening) {
+		io_uring_prep_poll_add(sqe, st->read_s, POLLIN);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_POLL);
+		st->uring_recv_armed = 1;
+	} else if (paused) {
+		io_uring_prep_poll_add(sqe, st->read_s, 0);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_POLL);
+		st->uring_hup_armed = 1;
+	} else {
+		io_uring_prep_recv(sqe, st->read_s, data, size, 0);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_RECV);
+		st->uring_recv_armed = 1;
+	}
+
+	dnet_uring_submit_nolock(nio);
+
+err_out_unlock:
+	pthread_mutex_unlock(&nio->uring_lock);
 	return err;
 }
 
-static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
+/* memory parts of @num requests, prepared by dnet_send_batch_iov() */
+static int dnet_uring_sendmsg(struct dnet_net_io *nio, struct dnet_net_state *st, int num, int iov_num, int more)
 {
-	struct epoll_event ev;
-	int err, fd;
+	struct dnet_uring_send *us = st->uring_send;
+	struct io_uring_sqe *sqe;
+	int err;
 
-	if (send) {
-		ev.events = EPOLLOUT;
-		fd = st->write_s;
-	} else {
-		ev.events = EPOLLIN;
-		fd = st->read_s;
-	}
+	us->num = num;
+
+	memset(&us->msg, 0, sizeof(struct msghdr));
+	us->msg.msg_iov = us->iov;
+	us->msg.msg_iovlen = iov_num;
+
+	pthread_mutex_lock(&nio->uring_lock);
+	err = dnet_uring_reserve(nio, 1 + us->wait_out);
+	if (err)
+		goto err_out_unlock;
+
+	if (us->wait_out) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_poll_add(sqe, st->write_s, POLLOUT);
+		io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_POLL_OUT);
+		us->ops++;
+		us->wait_out = 0;
+	}
+
+	sqe = io_uring_get_sqe(&nio->uring);
+	io_uring_prep_sendmsg(sqe, st->write_s, &us->msg, more ? MSG_MORE : 0);
+	dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_SENDMSG);
+	us->ops++;
+
+	dnet_uring_submit_nolock(nio);
+
+err_out_unlock:
+	pthread_mutex_unlock(&nio->uring_lock);
+	return err;
+}
+
+/*
+ * File part of the first request: chunk of the file is spliced into the pipe and linked
+ * splice moves it into the socket. If socket did not take everything, the rest
+ * is sent from the pipe before the next chunk is read.
+ */
+static int dnet_uring_splice(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	struct dnet_uring_send *us = st->uring_send;
+	struct dnet_io_req *r = us->reqs[0];
+	struct io_uring_sqe *sqe;
+	uint64_t offset = st->send_offset - r->hsize - r->dsize;
+	unsigned int len = us->pipe_bytes;
+	int err;
+
+	us->num = 1;
+
+	if (us->pipe[0] < 0) {
+		err = pipe2(us->pipe, O_CLOEXEC);
+		if (err) {
+			err = -errno;
+			dnet_log_err(st->n, "%s: failed to create splice pipe", dnet_state_dump_addr(st));
+			return err;
+		}
+	}
+
+	if (!len) {
+		len = DNET_URING_PIPE_SIZE;
+		if (r->fsize - offset < len)
+			len = r->fsize - offset;
+	}
+
+	pthread_mutex_lock(&nio->uring_lock);
+	err = dnet_uring_reserve(nio, 1 + us->wait_out + !us->pipe_bytes);
+	if (err)
+		goto err_out_unlock;
+
+	if (us->wait_out) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_poll_add(sqe, st->write_s, POLLOUT);
+		io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_POLL_OUT);
+		us->ops++;
+		us->wait_out = 0;
+	}
+
+	if (!us->pipe_bytes) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_splice(sqe, r->fd, r->local_offset + offset, us->pipe[1], -1, len, SPLICE_F_MOVE);
+		io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_SPLICE_IN);
+		us->ops++;
+	}
+
+	sqe = io_uring_get_sqe(&nio->uring);
+	io_uring_prep_splice(sqe, us->pipe[0], -1, st->write_s, -1, len,
+			SPLICE_F_MOVE | (offset + len < r->fsize ? SPLICE_F_MORE : 0));
+	dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_SPLICE_OUT);
+	us->ops++;
+
+	dnet_uring_submit_nolock(nio);
+
+err_out_unlock:
+	pthread_mutex_unlock(&nio->uring_lock);
+	return err;
+}
+
+/*
+ * Submits the head of the send queue like dnet_process_send_single() does:
+ * memory-only requests are coalesced, request with file part is sent alone.
+ * Caller owns @send_busy, it is cleared here when queue is empty.
+ */
+static int dnet_uring_send_next(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	struct dnet_uring_send *us = st->uring_send;
+	struct dnet_io_req *r;
+	int num, more, iov_num;
+
+	if (!us) {
+		us = malloc(sizeof(struct dnet_uring_send));
+		if (!us)
+			return -ENOMEM;
+
+		memset(us, 0, sizeof(struct dnet_uring_send));
+		us->pipe[0] = us->pipe[1] = -1;
+		st->uring_send = us;
+	}
+
+	while (1) {
+		num = 0;
+		more = 0;
+
+		pthread_mutex_lock(&st->send_lock);
+		list_for_each_entry(r, &st->send_list, req_entry) {
+			if ((r->fd >= 0 && r->fsize) || num == DNET_SEND_BATCH_MAX) {
+				if (num == 0)
+					us->reqs[num++] = r;
+				else
+					more = 1;
+				break;
+			}
+
+			us->reqs[num++] = r;
+		}
+
+		if (!num)
+			st->send_busy = 0;
+		pthread_mutex_unlock(&st->send_lock);
+
+		if (!num)
+			return 0;
+
+		r = us->reqs[0];
+		if (r->fd >= 0 && r->fsize) {
+			if (st->send_offset >= r->hsize + r->dsize)
+				return dnet_uring_splice(nio, st);
+
+			/* header is held by the kernel until file part follows */
+			more = 1;
+		}
+
+		iov_num = dnet_send_batch_iov(st, us->reqs, num, us->iov);
+		if (iov_num)
+			return dnet_uring_sendmsg(nio, st, num, iov_num, more);
+
+		st->send_offset = 0;
+		dnet_send_complete(st, us->reqs, num);
+	}
+}
+
+static int dnet_uring_send_drain(struct dnet_net_state *st)
+{
+	struct dnet_net_io *nio = dnet_uring_nio(st);
+
+	/* queue is sent when state is attached to network thread, see dnet_uring_schedule_recv() */
+	if (!nio)
+		return 0;
+
+	pthread_mutex_lock(&st->send_lock);
+	if (st->send_busy || list_empty(&st->send_list)) {
+		pthread_mutex_unlock(&st->send_lock);
+		return 0;
+	}
+
+	st->send_busy = 1;
+	pthread_mutex_unlock(&st->send_lock);
+
+	return dnet_uring_send_next(nio, st);
+}
+
+/*
+ * Accounts completed send operation, when all operations of the step are reaped
+ * completely sent requests are freed and the next step is submitted.
+ * Returns negative error if state has to be reset.
+ */
+static int dnet_uring_send_event(struct dnet_net_io *nio, struct dnet_net_state *st, enum dnet_uring_op op, int res)
+{
+	struct dnet_uring_send *us = st->uring_send;
+	struct dnet_io_req *r = us->reqs[0];
+	int file = r->fd >= 0 && r->fsize;
+	int done;
+
+	us->ops--;
+
+	switch (op) {
+	case DNET_URING_OP_SENDMSG:
+		if (res > 0) {
+			if (file) {
+				st->send_offset += res;
+			} else {
+				done = dnet_send_batch_sent(st, us->reqs, us->num, res);
+				dnet_send_complete(st, us->reqs, done);
+			}
+		} else if (res == 0) {
+			res = -ECONNRESET;
+		} else if (res == -EAGAIN) {
+			us->wait_out = 1;
+		}
+		break;
+	case DNET_URING_OP_SPLICE_IN:
+		if (res > 0) {
+			us->pipe_bytes += res;
+		} else if (res == 0) {
+			res = -ENODATA;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: looks like truncated file: fd: %d, offset: %llu, size: %llu\n",
+					dnet_state_dump_addr(st), r->fd, (unsigned long long)r->local_offset,
+					(unsigned long long)r->fsize);
+		}
+		break;
+	case DNET_URING_OP_SPLICE_OUT:
+		if (res > 0) {
+			us->pipe_bytes -= res;
+			st->send_offset += res;
+		} else if (res == 0) {
+			res = -ECONNRESET;
+		} else if (res == -EAGAIN) {
+			us->wait_out = 1;
+		}
+		break;
+	default:
+		/* socket errors are reported by linked send */
+		res = 0;
+		break;
+	}
+
+	/* operation linked after short or failed one completes with -ECANCELED */
+	if (res < 0 && res != -EAGAIN && res != -EINTR && res != -ECANCELED && !us->err)
+		us->err = res;
+
+	if (us->ops)
+		return 0;
+
+	if (us->err) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to send: %s [%d]\n",
+				dnet_state_dump_addr(st), strerror(-us->err), us->err);
+		return us->err;
+	}
+
+	if (file && st->send_offset == r->hsize + r->dsize + r->fsize) {
+		st->send_offset = 0;
+		dnet_send_complete(st, us->reqs, 1);
+	}
+
+	return dnet_uring_send_next(nio, st);
+}
+
+static void dnet_uring_resume(struct dnet_net_state *st)
+{
+	struct dnet_net_io *nio = dnet_uring_nio(st);
+	struct io_uring_sqe *sqe;
+
+	if (!nio)
+		return;
+
+	pthread_mutex_lock(&nio->uring_lock);
+	if (!dnet_uring_reserve(nio, 1)) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_nop(sqe);
+		dnet_uring_sqe_set_state(nio, sqe, st, DNET_URING_OP_RESUME);
+		dnet_uring_submit_nolock(nio);
+	}
+	pthread_mutex_unlock(&nio->uring_lock);
+}
+
+static int dnet_uring_schedule_recv(struct dnet_net_state *st)
+{
+	struct dnet_net_io *nio = dnet_uring_nio(st);
+	int nodelay = 1;
+	int err;
+
+	if (!nio)
+		return -EINVAL;
+
+	/* epoll engine sets it on the first flush of the send batch, see dnet_send_request_batch() */
+	if (st->process != dnet_state_accept_process)
+		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
+
+	err = dnet_uring_recv_arm(nio, st);
+	if (err)
+		return err;
+
+	/* requests queued before state was attached to network thread */
+	if (!st->need_exit)
+		dnet_schedule_send(st);
+
+	return 0;
+}
+
+/*
+ * Runs state processing for the completion and rearms receive.
+ * Returns negative error if state has been reset.
+ */
+static int dnet_uring_process_event(struct dnet_net_io *nio, struct dnet_net_state *st, unsigned int events)
+{
+	struct epoll_event ev;
+	int err;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
 	ev.data.ptr = st;
 
-	err = epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
-	if (err < 0) {
-		err = -errno;
+	if (events) {
+		err = dnet_process_network_event(nio, st, &ev);
+		if (err)
+			return err;
+	}
+
+	err = dnet_uring_recv_arm(nio, st);
+	if (err) {
+		pthread_mutex_lock(&st->send_lock);
+		if (!st->need_exit)
+			st->need_exit = err;
+		pthread_mutex_unlock(&st->send_lock);
+
+		ev.events = EPOLLERR;
+		return dnet_process_network_event(nio, st, &ev);
+	}
+
+	return 0;
+}
+
+static void dnet_uring_process_completion(struct dnet_net_io *nio, struct dnet_net_state *st, enum dnet_uring_op op, int res)
+{
+	unsigned int events = 0;
+	int err;
+
+	atomic_dec(&nio->uring_inflight);
+
+	/* network thread has dropped its reference, state is being destroyed */
+	if (st->uring_closed)
+		goto out_put;
+
+	switch (op) {
+	case DNET_URING_OP_RECV:
+		st->uring_recv_armed = 0;
+
+		if (res > 0) {
+			if (st->uring_recv_direct) {
+				st->rcv_offset += res;
+			} else {
+				st->rcv_buf_start = 0;
+				st->rcv_buf_end = res;
+			}
+
+			events = EPOLLIN;
+		} else if (res == 0) {
+			dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has disconnected.\n",
+				dnet_server_convert_dnet_addr(&st->addr));
+			events = EPOLLIN | EPOLLHUP;
+		} else if (res != -EAGAIN && res != -EINTR && res != -ENOBUFS) {
+			events = EPOLLERR;
+		}
+
+		dnet_uring_process_event(nio, st, events);
+		break;
+	case DNET_URING_OP_POLL:
+		if (st->process == dnet_state_accept_process)
+			st->uring_recv_armed = 0;
+		else
+			st->uring_hup_armed = 0;
+
+		/* POLL* and EPOLL* event masks are the same on linux */
+		dnet_uring_process_event(nio, st, res < 0 ? EPOLLERR : (unsigned int)res);
+		break;
+	case DNET_URING_OP_RESUME:
+		/* receive was armed again before resume has been reaped, nothing is left to parse */
+		if (!st->uring_recv_armed)
+			dnet_uring_process_event(nio, st, EPOLLIN);
+		break;
+	default:
+		err = dnet_uring_send_event(nio, st, op, res);
+		if (err)
+			dnet_send_shutdown(st, err);
+		break;
+	}
+
+out_put:
+	dnet_state_put(st);
+}
+
+static void *dnet_io_process_network_uring(void *data_)
+{
+	struct dnet_net_io *nio = data_;
+	struct dnet_node *n = nio->n;
+	struct io_uring_cqe *cqe;
+	uintptr_t data;
+	int err, res, num;
+
+	dnet_set_name("net_pool");
+	dnet_recv_cache_current = &nio->recv_cache;
+	dnet_uring_current = nio;
+
+	while (!n->need_exit) {
+		pthread_mutex_lock(&nio->uring_lock);
+		io_uring_submit(&nio->uring);
+		pthread_mutex_unlock(&nio->uring_lock);
+
+		err = io_uring_wait_cqe(&nio->uring, &cqe);
+		if (err < 0) {
+			if (err == -EAGAIN || err == -EINTR)
+				continue;
+
+			dnet_log(n, DNET_LOG_ERROR, "Failed to wait for io_uring completions: %d\n", err);
+			n->need_exit = err;
+			break;
+		}
+
+		for (num = 0; num < DNET_URING_BATCH && !io_uring_peek_cqe(&nio->uring, &cqe); ++num) {
+			data = (uintptr_t)io_uring_cqe_get_data(cqe);
+			res = cqe->res;
+
+			io_uring_cqe_seen(&nio->uring, cqe);
+
+			/* wakeup */
+			if (!data)
+				continue;
+
+			dnet_uring_process_completion(nio, (struct dnet_net_state *)(data & ~DNET_URING_OP_MASK),
+					data & DNET_URING_OP_MASK, res);
+		}
+	}
+
+	return &n->need_exit;
+}
+
+/* completion without data wakes network thread up, used at exit */
+static void dnet_uring_wakeup(struct dnet_net_io *nio)
+{
+	struct io_uring_sqe *sqe;
+
+	pthread_mutex_lock(&nio->uring_lock);
+	if (!dnet_uring_reserve(nio, 1)) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, NULL);
+		io_uring_submit(&nio->uring);
+	}
+	pthread_mutex_unlock(&nio->uring_lock);
+}
+
+/*
+ * Cancels all operations and drops their state references,
+ * called when network and IO threads have exited
+ */
+static void dnet_uring_drain(struct dnet_net_io *nio)
+{
+	struct io_uring_cqe *cqe;
+	struct io_uring_sqe *sqe;
+	uintptr_t data;
+	int res;
+
+	pthread_mutex_lock(&nio->uring_lock);
+	if (!dnet_uring_reserve(nio, 1)) {
+		sqe = io_uring_get_sqe(&nio->uring);
+		io_uring_prep_cancel(sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+	io_uring_submit(&nio->uring);
+	pthread_mutex_unlock(&nio->uring_lock);
+
+	while (atomic_read(&nio->uring_inflight) > 0) {
+		if (io_uring_wait_cqe(&nio->uring, &cqe))
+			break;
+
+		data = (uintptr_t)io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+
+		io_uring_cqe_seen(&nio->uring, cqe);
+
+		if (!data) {
+			if (res < 0 && res != -ENOENT) {
+				dnet_log(nio->n, DNET_LOG_ERROR, "Failed to cancel io_uring operations: %d, "
+						"%d states are not freed\n", res, atomic_read(&nio->uring_inflight));
+				break;
+			}
+			continue;
+		}
+
+		atomic_dec(&nio->uring_inflight);
+		dnet_state_put((struct dnet_net_state *)(data & ~DNET_URING_OP_MASK));
+	}
+}
+
+static int dnet_uring_init(struct dnet_net_io *nio)
+{
+	int err;
+
+	err = pthread_mutex_init(&nio->uring_lock, NULL);
+	if (err)
+		return -err;
+
+	err = io_uring_queue_init(DNET_URING_ENTRIES, &nio->uring, 0);
+	if (err) {
+		pthread_mutex_destroy(&nio->uring_lock);
+		return err;
+	}
+
+	atomic_init(&nio->uring_inflight, 0);
+	nio->epoll_fd = nio->uring.ring_fd;
+	return 0;
+}
+
+static void dnet_uring_cleanup(struct dnet_net_io *nio)
+{
+	io_uring_queue_exit(&nio->uring);
+	pthread_mutex_destroy(&nio->uring_lock);
+}
+
+void dnet_uring_state_destroy(struct dnet_net_state *st)
+{
+	struct dnet_uring_send *us = st->uring_send;
+
+	if (!us)
+		return;
+
+	if (us->pipe[0] >= 0) {
+		close(us->pipe[0]);
+		close(us->pipe[1]);
+	}
+
+	free(us);
+}
+#else
+static int dnet_uring_schedule_recv(struct dnet_net_state *st __unused)
+{
+	return -ENOTSUP;
+}
+
+static int dnet_uring_send_drain(struct dnet_net_state *st __unused)
+{
+	return -ENOTSUP;
+}
+
+static void dnet_uring_resume(struct dnet_net_state *st __unused)
+{
+}
+#endif
+
+/*
+ * Socket is registered once for both directions,
+ * so this removes it from epoll set completely
+ */
+void dnet_unschedule_recv(struct dnet_net_state *st)
+{
+	struct epoll_event ev;
+
+	if (st->n->io->net_engine == DNET_NET_ENGINE_URING) {
+#ifdef HAVE_URING_SUPPORT
+		st->uring_closed = 1;
+#endif
+		return;
+	}
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = st;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
+}
+
+/*
+ * Reading from connection is paused when its send queue exceeds the limit,
+ * it is resumed when half of the limit is sent
+ */
+static int dnet_recv_paused(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	int paused;
+
+	if (!n->send_limit)
+		return 0;
+
+	pthread_mutex_lock(&st->send_lock);
+	if (!st->recv_paused && st->send_queue_bytes > n->send_limit) {
+		st->recv_paused = 1;
+
+		dnet_log(n, DNET_LOG_NOTICE, "%s: send queue: %llu bytes, limit: %llu, pausing reading\n",
+				dnet_state_dump_addr(st), (unsigned long long)st->send_queue_bytes,
+				(unsigned long long)n->send_limit);
+		dnet_counter_inc(n, DNET_CNTR_SEND_QUEUE_PAUSED, 0);
+	}
+	paused = st->recv_paused;
+	pthread_mutex_unlock(&st->send_lock);
+
+	return paused;
+}
+
+/*
+ * There will be no new edge for data which is already in socket or receive buffer,
+ * so network thread is forced to report event for this state again
+ */
+static void dnet_recv_resume(struct dnet_net_state *st)
+{
+	struct epoll_event ev;
+
+	if (st->need_exit || st->epoll_fd == -1)
+		return;
+
+	st->recv_resume = 1;
+
+	if (st->n->io->net_engine == DNET_NET_ENGINE_URING) {
+		dnet_uring_resume(st);
+		return;
+	}
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = st;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_MOD, st->read_s, &ev);
+}
+
+static void dnet_trace_send(struct dnet_node *n, struct dnet_io_req *r, struct timeval *now)
+{
+	struct dnet_trace_span span;
+	struct dnet_cmd *cmd = r->header;
+
+	memset(&span, 0, sizeof(struct dnet_trace_span));
+	if (cmd && r->hsize >= sizeof(struct dnet_cmd)) {
+		span.trace_id = cmd->id.trace_id & ~DNET_TRACE_BIT;
+		span.cmd = cmd->cmd;
+		span.err = cmd->status;
+		memcpy(span.id, cmd->id.id, sizeof(span.id));
+	}
+
+	span.stage = DNET_STAGE_SEND;
+	span.start = r->time.tv_sec * 1000000ULL + r->time.tv_usec;
+	span.duration = dnet_time_diff_usecs(&r->time, now);
+	span.size = r->hsize + r->dsize + r->fsize;
+
+	dnet_trace_span(n, &span);
+}
+
+static void dnet_send_complete(struct dnet_net_state *st, struct dnet_io_req **reqs, int num)
+{
+	struct dnet_io_req *r;
+	struct timeval now;
+	uint64_t size = 0;
+	int i, resume = 0;
 
-		if (err == -EEXIST) {
+	gettimeofday(&now, NULL);
+
+	pthread_mutex_lock(&st->send_lock);
+	for (i = 0; i < num; ++i) {
+		list_del(&reqs[i]->req_entry);
+		size += reqs[i]->hsize + reqs[i]->dsize;
+	}
+
+	st->send_queue_bytes -= size;
+	if (st->recv_paused && st->send_queue_bytes <= st->n->send_limit / 2) {
+		st->recv_paused = 0;
+		resume = 1;
+	}
+
+	/*
+	 * Producers throttled in dnet_send_reply_threshold() check the queue size
+	 * under send_lock, so it is decreased and low watermark is signalled here
+	 */
+	for (i = 0; i < num && atomic_read(&st->send_queue_size) > 0; ++i) {
+		if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
+			dnet_log(st->n, DNET_LOG_DEBUG,
+					"State low_watermark reached: %s: %d, waking up\n",
+					dnet_server_convert_dnet_addr(&st->addr),
+					atomic_read(&st->send_queue_size));
+			pthread_cond_broadcast(&st->send_wait);
+		}
+	}
+	pthread_mutex_unlock(&st->send_lock);
+
+	dnet_node_send_queue_add(st->n, -(int64_t)size);
+
+	if (resume) {
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: send queue: %llu bytes, resuming reading\n",
+				dnet_state_dump_addr(st), (unsigned long long)st->send_queue_bytes);
+		dnet_recv_resume(st);
+	}
+
+	for (i = 0; i < num; ++i) {
+		r = reqs[i];
+
+		if (timerisset(&r->time))
+			dnet_counter_stage(st->n, DNET_STAGE_SEND, dnet_time_diff_usecs(&r->time, &now));
+
+		if (r->sampled)
+			dnet_trace_send(st->n, r, &now);
+
+		dnet_io_req_free(r);
+	}
+}
+
+/*
+ * Requests which contain only memory buffers are coalesced and sent
+ * with a single sendmsg() call, request with file part is sent alone
+ * using sendfile() under TCP_CORK.
+ */
+static int dnet_process_send_single(struct dnet_net_state *st)
+{
+	struct dnet_io_req *reqs[DNET_SEND_BATCH_MAX];
+	struct dnet_io_req *r;
+	int num, more, err;
+
+	while (1) {
+		num = 0;
+		more = 0;
+
+		pthread_mutex_lock(&st->send_lock);
+		list_for_each_entry(r, &st->send_list, req_entry) {
+			if ((r->fd >= 0 && r->fsize) || num == DNET_SEND_BATCH_MAX) {
+				if (num == 0)
+					reqs[num++] = r;
+				else
+					more = 1;
+				break;
+			}
+
+			reqs[num++] = r;
+		}
+
+		pthread_mutex_unlock(&st->send_lock);
+
+		if (!num) {
 			err = 0;
-		} else {
-			dnet_log_err(st->n, "%s: failed to add %s event", dnet_state_dump_addr(st), send ? "SEND" : "RECV");
+			goto err_out_exit;
+		}
+
+		r = reqs[0];
+		if (r->fd >= 0 && r->fsize) {
+			err = dnet_send_request(st, r);
+			if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
+				st->send_offset = 0;
+				dnet_send_complete(st, reqs, 1);
+			}
+
+			if (err)
+				goto err_out_exit;
+
+			continue;
+		}
+
+		err = dnet_send_request_batch(st, reqs, num, more);
+		if (err < 0)
+			goto err_out_exit;
+
+		dnet_send_complete(st, reqs, err);
+
+		/* socket buffer is full, wait for the next EPOLLOUT edge */
+		if (err < num) {
+			err = -EAGAIN;
+			goto err_out_exit;
+		}
+	}
+
+err_out_exit:
+	return err;
+}
+
+/*
+ * Send queue is drained by whichever thread finds socket writable and
+ * nobody else sending: io thread right after queueing reply or net thread
+ * on EPOLLOUT edge. Socket is marked non-writable only if there was no
+ * new edge since sender started, otherwise that edge could be lost.
+ *
+ * Returns negative error if state has to be reset.
+ */
+static int dnet_send_drain(struct dnet_net_state *st)
+{
+	unsigned int seq;
+	int err;
+
+	if (st->n->io->net_engine == DNET_NET_ENGINE_URING)
+		return dnet_uring_send_drain(st);
+
+	pthread_mutex_lock(&st->send_lock);
+	if (st->send_busy || !st->send_writable || list_empty(&st->send_list)) {
+		pthread_mutex_unlock(&st->send_lock);
+		return 0;
+	}
+
+	st->send_busy = 1;
+	seq = st->send_ready_seq;
+	pthread_mutex_unlock(&st->send_lock);
+
+	while (1) {
+		err = dnet_process_send_single(st);
+
+		pthread_mutex_lock(&st->send_lock);
+		if (err == -EAGAIN) {
+			if (seq != st->send_ready_seq) {
+				seq = st->send_ready_seq;
+				pthread_mutex_unlock(&st->send_lock);
+				continue;
+			}
+
+			st->send_writable = 0;
+			err = 0;
+		} else if (!err && !list_empty(&st->send_list)) {
+			pthread_mutex_unlock(&st->send_lock);
+			continue;
 		}
+
+		st->send_busy = 0;
+		pthread_mutex_unlock(&st->send_lock);
+		break;
 	}
 
 	return err;
 }
 
+static int dnet_send_ready(struct dnet_net_state *st)
+{
+	pthread_mutex_lock(&st->send_lock);
+	st->send_writable = 1;
+	st->send_ready_seq++;
+	pthread_mutex_unlock(&st->send_lock);
+
+	return dnet_send_drain(st);
+}
+
+/*
+ * Called after request was queued, sends it directly from the calling
+ * thread if socket is writable, otherwise it will be sent on EPOLLOUT edge.
+ * Errors are handled by dnet_send_shutdown().
+ */
 int dnet_schedule_send(struct dnet_net_state *st)
 {
-	return dnet_schedule_network_io(st, 1);
+	int err;
+
+	err = dnet_send_drain(st);
+	if (err)
+		dnet_send_shutdown(st, err);
+
+	return err;
 }
 
 int dnet_schedule_recv(struct dnet_net_state *st)
 {
-	return dnet_schedule_network_io(st, 0);
+	struct epoll_event ev;
+	int err;
+
+	if (st->n->io->net_engine == DNET_NET_ENGINE_URING)
+		return dnet_uring_schedule_recv(st);
+
+	/*
+	 * Socket is added once for both directions and never modified,
+	 * send readiness is tracked in dnet_net_state, see dnet_send_drain()
+	 *
+	 * Listening socket stays level-triggered: accept can fail with a recoverable
+	 * error (like EMFILE) while connections are still pending in the backlog,
+	 * there will be no new edge for them until yet another client connects
+	 */
+	if (st->process == dnet_state_accept_process)
+		ev.events = EPOLLIN;
+	else
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = st;
+
+	err = epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, st->read_s, &ev);
+	if (err < 0) {
+		err = -errno;
+
+		if (err == -EEXIST) {
+			err = 0;
+		} else {
+			dnet_log_err(st->n, "%s: failed to add network events", dnet_state_dump_addr(st));
+		}
+	}
+
+	return err;
 }
 
 int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev)
 {
-	int err = -ECONNRESET;
+	int err = -EAGAIN;
 
-	if (ev->events & EPOLLIN) {
-		err = dnet_process_recv_single(st);
-		if (err && (err != -EAGAIN))
+	/* sender failed and shut socket down, see dnet_schedule_send() */
+	if (st->need_exit)
+		return st->need_exit;
+
+	/*
+	 * Events are edge-triggered: send readiness is handled once per event,
+	 * while receive side is called again until it returns -EAGAIN
+	 */
+	if (ev->events & EPOLLOUT) {
+		ev->events &= ~EPOLLOUT;
+
+		err = dnet_send_ready(st);
+		if (err)
 			goto err_out_exit;
+
+		err = -EAGAIN;
 	}
-	if (ev->events & EPOLLOUT) {
-		err = dnet_process_send_single(st);
+
+	if ((ev->events & EPOLLIN) || st->recv_resume) {
+		if (dnet_recv_paused(st)) {
+			err = -EAGAIN;
+			goto err_out_exit;
+		}
+
+		st->recv_resume = 0;
+
+		err = dnet_process_recv_single(st);
 		if (err && (err != -EAGAIN))
 			goto err_out_exit;
 	}
@@ -559,6 +1936,47 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Process all pending work of the state for the given event.
+ * Returns negative error if state has been reset and the network thread's reference dropped.
+ */
+static int dnet_process_network_event(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev)
+{
+	int err;
+
+	st->epoll_fd = nio->epoll_fd;
+
+	while (1) {
+		err = st->process(st, ev);
+		if (err == 0)
+			continue;
+
+		if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
+			return 0;
+
+		if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+			if (!err)
+				err = -ETIMEDOUT;
+
+			dnet_state_reset(st, err);
+
+			pthread_mutex_lock(&st->send_lock);
+			dnet_unschedule_recv(st);
+			pthread_mutex_unlock(&st->send_lock);
+
+			// state still contains a fair number of transactions in its queue
+			// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
+			// while every transaction holds a reference
+			//
+			// IO thread could remove transaction, it is the only place allowed to do so.
+			// transactions may live in the tree and be accessed without locks in IO thread,
+			// IO thread is kind of 'owner' of the transaction processing
+			dnet_state_put(st);
+			return err;
+		}
+	}
+}
+
 static void *dnet_io_process_network(void *data_)
 {
 	struct dnet_net_io *nio = data_;
@@ -568,6 +1986,7 @@ static void *dnet_io_process_network(void *data_)
 	int err = 0;
 
 	dnet_set_name("net_pool");
+	dnet_recv_cache_current = &nio->recv_cache;
 
 	while (!n->need_exit) {
 		err = epoll_wait(nio->epoll_fd, &ev, 1, 1000);
@@ -586,38 +2005,7 @@ static void *dnet_io_process_network(void *data_)
 		}
 
 		st = ev.data.ptr;
-		st->epoll_fd = nio->epoll_fd;
-
-		while (1) {
-			err = st->process(st, &ev);
-			if (err == 0)
-				continue;
-
-			if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
-				break;
-
-			if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
-				if (!err)
-					err = -ETIMEDOUT;
-
-				dnet_state_reset(st, err);
-
-				pthread_mutex_lock(&st->send_lock);
-				dnet_unschedule_send(st);
-				dnet_unschedule_recv(st);
-				pthread_mutex_unlock(&st->send_lock);
-
-				// state still contains a fair number of transactions in its queue
-				// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
-				// while every transaction holds a reference
-				//
-				// IO thread could remove transaction, it is the only place allowed to do so.
-				// transactions may live in the tree and be accessed without locks in IO thread,
-				// IO thread is kind of 'owner' of the transaction processing
-				dnet_state_put(st);
-				break;
-			}
-		}
+		dnet_process_network_event(nio, st, &ev);
 	}
 
 	return &n->need_exit;
@@ -628,7 +2016,6 @@ static void dnet_io_cleanup_states(struct dnet_node *n)
 	struct dnet_net_state *st, *tmp;
 
 	list_for_each_entry_safe(st, tmp, &n->storage_state_list, storage_state_entry) {
-		dnet_unschedule_send(st);
 		dnet_unschedule_recv(st);
 
 		dnet_state_reset(st, -EUCLEAN);
@@ -643,55 +2030,101 @@ struct dnet_io_process_data {
 	int thread_number;
 };
 
-static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_index)
+static struct dnet_io_req *dnet_work_io_pop(struct dnet_work_io *wio)
 {
-	struct dnet_io_req *it = NULL;
-	struct dnet_cmd *cmd;
-	uint64_t tid;
-	int i;
-	int ok;
-
-	list_for_each_entry(it, &pool->list, req_entry) {
-		cmd = it->header;
-		tid = cmd->trans & ~DNET_TRANS_REPLY;
-		ok = 1;
-
-		/* This is not a transaction reply, process it right now */
-		if (!(cmd->trans & DNET_TRANS_REPLY))
-			return it;
-
-		for (i = 0; i < pool->num; ++i) {
-			 /* Someone claimed transaction @tid */
-			if (pool->trans[i] == tid) {
-				 /* Its our transaction, let's handle it */
-				if (i == thread_index) {
-					/* its the last transaction in given set, clear 'claim' flag for current thread */
-					if (!(cmd->flags & DNET_FLAGS_MORE))
-						pool->trans[thread_index] = ~0ULL;
-
-					return it;
-				}
-
-				/* we should not touch it */
-				ok = 0;
-				break;
-			}
-		}
+	struct dnet_io_req *r = NULL;
 
-		/*
-		 * 'ok' here means no one claimed given transaction, we can process it,
-		 * but only if 'we' do not wait for another transaction already.
-		 */
-		if (ok) {
-			if (pool->trans[thread_index] == ~0ULL) {
-				/* only claim this transaction if there will be others */
-				if (cmd->flags & DNET_FLAGS_MORE)
-					pool->trans[thread_index] = tid;
-				return it;
-			}
+	pthread_mutex_lock(&wio->lock);
+	if (!list_empty(&wio->list)) {
+		r = list_first_entry(&wio->list, struct dnet_io_req, req_entry);
+		list_del_init(&r->req_entry);
+		list_stat_size_decrease(&wio->list_stats, 1);
+	}
+	pthread_mutex_unlock(&wio->lock);
+
+	return r;
+}
+
+static struct dnet_io_req *dnet_work_io_take_reply(struct dnet_work_io *wio)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_trans *t;
+	struct dnet_io_req *r = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+
+	/*
+	 * Release previously processed transaction: either drop it if there are
+	 * no more queued replies, or put it at the tail of the ready list,
+	 * so that other transactions are not starved by the long reply stream.
+	 */
+	t = wio->trans;
+	if (t) {
+		wio->trans = NULL;
+		t->owner = NULL;
+
+		if (list_empty(&t->list)) {
+			hlist_del(&t->hash_entry);
+			free(t);
+		} else {
+			list_add_tail(&t->ready_entry, &pool->ready_list);
 		}
 	}
 
+	if (!list_empty(&pool->ready_list)) {
+		t = list_first_entry(&pool->ready_list, struct dnet_work_trans, ready_entry);
+		list_del_init(&t->ready_entry);
+
+		r = list_first_entry(&t->list, struct dnet_io_req, req_entry);
+		list_del_init(&r->req_entry);
+		list_stat_size_decrease(&pool->list_stats, 1);
+
+		t->owner = wio;
+		wio->trans = t;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return r;
+}
+
+/*
+ * Order matters: transaction processed by this thread is released first
+ * (and its next reply is taken if it is the oldest ready one), then own
+ * commands, then other replies, and only then we steal commands queued
+ * to other threads.
+ *
+ * @locked forces check of the reply queue under the pool lock, it is used
+ * right before going to sleep, when lockless peek is not enough.
+ */
+static struct dnet_io_req *dnet_work_io_take(struct dnet_work_io *wio, int locked)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_io_req *r;
+	int i;
+
+	/* only this thread sets its own transaction, so it is safe to check it without lock */
+	if (wio->trans) {
+		r = dnet_work_io_take_reply(wio);
+		if (r)
+			return r;
+	}
+
+	r = dnet_work_io_pop(wio);
+	if (r)
+		return r;
+
+	if (locked || !list_empty(&pool->ready_list)) {
+		r = dnet_work_io_take_reply(wio);
+		if (r)
+			return r;
+	}
+
+	for (i = 1; i < pool->num; ++i) {
+		r = dnet_work_io_pop(pool->wio[(wio->thread_index + i) % pool->num]);
+		if (r)
+			return r;
+	}
+
 	return NULL;
 }
 
@@ -701,40 +2134,34 @@ static void *dnet_io_process(void *data_)
 	struct dnet_work_pool *pool = wio->pool;
 	struct dnet_node *n = pool->n;
 	struct dnet_net_state *st;
-	struct timespec ts;
-	struct timeval tv;
 	struct dnet_io_req *r;
-	int err;
 	struct dnet_cmd *cmd;
 
 	dnet_set_name("io_pool");
 
 	while (!n->need_exit) {
-		r = NULL;
-		err = 0;
-
-		gettimeofday(&tv, NULL);
-		ts.tv_sec = tv.tv_sec + 1;
-		ts.tv_nsec = tv.tv_usec * 1000;
-
-		pthread_mutex_lock(&pool->lock);
+		r = dnet_work_io_take(wio, 0);
+		if (!r) {
+			/*
+			 * Announce that we are idle and check queues once again:
+			 * producer either sees @idle and wakes us up, or we will find its request.
+			 */
+			pthread_mutex_lock(&wio->lock);
+			wio->idle = 1;
+			pthread_mutex_unlock(&wio->lock);
 
-		pool->trans[wio->thread_index] = -1;
+			r = dnet_work_io_take(wio, 1);
 
-		if (!(r = take_request(pool, wio->thread_index))) {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if ((r = take_request(pool, wio->thread_index)))
-				err = 0;
-		}
+			pthread_mutex_lock(&wio->lock);
+			while (!r && !wio->wakeup && !n->need_exit)
+				pthread_cond_wait(&wio->wait, &wio->lock);
+			wio->idle = 0;
+			wio->wakeup = 0;
+			pthread_mutex_unlock(&wio->lock);
 
-		if (r) {
-			list_del_init(&r->req_entry);
-			list_stat_size_decrease(&pool->list_stats, 1);
+			if (!r)
+				continue;
 		}
-		pthread_mutex_unlock(&pool->lock);
-
-		if (!r || err)
-			continue;
 
 		st = r->st;
 		cmd = r->header;
@@ -743,7 +2170,9 @@ static void *dnet_io_process(void *data_)
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s\n",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode));
 
-		err = dnet_process_recv(st, r);
+		dnet_io_recv_time = r->time;
+		dnet_process_recv(st, r);
+		timerclear(&dnet_io_recv_time);
 		trace_id = 0;
 
 		dnet_io_req_free(r);
@@ -753,10 +2182,45 @@ static void *dnet_io_process(void *data_)
 	return NULL;
 }
 
+static void dnet_net_io_close(struct dnet_io *io, struct dnet_net_io *nio)
+{
+#ifdef HAVE_URING_SUPPORT
+	if (io->net_engine == DNET_NET_ENGINE_URING) {
+		dnet_uring_cleanup(nio);
+		return;
+	}
+#else
+	(void) io;
+#endif
+	close(nio->epoll_fd);
+}
+
+static void dnet_net_io_join(struct dnet_io *io, struct dnet_net_io *nio)
+{
+#ifdef HAVE_URING_SUPPORT
+	/* io_uring network thread waits for completions without timeout */
+	if (io->net_engine == DNET_NET_ENGINE_URING)
+		dnet_uring_wakeup(nio);
+#else
+	(void) io;
+#endif
+	pthread_join(nio->tid, NULL);
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
 	int err, i;
 	int io_size = sizeof(struct dnet_io) + sizeof(struct dnet_net_io) * cfg->net_thread_num;
+	void *(* process_network)(void *) = dnet_io_process_network;
+
+#ifndef HAVE_URING_SUPPORT
+	if (cfg->net_engine == DNET_NET_ENGINE_URING) {
+		dnet_log(n, DNET_LOG_ERROR, "io_uring network engine is not supported, "
+				"elliptics has to be built with liburing (WITH_URING)\n");
+		err = -ENOTSUP;
+		goto err_out_exit;
+	}
+#endif
 
 	n->io = malloc(io_size);
 	if (!n->io) {
@@ -766,6 +2230,7 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 	memset(n->io, 0, io_size);
 
+	n->io->net_engine = cfg->net_engine;
 	n->io->net_thread_num = cfg->net_thread_num;
 	n->io->net_thread_pos = 0;
 	n->io->net = (struct dnet_net_io *)(n->io + 1);
@@ -787,19 +2252,41 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 		nio->n = n;
 
-		nio->epoll_fd = epoll_create(10000);
-		if (nio->epoll_fd < 0) {
-			err = -errno;
-			dnet_log_err(n, "Failed to create epoll fd");
+		err = dnet_recv_cache_init(&nio->recv_cache);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to initialize receive buffer cache: %d\n", err);
 			goto err_out_net_destroy;
 		}
 
-		fcntl(nio->epoll_fd, F_SETFD, FD_CLOEXEC);
-		fcntl(nio->epoll_fd, F_SETFL, O_NONBLOCK);
+#ifdef HAVE_URING_SUPPORT
+		if (n->io->net_engine == DNET_NET_ENGINE_URING) {
+			err = dnet_uring_init(nio);
+			if (err) {
+				dnet_log(n, DNET_LOG_ERROR, "Failed to initialize io_uring: %d\n", err);
+				dnet_recv_cache_destroy(&nio->recv_cache);
+				goto err_out_net_destroy;
+			}
+
+			process_network = dnet_io_process_network_uring;
+		} else
+#endif
+		{
+			nio->epoll_fd = epoll_create(10000);
+			if (nio->epoll_fd < 0) {
+				err = -errno;
+				dnet_log_err(n, "Failed to create epoll fd");
+				dnet_recv_cache_destroy(&nio->recv_cache);
+				goto err_out_net_destroy;
+			}
+
+			fcntl(nio->epoll_fd, F_SETFD, FD_CLOEXEC);
+			fcntl(nio->epoll_fd, F_SETFL, O_NONBLOCK);
+		}
 
-		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
+		err = pthread_create(&nio->tid, NULL, process_network, nio);
 		if (err) {
-			close(nio->epoll_fd);
+			dnet_net_io_close(n->io, nio);
+			dnet_recv_cache_destroy(&nio->recv_cache);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d\n", err);
 			goto err_out_net_destroy;
@@ -810,8 +2297,9 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 err_out_net_destroy:
 	while (--i >= 0) {
-		pthread_join(n->io->net[i].tid, NULL);
-		close(n->io->net[i].epoll_fd);
+		dnet_net_io_join(n->io, &n->io->net[i]);
+		dnet_net_io_close(n->io, &n->io->net[i]);
+		dnet_recv_cache_destroy(&n->io->net[i].recv_cache);
 	}
 
 	dnet_work_pool_cleanup(n->io->recv_pool_nb);
@@ -831,15 +2319,30 @@ void dnet_io_exit(struct dnet_node *n)
 
 	n->need_exit = 1;
 
-	for (i=0; i<io->net_thread_num; ++i) {
-		pthread_join(io->net[i].tid, NULL);
-		close(io->net[i].epoll_fd);
-	}
+	for (i=0; i<io->net_thread_num; ++i)
+		dnet_net_io_join(io, &io->net[i]);
 
 	dnet_work_pool_cleanup(io->recv_pool_nb);
 	dnet_work_pool_cleanup(io->recv_pool);
 
+#ifdef HAVE_URING_SUPPORT
+	/* nobody submits anymore, operations in flight hold state references */
+	if (io->net_engine == DNET_NET_ENGINE_URING) {
+		for (i=0; i<io->net_thread_num; ++i)
+			dnet_uring_drain(&io->net[i]);
+	}
+#endif
+
 	dnet_io_cleanup_states(n);
 
+	/*
+	 * States are unscheduled at this point, so event engines can be closed.
+	 * All receive buffers are freed too: IO threads are stopped, network threads too.
+	 */
+	for (i=0; i<io->net_thread_num; ++i) {
+		dnet_net_io_close(io, &io->net[i]);
+		dnet_recv_cache_destroy(&io->net[i].recv_cache);
+	}
+
 	free(io);
 }
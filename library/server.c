@@ -218,6 +218,13 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data, str
 	if (err)
 		goto err_out_node_destroy;
 
+	if (cfg->trace_sample_rate > 0) {
+		if (!cfg_data || !cfg_data->trace_file)
+			dnet_log(n, DNET_LOG_ERROR, "Tracing is disabled: trace file is not set\n");
+		else if (dnet_node_set_trace_file(n, cfg_data->trace_file))
+			dnet_log(n, DNET_LOG_ERROR, "Tracing is disabled: failed to open trace file\n");
+	}
+
 	if (!n->notify_hash_size) {
 		n->notify_hash_size = DNET_DEFAULT_NOTIFY_HASH_SIZE;
 
@@ -327,6 +334,8 @@ void dnet_server_node_destroy(struct dnet_node *n)
 		free(n->config_data->cfg_addrs);
 		free(n->config_data->cfg_remotes);
 		free(n->config_data->cfg_backend);
+		free(n->config_data->cfg_state.slow_log);
+		free(n->config_data->trace_file);
 		free(n->config_data);
 	}
 
@@ -26,53 +26,84 @@
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
 
-static inline int dnet_trans_cmp(uint64_t old, uint64_t new)
+#define DNET_TRANS_TABLE_MIN_BITS	6
+
+/*
+ * Transaction ids are allocated by node-wide counter, so ids of the single
+ * state are not dense, multiplicative hash spreads them over all buckets
+ */
+static inline struct hlist_head *dnet_trans_bucket(struct dnet_trans_table *table, uint64_t trans)
 {
-	if (old > new)
-		return 1;
-	if (old < new)
-		return -1;
+	return &table->hash[(trans * 0x9e3779b97f4a7c15ULL) >> (64 - table->bits)];
+}
+
+static int dnet_trans_table_resize(struct dnet_trans_table *table, unsigned int bits)
+{
+	struct hlist_head *old = table->hash;
+	unsigned int old_size = old ? 1U << table->bits : 0;
+	struct hlist_node *pos, *tmp;
+	struct dnet_trans *t;
+	unsigned int i;
+
+	table->hash = malloc(sizeof(struct hlist_head) << bits);
+	if (!table->hash) {
+		table->hash = old;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < (1U << bits); ++i)
+		INIT_HLIST_HEAD(&table->hash[i]);
+	table->bits = bits;
+
+	for (i = 0; i < old_size; ++i) {
+		hlist_for_each_entry_safe(t, pos, tmp, &old[i], trans_entry)
+			hlist_add_head(&t->trans_entry, dnet_trans_bucket(table, t->trans));
+	}
+
+	free(old);
 	return 0;
 }
 
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans)
+void dnet_trans_table_destroy(struct dnet_trans_table *table)
 {
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
+	free(table->hash);
+	memset(table, 0, sizeof(struct dnet_trans_table));
+}
 
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, trans_entry);
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *table, uint64_t trans)
+{
+	struct hlist_node *pos;
+	struct dnet_trans *t;
 
-		cmp = dnet_trans_cmp(t->trans, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
+	if (!table->hash)
+		return NULL;
+
+	hlist_for_each_entry(t, pos, dnet_trans_bucket(table, trans), trans_entry) {
+		if (t->trans == trans)
 			return dnet_trans_get(t);
 	}
 
 	return NULL;
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
+int dnet_trans_insert_nolock(struct dnet_trans_table *table, struct dnet_trans *a)
 {
-	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct hlist_head *head;
+	struct hlist_node *pos;
 	struct dnet_trans *t;
-	int cmp;
+	int err;
 
-	while (*n) {
-		parent = *n;
+	if (!table->hash || table->num >= (1U << table->bits)) {
+		err = dnet_trans_table_resize(table, table->hash ? table->bits + 1 : DNET_TRANS_TABLE_MIN_BITS);
 
-		t = rb_entry(parent, struct dnet_trans, trans_entry);
+		/* failed growth only makes chains longer */
+		if (err && !table->hash)
+			return err;
+	}
 
-		cmp = dnet_trans_cmp(t->trans, a->trans);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
+	head = dnet_trans_bucket(table, a->trans);
+	hlist_for_each_entry(t, pos, head, trans_entry) {
+		if (t->trans == a->trans)
 			return -EEXIST;
 	}
 
@@ -81,24 +112,23 @@ int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
 			dnet_dump_id(&a->cmd.id), (unsigned long long)a->trans,
 			dnet_server_convert_dnet_addr(&a->st->addr));
 
-	rb_link_node(&a->trans_entry, parent, n);
-	rb_insert_color(&a->trans_entry, root);
+	hlist_add_head(&a->trans_entry, head);
+	table->num++;
 	return 0;
 }
 
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t)
+void dnet_trans_remove_nolock(struct dnet_trans_table *table, struct dnet_trans *t)
 {
-	if (!t->trans_entry.rb_parent_color) {
+	if (hlist_unhashed(&t->trans_entry)) {
 		if (t->st && t->st->n)
 			dnet_log(t->st->n, DNET_LOG_ERROR, "%s: trying to remove standalone transaction %llu.\n",
 				dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans);
 		return;
 	}
 
-	if (t) {
-		rb_erase(&t->trans_entry, root);
-		t->trans_entry.rb_parent_color = 0;
-	}
+	__hlist_del(&t->trans_entry);
+	INIT_HLIST_NODE(&t->trans_entry);
+	table->num--;
 }
 
 void dnet_trans_remove(struct dnet_trans *t)
@@ -106,23 +136,334 @@ void dnet_trans_remove(struct dnet_trans *t)
 	struct dnet_net_state *st = t->st;
 
 	pthread_mutex_lock(&st->trans_lock);
-	dnet_trans_remove_nolock(&st->trans_root, t);
-	list_del_init(&t->trans_list_entry);
+	dnet_trans_remove_nolock(&st->trans_table, t);
+	dnet_trans_timer_del(t);
 	pthread_mutex_unlock(&st->trans_lock);
 }
 
-struct dnet_trans *dnet_trans_alloc(struct dnet_node *n __unused, uint64_t size)
+/* maximum trailing payload of every size class */
+static const uint64_t dnet_trans_pool_sizes[DNET_TRANS_POOL_CLASSES] = {128, 512, 4096};
+
+static void dnet_trans_obj_free_list(struct dnet_trans_obj *obj)
+{
+	struct dnet_trans_obj *next;
+
+	while (obj) {
+		next = obj->next;
+		free(obj);
+		obj = next;
+	}
+}
+
+/* must be called under pool->lock */
+static void dnet_trans_pool_put_nolock(struct dnet_trans_pool *pool, struct dnet_trans_obj *obj)
+{
+	if (pool->num[obj->cls] >= DNET_TRANS_POOL_MAX_FREE) {
+		free(obj);
+		return;
+	}
+
+	obj->next = pool->free[obj->cls];
+	pool->free[obj->cls] = obj;
+	pool->num[obj->cls]++;
+}
+
+/* pthread key destructor: returns cached objects of exiting thread to the pool */
+static void dnet_trans_cache_destroy(void *data)
+{
+	struct dnet_trans_cache *cache = data;
+	struct dnet_trans_pool *pool = cache->pool;
+	struct dnet_trans_obj *obj;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < DNET_TRANS_POOL_CLASSES; ++i) {
+		while ((obj = cache->free[i])) {
+			cache->free[i] = obj->next;
+			dnet_trans_pool_put_nolock(pool, obj);
+		}
+	}
+
+	pool->alloc += cache->alloc;
+	pool->freed += cache->freed;
+	pool->miss += cache->miss;
+
+	list_del(&cache->cache_entry);
+	pthread_mutex_unlock(&pool->lock);
+
+	free(cache);
+}
+
+static struct dnet_trans_cache *dnet_trans_cache_get(struct dnet_trans_pool *pool)
+{
+	struct dnet_trans_cache *cache;
+
+	cache = pthread_getspecific(pool->key);
+	if (cache)
+		return cache;
+
+	cache = malloc(sizeof(struct dnet_trans_cache));
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(struct dnet_trans_cache));
+	cache->pool = pool;
+
+	if (pthread_setspecific(pool->key, cache)) {
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	list_add_tail(&cache->cache_entry, &pool->cache_list);
+	pthread_mutex_unlock(&pool->lock);
+
+	return cache;
+}
+
+/* moves half of the thread cache capacity from the pool */
+static void dnet_trans_cache_refill(struct dnet_trans_cache *cache, int cls)
+{
+	struct dnet_trans_pool *pool = cache->pool;
+	struct dnet_trans_obj *obj;
+
+	pthread_mutex_lock(&pool->lock);
+	while (cache->num[cls] < DNET_TRANS_CACHE_MAX / 2 && (obj = pool->free[cls])) {
+		pool->free[cls] = obj->next;
+		pool->num[cls]--;
+
+		obj->next = cache->free[cls];
+		cache->free[cls] = obj;
+		cache->num[cls]++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void dnet_trans_cache_flush(struct dnet_trans_cache *cache, int cls)
+{
+	struct dnet_trans_pool *pool = cache->pool;
+	struct dnet_trans_obj *obj;
+
+	pthread_mutex_lock(&pool->lock);
+	while (cache->num[cls] > DNET_TRANS_CACHE_MAX / 2) {
+		obj = cache->free[cls];
+		cache->free[cls] = obj->next;
+		cache->num[cls]--;
+
+		dnet_trans_pool_put_nolock(pool, obj);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static struct dnet_trans_obj *dnet_trans_obj_alloc(struct dnet_trans_pool *pool, uint64_t size)
+{
+	struct dnet_trans_cache *cache = NULL;
+	struct dnet_trans_obj *obj = NULL;
+	int cls;
+
+	for (cls = 0; cls < DNET_TRANS_POOL_CLASSES; ++cls) {
+		if (size <= dnet_trans_pool_sizes[cls])
+			break;
+	}
+
+	if (pool)
+		cache = dnet_trans_cache_get(pool);
+
+	if (cache && cls < DNET_TRANS_POOL_CLASSES) {
+		if (!cache->free[cls])
+			dnet_trans_cache_refill(cache, cls);
+
+		obj = cache->free[cls];
+		if (obj) {
+			cache->free[cls] = obj->next;
+			cache->num[cls]--;
+		}
+	}
+
+	if (!obj) {
+		if (cls < DNET_TRANS_POOL_CLASSES)
+			size = dnet_trans_pool_sizes[cls];
+		else
+			cls = -1;
+
+		obj = malloc(sizeof(struct dnet_trans_obj) + sizeof(struct dnet_trans) + size);
+		if (!obj)
+			return NULL;
+
+		obj->pool = pool;
+		obj->cls = cls;
+
+		if (cache) {
+			cache->miss++;
+		} else if (pool) {
+			pthread_mutex_lock(&pool->lock);
+			pool->miss++;
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+
+	if (cache) {
+		cache->alloc++;
+	} else if (pool) {
+		pthread_mutex_lock(&pool->lock);
+		pool->alloc++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return obj;
+}
+
+static void dnet_trans_obj_free(struct dnet_trans_obj *obj)
 {
+	struct dnet_trans_pool *pool = obj->pool;
+	struct dnet_trans_cache *cache;
+
+	if (!pool) {
+		free(obj);
+		return;
+	}
+
+	cache = dnet_trans_cache_get(pool);
+	if (!cache) {
+		pthread_mutex_lock(&pool->lock);
+		pool->freed++;
+		if (obj->cls >= 0)
+			dnet_trans_pool_put_nolock(pool, obj);
+		else
+			free(obj);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	cache->freed++;
+
+	if (obj->cls < 0) {
+		free(obj);
+		return;
+	}
+
+	obj->next = cache->free[obj->cls];
+	cache->free[obj->cls] = obj;
+	if (++cache->num[obj->cls] > DNET_TRANS_CACHE_MAX)
+		dnet_trans_cache_flush(cache, obj->cls);
+}
+
+int dnet_trans_pool_init(struct dnet_node *n)
+{
+	struct dnet_trans_pool *pool;
+	int err;
+
+	pool = malloc(sizeof(struct dnet_trans_pool));
+	if (!pool) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(pool, 0, sizeof(struct dnet_trans_pool));
+	INIT_LIST_HEAD(&pool->cache_list);
+
+	err = pthread_mutex_init(&pool->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	err = pthread_key_create(&pool->key, dnet_trans_cache_destroy);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_lock;
+	}
+
+	n->trans_pool = pool;
+	return 0;
+
+err_out_destroy_lock:
+	pthread_mutex_destroy(&pool->lock);
+err_out_free:
+	free(pool);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "Failed to initialize transaction pool: %d\n", err);
+	return err;
+}
+
+/*
+ * Caches of still running threads are freed here, key is deleted first,
+ * so their destructors will not be called
+ */
+void dnet_trans_pool_cleanup(struct dnet_node *n)
+{
+	struct dnet_trans_pool *pool = n->trans_pool;
+	struct dnet_trans_cache *cache, *tmp;
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_key_delete(pool->key);
+
+	list_for_each_entry_safe(cache, tmp, &pool->cache_list, cache_entry) {
+		list_del(&cache->cache_entry);
+
+		for (i = 0; i < DNET_TRANS_POOL_CLASSES; ++i)
+			dnet_trans_obj_free_list(cache->free[i]);
+		free(cache);
+	}
+
+	for (i = 0; i < DNET_TRANS_POOL_CLASSES; ++i)
+		dnet_trans_obj_free_list(pool->free[i]);
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	n->trans_pool = NULL;
+}
+
+/* counters of other threads' caches are read without their owners' synchronization */
+void dnet_trans_pool_stat(struct dnet_node *n, uint64_t *used, uint64_t *cached, uint64_t *miss)
+{
+	struct dnet_trans_pool *pool = n->trans_pool;
+	struct dnet_trans_cache *cache;
+	uint64_t alloc, freed;
+	int i;
+
+	*used = *cached = *miss = 0;
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	alloc = pool->alloc;
+	freed = pool->freed;
+	*miss = pool->miss;
+	for (i = 0; i < DNET_TRANS_POOL_CLASSES; ++i)
+		*cached += pool->num[i];
+
+	list_for_each_entry(cache, &pool->cache_list, cache_entry) {
+		alloc += cache->alloc;
+		freed += cache->freed;
+		*miss += cache->miss;
+
+		for (i = 0; i < DNET_TRANS_POOL_CLASSES; ++i)
+			*cached += cache->num[i];
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	*used = alloc > freed ? alloc - freed : 0;
+}
+
+struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size)
+{
+	struct dnet_trans_obj *obj;
 	struct dnet_trans *t;
 
-	t = malloc(sizeof(struct dnet_trans) + size);
-	if (!t)
+	obj = dnet_trans_obj_alloc(n ? n->trans_pool : NULL, size);
+	if (!obj)
 		goto err_out_exit;
 
+	t = (struct dnet_trans *)(obj + 1);
 	memset(t, 0, sizeof(struct dnet_trans) + size);
 
 	atomic_init(&t->refcnt, 1);
 	INIT_LIST_HEAD(&t->trans_list_entry);
+	INIT_LIST_HEAD(&t->expire_entry);
 
 	gettimeofday(&t->start, NULL);
 
@@ -148,10 +489,10 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		st = t->st;
 
 		pthread_mutex_lock(&st->trans_lock);
-		list_del_init(&t->trans_list_entry);
+		dnet_trans_timer_del(t);
 		pthread_mutex_unlock(&st->trans_lock);
 
-		if (t->trans_entry.rb_parent_color)
+		if (!hlist_unhashed(&t->trans_entry))
 			dnet_trans_remove(t);
 	} else if (!list_empty(&t->trans_list_entry)) {
 		assert(0);
@@ -196,7 +537,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 	dnet_state_put(t->st);
 	dnet_state_put(t->orig);
 
-	free(t);
+	dnet_trans_obj_free((struct dnet_trans_obj *)t - 1);
 }
 
 int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl)
@@ -302,76 +643,335 @@ static void dnet_trans_clean_list(struct list_head *head)
 	}
 }
 
-static void dnet_trans_check_stall(struct dnet_net_state *st, struct list_head *head)
+uint64_t dnet_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#define DNET_TIMER_L0_SIZE		(1 << DNET_TIMER_L0_BITS)
+#define DNET_TIMER_LN_SIZE		(1 << DNET_TIMER_LN_BITS)
+#define DNET_TIMER_LN_MASK		(DNET_TIMER_LN_SIZE - 1)
+#define DNET_TIMER_LEVEL_SHIFT(l)	(DNET_TIMER_L0_BITS + ((l) - 1) * DNET_TIMER_LN_BITS)
+#define DNET_TIMER_MAX_DELTA		((1ULL << DNET_TIMER_LEVEL_SHIFT(DNET_TIMER_LEVELS)) - 1)
+
+/* longest sleep of timer thread, it also checks need_exit */
+#define DNET_TIMER_MAX_SLEEP		1000
+
+static inline struct dnet_timer_shard *dnet_timer_shard(struct dnet_timer *timer, uint64_t trans)
+{
+	return &timer->shard[trans & (DNET_TIMER_SHARDS - 1)];
+}
+
+static inline struct list_head *dnet_timer_slot(struct dnet_timer_shard *shard, int level, unsigned int idx)
+{
+	if (!level)
+		return &shard->slots[idx];
+
+	return &shard->slots[DNET_TIMER_L0_SIZE + (level - 1) * DNET_TIMER_LN_SIZE + idx];
+}
+
+/* timer must not be in the past relative to shard->now */
+static void dnet_timer_shard_add(struct dnet_timer_shard *shard, struct dnet_trans *t)
+{
+	uint64_t delta = t->expires - shard->now;
+	struct list_head *slot;
+	int level;
+
+	if (delta < DNET_TIMER_L0_SIZE) {
+		slot = dnet_timer_slot(shard, 0, t->expires & (DNET_TIMER_L0_SIZE - 1));
+	} else {
+		if (delta > DNET_TIMER_MAX_DELTA) {
+			t->expires = shard->now + DNET_TIMER_MAX_DELTA;
+			delta = DNET_TIMER_MAX_DELTA;
+		}
+
+		for (level = 1; level < DNET_TIMER_LEVELS - 1; ++level) {
+			if (delta < (1ULL << DNET_TIMER_LEVEL_SHIFT(level + 1)))
+				break;
+		}
+
+		slot = dnet_timer_slot(shard, level, (t->expires >> DNET_TIMER_LEVEL_SHIFT(level)) & DNET_TIMER_LN_MASK);
+	}
+
+	list_add_tail(&t->trans_list_entry, slot);
+}
+
+void dnet_trans_timer_add(struct dnet_trans *t, struct timespec *wait_ts)
+{
+	struct dnet_timer *timer = t->st->n->timer;
+	struct dnet_timer_shard *shard = dnet_timer_shard(timer, t->trans);
+	uint64_t expires;
+
+	expires = dnet_time_ms() + wait_ts->tv_sec * 1000 + wait_ts->tv_nsec / 1000000;
+
+	pthread_mutex_lock(&shard->lock);
+	if (t->timer_armed)
+		list_del_init(&t->trans_list_entry);
+
+	/* current tick has been already processed */
+	if (expires <= shard->now)
+		expires = shard->now + 1;
+
+	t->expires = expires;
+	t->timer_armed = 1;
+	t->timer_seq++;
+	dnet_timer_shard_add(shard, t);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (expires < timer->earliest) {
+		pthread_mutex_lock(&timer->wait_lock);
+		if (expires < timer->earliest) {
+			timer->earliest = expires;
+			pthread_cond_signal(&timer->wait);
+		}
+		pthread_mutex_unlock(&timer->wait_lock);
+	}
+}
+
+void dnet_trans_timer_del(struct dnet_trans *t)
+{
+	struct dnet_timer_shard *shard = dnet_timer_shard(t->st->n->timer, t->trans);
+
+	pthread_mutex_lock(&shard->lock);
+	if (t->timer_armed) {
+		list_del_init(&t->trans_list_entry);
+		t->timer_armed = 0;
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void dnet_timer_cascade(struct dnet_timer_shard *shard, int level)
+{
+	unsigned int idx = (shard->now >> DNET_TIMER_LEVEL_SHIFT(level)) & DNET_TIMER_LN_MASK;
+	struct list_head *slot = dnet_timer_slot(shard, level, idx);
+	struct dnet_trans *t, *tmp;
+
+	list_for_each_entry_safe(t, tmp, slot, trans_list_entry) {
+		list_del_init(&t->trans_list_entry);
+		dnet_timer_shard_add(shard, t);
+	}
+
+	if (!idx && level < DNET_TIMER_LEVELS - 1)
+		dnet_timer_cascade(shard, level + 1);
+}
+
+/*
+ * Moves transactions expired up to @now into @expired list and returns
+ * the time when shard has to be run again. Armed transaction is always
+ * present in its state's transaction table, which holds a reference,
+ * so it is safe to grab another one here.
+ */
+static uint64_t dnet_timer_shard_run(struct dnet_timer_shard *shard, uint64_t now, struct list_head *expired)
 {
 	struct dnet_trans *t, *tmp;
+	struct list_head *slot;
+	uint64_t next;
+
+	pthread_mutex_lock(&shard->lock);
+	while (shard->now < now) {
+		shard->now++;
+
+		if (!(shard->now & (DNET_TIMER_L0_SIZE - 1)))
+			dnet_timer_cascade(shard, 1);
+
+		slot = dnet_timer_slot(shard, 0, shard->now & (DNET_TIMER_L0_SIZE - 1));
+		list_for_each_entry_safe(t, tmp, slot, trans_list_entry) {
+			list_del_init(&t->trans_list_entry);
+			t->timer_armed = 0;
+			t->expire_seq = t->timer_seq;
+
+			dnet_trans_get(t);
+			list_add_tail(&t->expire_entry, expired);
+		}
+	}
+
+	/* the first non-empty level 0 slot or the next cascade */
+	for (next = shard->now + 1; next & (DNET_TIMER_L0_SIZE - 1); ++next) {
+		if (!list_empty(dnet_timer_slot(shard, 0, next & (DNET_TIMER_L0_SIZE - 1))))
+			break;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return next;
+}
+
+static void dnet_trans_timeout(struct dnet_trans *t, struct list_head *head)
+{
+	struct dnet_net_state *st = t->st;
 	struct timeval tv;
-	int trans_timeout = 0;
+	int timed_out = 0;
 	char str[64];
 	struct tm tm;
 
+	/* transaction could be replied, removed or rearmed after it was taken from the wheel */
+	pthread_mutex_lock(&st->trans_lock);
+	if (t->expire_seq == t->timer_seq && !t->timer_armed && !hlist_unhashed(&t->trans_entry)) {
+		dnet_trans_remove_nolock(&st->trans_table, t);
+		list_add_tail(&t->trans_list_entry, head);
+		timed_out = 1;
+	}
+	pthread_mutex_unlock(&st->trans_lock);
+
+	if (!timed_out)
+		return;
+
+	localtime_r((time_t *)&t->start.tv_sec, &tm);
+	strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT: wait-ts: %ld.%03ld, cmd: %s [%d], started: %s.%06lu\n",
+			dnet_state_dump_addr(st), (unsigned long long)t->trans,
+			(unsigned long)t->wait_ts.tv_sec, t->wait_ts.tv_nsec / 1000000,
+			dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
+			str, t->start.tv_usec);
+
+	/* stall counter is increased once per second with timeouts and reset by any reply */
 	gettimeofday(&tv, NULL);
+	if (st->stall_time == tv.tv_sec)
+		return;
 
-	pthread_mutex_lock(&st->trans_lock);
-	list_for_each_entry_safe(t, tmp, &st->trans_list, trans_list_entry) {
-		if (t->time.tv_sec >= tv.tv_sec)
-			break;
+	st->stall_time = tv.tv_sec;
+	st->stall++;
 
-		localtime_r((time_t *)&t->start.tv_sec, &tm);
-		strftime(str, sizeof(str), "%F %R:%S", &tm);
+	if (st->weight >= 2)
+		st->weight /= 2;
 
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT: stall-check wait-ts: %ld, cmd: %s [%d], started: %s.%06lu\n",
-				dnet_state_dump_addr(st), (unsigned long long)t->trans,
-				(unsigned long)t->wait_ts.tv_sec,
-				dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
-				str, t->start.tv_usec);
-		trans_timeout++;
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: stall counter: %d/%ld, weight: %f\n",
+			dnet_state_dump_addr(st), st->stall, st->n->stall_count, st->weight);
 
-		dnet_trans_remove_nolock(&st->trans_root, t);
-		list_move(&t->trans_list_entry, head);
+	if (st->stall >= st->n->stall_count)
+		dnet_state_reset(st, -ETIMEDOUT);
+}
+
+/*
+ * Expires transactions in all shards and returns the time to run again.
+ * Timed out transactions' callbacks are called without any lock held.
+ */
+static uint64_t dnet_trans_timer_run(struct dnet_node *n)
+{
+	struct dnet_timer *timer = n->timer;
+	uint64_t now = dnet_time_ms();
+	uint64_t next = now + DNET_TIMER_MAX_SLEEP, shard_next;
+	struct dnet_trans *t, *tmp;
+	LIST_HEAD(expired);
+	LIST_HEAD(head);
+	int i;
+
+	for (i = 0; i < DNET_TIMER_SHARDS; ++i) {
+		shard_next = dnet_timer_shard_run(&timer->shard[i], now, &expired);
+		if (shard_next < next)
+			next = shard_next;
 	}
-	pthread_mutex_unlock(&st->trans_lock);
 
-	if (trans_timeout) {
-		st->stall++;
+	list_for_each_entry_safe(t, tmp, &expired, expire_entry) {
+		list_del_init(&t->expire_entry);
 
-		if (st->weight >= 2)
-			st->weight /= 2;
+		dnet_trans_timeout(t, &head);
+		dnet_trans_put(t);
+	}
 
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%u, weight: %f\n",
-				dnet_state_dump_addr(st), trans_timeout, st->stall, DNET_DEFAULT_STALL_TRANSACTIONS, st->weight);
+	dnet_trans_clean_list(&head);
 
-		if (st->stall >= st->n->stall_count) {
-			dnet_state_reset(st, -ETIMEDOUT);
-		}
-	} else {
-		st->stall = 0;
+	return next;
+}
 
-		if (st->weight < DNET_STATE_MAX_WEIGHT)
-			st->weight *= 1.2;
+static void dnet_trans_timer_sleep(struct dnet_node *n, uint64_t next)
+{
+	struct dnet_timer *timer = n->timer;
+	struct timespec ts;
 
-		if (st->stall) {
-			dnet_log(st->n, DNET_LOG_INFO, "%s: reseting state stall counter: weight: %f\n",
-					dnet_state_dump_addr(st), st->weight);
-		}
+	pthread_mutex_lock(&timer->wait_lock);
+	if (timer->earliest < next)
+		next = timer->earliest;
+
+	if (next > dnet_time_ms() && !n->need_exit) {
+		ts.tv_sec = next / 1000;
+		ts.tv_nsec = (next % 1000) * 1000000;
+
+		pthread_cond_timedwait(&timer->wait, &timer->wait_lock, &ts);
 	}
+
+	/* timers added from now on are noticed by the next run */
+	timer->earliest = ~0ULL;
+	pthread_mutex_unlock(&timer->wait_lock);
 }
 
-static void dnet_check_all_states(struct dnet_node *n)
+int dnet_trans_timer_init(struct dnet_node *n)
 {
-	struct dnet_net_state *st, *tmp;
-	struct dnet_group *g, *gtmp;
-	LIST_HEAD(head);
+	struct dnet_timer *timer;
+	pthread_condattr_t attr;
+	int err, i, j;
 
-	pthread_mutex_lock(&n->state_lock);
-	list_for_each_entry_safe(g, gtmp, &n->group_list, group_entry) {
-		list_for_each_entry_safe(st, tmp, &g->state_list, state_entry) {
-			dnet_trans_check_stall(st, &head);
+	timer = malloc(sizeof(struct dnet_timer));
+	if (!timer) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(timer, 0, sizeof(struct dnet_timer));
+
+	for (i = 0; i < DNET_TIMER_SHARDS; ++i) {
+		struct dnet_timer_shard *shard = &timer->shard[i];
+
+		err = pthread_mutex_init(&shard->lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_destroy_shards;
 		}
+
+		shard->now = dnet_time_ms();
+		for (j = 0; j < DNET_TIMER_SLOTS; ++j)
+			INIT_LIST_HEAD(&shard->slots[j]);
 	}
-	pthread_mutex_unlock(&n->state_lock);
 
-	dnet_trans_clean_list(&head);
+	err = pthread_mutex_init(&timer->wait_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_shards;
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	err = pthread_cond_init(&timer->wait, &attr);
+	pthread_condattr_destroy(&attr);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_wait_lock;
+	}
+
+	timer->earliest = ~0ULL;
+	n->timer = timer;
+	return 0;
+
+err_out_destroy_wait_lock:
+	pthread_mutex_destroy(&timer->wait_lock);
+err_out_destroy_shards:
+	while (--i >= 0)
+		pthread_mutex_destroy(&timer->shard[i].lock);
+	free(timer);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "Failed to initialize transaction timer: %d\n", err);
+	return err;
+}
+
+void dnet_trans_timer_cleanup(struct dnet_node *n)
+{
+	struct dnet_timer *timer = n->timer;
+	int i;
+
+	if (!timer)
+		return;
+
+	for (i = 0; i < DNET_TIMER_SHARDS; ++i)
+		pthread_mutex_destroy(&timer->shard[i].lock);
+
+	pthread_cond_destroy(&timer->wait);
+	pthread_mutex_destroy(&timer->wait_lock);
+
+	free(timer);
+	n->timer = NULL;
 }
 
 static int dnet_check_route_table(struct dnet_node *n)
@@ -454,12 +1054,13 @@ static void *dnet_reconnect_process(void *data)
 static void *dnet_check_process(void *data)
 {
 	struct dnet_node *n = data;
+	uint64_t next;
 
 	dnet_set_name("stall-check");
 
 	while (!n->need_exit) {
-		dnet_check_all_states(n);
-		sleep(1);
+		next = dnet_trans_timer_run(n);
+		dnet_trans_timer_sleep(n, next);
 	}
 
 	return NULL;